@@ -0,0 +1,77 @@
+﻿
+//
+// IMA ADPCMの展開
+//
+
+#include "adpcm.hpp"
+#include <algorithm>
+
+
+static const int index_table[16] = {
+  -1, -1, -1, -1, 2, 4, 6, 8,
+  -1, -1, -1, -1, 2, 4, 6, 8,
+};
+
+static const int step_table[89] = {
+  7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+  19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+  50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+  130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+  337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+  876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+  2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+  5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+  15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+
+// 4bitの差分をひとつ展開する
+static int16_t decodeNibble(const int nibble, int& predictor, int& index) {
+  int step = step_table[index];
+
+  int diff = step >> 3;
+  if (nibble & 1) diff += step >> 2;
+  if (nibble & 2) diff += step >> 1;
+  if (nibble & 4) diff += step;
+  if (nibble & 8) diff = -diff;
+
+  predictor = std::min(std::max(predictor + diff, -32768), 32767);
+  index     = std::min(std::max(index + index_table[nibble], 0), 88);
+
+  return int16_t(predictor);
+}
+
+
+// ブロックに入っているサンプル数(1チャンネルあたり)
+u_int imaAdpcmBlockFrames(const u_int block_size, const u_int ch) {
+  // TIPS:ヘッダに1サンプル、残りは1バイトに2サンプル
+  return (block_size - 4 * ch) * 2 / ch + 1;
+}
+
+// ブロックを16bit PCMに展開する
+// TIPS:ブロックの先頭にはチャンネルごとに4バイトのヘッダ(初期値と量子化幅の番号)があり、
+//      続くデータはチャンネルごとに4バイト(8サンプル)ずつ交互に並んでいる
+void decodeImaAdpcmBlock(const u_char* block, const u_int block_size, const u_int ch,
+                         int16_t* out) {
+  int predictor[2];
+  int index[2];
+  for (u_int c = 0; c < ch; ++c) {
+    const u_char* header = block + c * 4;
+    predictor[c] = int16_t(header[0] | (header[1] << 8));
+    index[c]     = std::min(int(header[2]), 88);
+    out[c]       = int16_t(predictor[c]);
+  }
+
+  const u_char* data = block + ch * 4;
+  u_int groups = (block_size - ch * 4) / (ch * 4);
+  for (u_int g = 0; g < groups; ++g) {
+    for (u_int c = 0; c < ch; ++c) {
+      int16_t* dst = out + (1 + g * 8) * ch + c;
+      for (u_int i = 0; i < 4; ++i) {
+        u_char value = *data++;
+        dst[(i * 2) * ch]     = decodeNibble(value & 0xf, predictor[c], index[c]);
+        dst[(i * 2 + 1) * ch] = decodeNibble(value >> 4,  predictor[c], index[c]);
+      }
+    }
+  }
+}
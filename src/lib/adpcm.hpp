@@ -0,0 +1,24 @@
+﻿
+#pragma once
+
+//
+// IMA ADPCMの展開
+// 効果音などを圧縮したままメモリに置いておき、再生する時に展開する
+//
+
+#include "defines.hpp"
+#include <cstdint>
+
+
+// ブロックに入っているサンプル数(1チャンネルあたり)
+// block_size ブロックのバイト数
+// ch         チャンネル数
+u_int imaAdpcmBlockFrames(const u_int block_size, const u_int ch);
+
+// ブロックを16bit PCMに展開する
+// block      ブロックの先頭
+// block_size ブロックのバイト数
+// ch         チャンネル数
+// out        展開先(imaAdpcmBlockFrames() * ch 個ぶんの領域)
+void decodeImaAdpcmBlock(const u_char* block, const u_int block_size, const u_int ch,
+                         int16_t* out);
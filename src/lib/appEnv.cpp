@@ -4,6 +4,10 @@
 
 #include "appEnv.hpp"
 #include <iostream>
+#include <thread>
+#include <chrono>
+#include "batch.hpp"
+#include "font.hpp"
 
 
 // width, height 生成時のサイズ
@@ -19,11 +23,16 @@ AppEnv::AppEnv(const int width, const int height,
     viewport_ofs_(0, 0),
     viewport_size_(width, height),
     bg_color_(0, 0, 0, 0),
+    pushed_key_(0),
     mouse_current_pos_(0, 0),
+    mouse_motion_(0, 0),
+    cursor_mode_(GLFW_CURSOR_NORMAL),
     is_focus_(false)
 {
   DOUT << "AppEnv()" << std::endl;
 
+  input_events_.reserve(256);
+
   // Windowを画面の中央へ移動
   const auto* video_mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
   glfwSetWindowPos(window_(), (video_mode->width - width) / 2, (video_mode->height - height) / 2);
@@ -64,6 +73,13 @@ AppEnv::AppEnv(const int width, const int height,
   }
 }
 
+AppEnv::~AppEnv() {
+  DOUT << "~AppEnv()" << std::endl;
+
+  // TIPS:抜き差しの通知から、破棄した自分を呼ばせない
+  disconnectGamePadCallback({});
+}
+
 
 // アプリウインドウが開いてるならtrueを返す
 bool AppEnv::isOpen() {
@@ -114,24 +130,44 @@ void AppEnv::begin() {
   glMatrixMode(GL_MODELVIEW);
   glLoadMatrixf(glm::value_ptr(matrix.second));
 
-  updateGamePad(gamepads_);
+  updateInput();
 }
 
 // アプリ更新処理終了
 // 1. OpenGLの描画内容をウインドウに表示
 // 2. キーやマウスイベントのポーリング
 void AppEnv::end() {
+  // 溜まっている描画を済ませる
+  flushBatch();
+  // グリフの使用状況を記録するため
+  FontAtlas::nextFrame();
+
   // GLFWへ描画指示
   glfwSwapBuffers(window_());
 
   // 入力(キー＆ボタン)の再初期化
   switchInputBuffer();
 
-  if (!is_focus_) {
+  // フレームの途中で起きた入力を、次のフレームの入力に含める
+  // TIPS:入力状況にはもう反映してあるので、記録されるようにするだけ
+  input_events_.insert(std::end(input_events_), std::begin(pending_events_), std::end(pending_events_));
+  pending_events_.clear();
+
+  if (!is_focus_ && !player_) {
     // TIPS:OSXはWindow全面が覆い隠されると、全速力で更新が行われてしまう
     //      それに対処するためイベント待ちをおこなっている
-    glfwWaitEvents();
+    if (sampler_) {
+      // TIPS:イベント待ちの間ずっと読み取りスレッドを止めないように、GLFWを触らずに待つ
+      std::this_thread::sleep_for(std::chrono::milliseconds(16));
+    }
+    else {
+      glfwWaitEvents();
+    }
   }
+
+  // TIPS:GamePadを読み取るスレッドと同時にGLFWを触らない
+  std::unique_lock<std::mutex> lock;
+  if (sampler_) lock = std::unique_lock<std::mutex>(sampler_->glfwMutex());
   glfwPollEvents();
 }
   
@@ -177,19 +213,19 @@ u_int AppEnv::getPushedKey() const { return pushed_key_; }
 // key 'A'とか'7'とか
 // SOURCE:include/GLFW/glfw3.h 271〜396
 bool AppEnv::isKeyPressing(const int key) const {
-  return press_keys_.count(key);
+  return (key >= 0) && (key <= GLFW_KEY_LAST) && press_keys_[key];
 }
   
 // 当該キーが押された瞬間trueを返す
 // key 'A'とか'7'とか
 // SOURCE:include/GLFW/glfw3.h 271〜396
 bool AppEnv::isKeyPushed(const int key) const {
-  return push_keys_.count(key);
+  return (key >= 0) && (key <= GLFW_KEY_LAST) && push_keys_[key];
 }
 
 // 当該キーが離された瞬間trueを返す
 bool AppEnv::isKeyReleased(const int key) const {
-  return pull_keys_.count(key);
+  return (key >= 0) && (key <= GLFW_KEY_LAST) && pull_keys_[key];
 }
 
   
@@ -208,6 +244,38 @@ void AppEnv::mousePosition(const Vec2f& pos) {
   glfwSetCursorPos(window_(), mouse_pos.x, mouse_pos.y);
 }
 
+// 前のフレームからのマウスの移動量
+const Vec2f& AppEnv::mouseMotion() const { return mouse_motion_; }
+
+// マウスの移動量をOSから直接受け取る
+bool AppEnv::rawMouseMotion(const bool enable) {
+  if (enable) {
+    // TIPS:続けて有効にした時に、消した状態を覚えてしまわないようにする
+    int mode = glfwGetInputMode(window_(), GLFW_CURSOR);
+    if (mode != GLFW_CURSOR_DISABLED) cursor_mode_ = mode;
+    glfwSetInputMode(window_(), GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+  }
+  else {
+    glfwSetInputMode(window_(), GLFW_CURSOR, cursor_mode_);
+  }
+
+  // TIPS:切り替えるとカーソルの位置が飛ぶので、移動量に含めない
+  //      再生中は、記録した MOUSE_WARP が次のフレームで位置を合わせる
+  if (!player_) {
+    double x_pos, y_pos;
+    glfwGetCursorPos(window_(), &x_pos, &y_pos);
+    Vec2f pos = screenPosition(Vec2f(x_pos - viewport_ofs_.x, y_pos - viewport_ofs_.y),
+                               current_window_size_, Vec2f(viewport_size_.x, viewport_size_.y));
+    mouse_current_pos_ = Vec2f(pos.x, -pos.y);
+    pending_events_.push_back({ InputEvent::MOUSE_WARP, 0, 0, 0, mouse_current_pos_, glfwGetTime() });
+  }
+
+  if (!glfwRawMouseMotionSupported()) return false;
+
+  glfwSetInputMode(window_(), GLFW_RAW_MOUSE_MOTION, enable ? GLFW_TRUE : GLFW_FALSE);
+  return true;
+}
+
 // マウスカーソルのON/OFF
 void AppEnv::mouseCursor(const bool disp) {
   glfwSetInputMode(window_(), GLFW_CURSOR, disp ? GLFW_CURSOR_NORMAL
@@ -218,29 +286,80 @@ void AppEnv::mouseCursor(const bool disp) {
 // button Mouse::LEFT
 //        Mouse::Right
 bool AppEnv::isButtonPressing(const Mouse button) const {
-  return press_buttons_.count(static_cast<int>(button));
+  return press_buttons_[static_cast<int>(button)];
 }
   
 // 当該ボタンが押された瞬間trueを返す
 // button Mouse::LEFT
 //        Mouse::RIGHT
 bool AppEnv::isButtonPushed(const Mouse button) const {
-  return push_buttons_.count(static_cast<int>(button));
+  return push_buttons_[static_cast<int>(button)];
 }
 
 // 当該ボタンが離された瞬間trueを返す
 // button Mouse::LEFT
 //        Mouse::RIGHT
 bool AppEnv::isButtonReleased(const Mouse button) const {
-  return pull_buttons_.count(static_cast<int>(button));
+  return pull_buttons_[static_cast<int>(button)];
 }
 
+// 前のフレームから届いた入力イベント
+const std::vector<InputEvent>& AppEnv::inputEvents() const { return input_events_; }
+
+// 入力をファイルに記録する
+// seed 乱数の種(再生する時に返す)
+void AppEnv::recordInput(const std::string& path, const u_int seed) {
+  recorder_ = std::make_unique<InputRecorder>(path, seed, gamepads_);
+}
+
+// 記録した入力を再生する
+// headless trueならウインドウを表示しない
+// 戻り値   記録した時の乱数の種
+u_int AppEnv::replayInput(const std::string& path, const bool headless) {
+  player_ = std::make_unique<InputPlayer>(path);
+
+  // TIPS:GamePadは記録した時の構成に置き換える
+  gamepads_ = player_->gamePads();
+  switchInputBuffer();
+  press_keys_.reset();
+  press_buttons_.reset();
+
+  // 垂直同期を待たない
+  glfwSwapInterval(0);
+  if (headless) glfwHideWindow(window_());
+
+  return player_->seed();
+}
+
+// 入力を再生中ならtrue
+bool AppEnv::isReplaying() const { return player_ ? true : false; }
+
 // フォーカス状態
 bool AppEnv::isFocus() const { return is_focus_; }
 
 // GamePadの接続数
 size_t AppEnv::numGamePad() const { return gamepads_.size(); }
 
+// GamePadを別スレッドで読み取る
+// hz 1秒間に読み取る回数(0で止める)
+void AppEnv::sampleGamePad(const float hz) {
+  sampler_.reset();
+  pad_samples_.clear();
+  disconnectGamePadCallback({});
+
+  if (hz > 0.0f) {
+    sampler_ = std::make_unique<InputSampler>(hz);
+
+    // TIPS:抜き差しの通知は glfwPollEvents() の中なので、glfwMutex() はロックされている
+    disconnectGamePadCallback([this](const int id) {
+        sampler_->disconnect(id);
+      });
+  }
+}
+
+// 前のフレームから届いたGamePadの入力の変化
+const std::vector<GamePadSample>& AppEnv::gamePadSamples() const { return pad_samples_; }
+
 // 指定番号のGamePadを取得
 // TIPS:const版も定義
 const GamePad& AppEnv::gamePad(const int index) const {
@@ -256,24 +375,13 @@ GamePad& AppEnv::gamePad(const int index) {
 void AppEnv::createCharaInfo(GLFWwindow* window, const u_int chara) {
   auto* const obj = static_cast<AppEnv*>(glfwGetWindowUserPointer(window));
     
-  obj->pushed_key_ = chara;
+  obj->addInputEvent(InputEvent::CHAR, int(chara), GLFW_PRESS, 0);
 }
 
 void AppEnv::createKeyInfo(GLFWwindow* window, const int key, const int scancode, const int action, const int mods) {
   auto* const obj = static_cast<AppEnv*>(glfwGetWindowUserPointer(window));
 
-  // キーのpush,press,pull情報を生成
-  switch (action) {
-  case GLFW_PRESS:
-    obj->push_keys_.insert(key);
-    obj->press_keys_.insert(key);
-    break;
-
-  case GLFW_RELEASE:
-    obj->pull_keys_.insert(key);
-    obj->press_keys_.erase(key);
-    break;
-  }
+  obj->addInputEvent(InputEvent::KEY, key, action, mods);
 }
 
 void AppEnv::changeWindowSize(GLFWwindow* window, const int width, const int height) {
@@ -295,28 +403,19 @@ void AppEnv::changeWindowSize(GLFWwindow* window, const int width, const int hei
 void AppEnv::mouseButtonCallback(GLFWwindow* window, const int button, const int action, const int mods) {
   auto* const obj = static_cast<AppEnv*>(glfwGetWindowUserPointer(window));
 
-  // ボタン入力情報を生成
-  switch (action) {
-  case GLFW_PRESS:
-    obj->push_buttons_.insert(button);
-    obj->press_buttons_.insert(button);
-    break;
-
-  case GLFW_RELEASE:
-    obj->pull_buttons_.insert(button);
-    obj->press_buttons_.erase(button);
-    break;
-  }
+  obj->addInputEvent(InputEvent::MOUSE_BUTTON, button, action, mods);
 }
 
 void AppEnv::mouseMoveCallback(GLFWwindow* window, const double x_pos, const double y_pos) {
   auto* const obj = static_cast<AppEnv*>(glfwGetWindowUserPointer(window));
+  // TIPS:再生中は無視
+  if (obj->player_) return;
     
   Vec2f pos = screenPosition(Vec2f(x_pos - obj->viewport_ofs_.x, y_pos - obj->viewport_ofs_.y),
                              obj->current_window_size_,
                              Vec2f(obj->viewport_size_.x, obj->viewport_size_.y));
   // TIPS:Yは上下が逆
-  obj->mouse_current_pos_ = Vec2f(pos.x, -pos.y);
+  obj->applyInputEvent({ InputEvent::MOUSE_MOVE, 0, 0, 0, Vec2f(pos.x, -pos.y), glfwGetTime() });
 }
 
 void AppEnv::focusCallback(GLFWwindow* window, int focus) {
@@ -345,11 +444,122 @@ Vec2f AppEnv::windowPosition(const Vec2f& pos, const Vec2f& window, const Vec2f&
 void AppEnv::switchInputBuffer() {
   pushed_key_ = 0;
 
-  push_keys_.clear();
-  pull_keys_.clear();
+  push_keys_.reset();
+  pull_keys_.reset();
+
+  push_buttons_.reset();
+  pull_buttons_.reset();
+
+  mouse_motion_ = Vec2f(0, 0);
+  input_events_.clear();
+}
+
+// 入力イベントを記録する
+// TIPS:マウスカーソルの位置も一緒に記録する
+void AppEnv::addInputEvent(const InputEvent::Type type, const int code, const int action, const int mods) {
+  // TIPS:再生中はGLFWからの入力を無視
+  if (player_) return;
+
+  applyInputEvent({ type, code, action, mods, mouse_current_pos_, glfwGetTime() });
+}
+
+// 入力イベントから入力状況を作る
+// TIPS:GLFWからの入力も、再生した入力も、ここを通る
+void AppEnv::applyInputEvent(const InputEvent& event) {
+  input_events_.push_back(event);
+
+  switch (event.type) {
+  case InputEvent::KEY:
+    {
+      // TIPS:GLFW_KEY_UNKNOWN は扱わない
+      if ((event.code < 0) || (event.code > GLFW_KEY_LAST)) break;
+
+      // キーのpush,press,pull情報を生成
+      switch (event.action) {
+      case GLFW_PRESS:
+        push_keys_.set(event.code);
+        press_keys_.set(event.code);
+        break;
+
+      case GLFW_RELEASE:
+        pull_keys_.set(event.code);
+        press_keys_.reset(event.code);
+        break;
+      }
+    }
+    break;
+
+  case InputEvent::CHAR:
+    pushed_key_ = u_int(event.code);
+    break;
+
+  case InputEvent::MOUSE_BUTTON:
+    {
+      if ((event.code < 0) || (event.code > GLFW_MOUSE_BUTTON_LAST)) break;
+
+      // ボタン入力情報を生成
+      switch (event.action) {
+      case GLFW_PRESS:
+        push_buttons_.set(event.code);
+        press_buttons_.set(event.code);
+        break;
+
+      case GLFW_RELEASE:
+        pull_buttons_.set(event.code);
+        press_buttons_.reset(event.code);
+        break;
+      }
+    }
+    break;
+
+  case InputEvent::MOUSE_MOVE:
+    mouse_motion_ += event.pos - mouse_current_pos_;
+    mouse_current_pos_ = event.pos;
+    break;
+
+  case InputEvent::MOUSE_WARP:
+    mouse_current_pos_ = event.pos;
+    break;
+  }
+}
+
+// フレームの入力を更新する
+// TIPS:キーとマウスの入力は、前のフレームの終わりに届いている
+void AppEnv::updateInput() {
+  if (player_) {
+    // 記録した1フレームぶんの入力を、GLFWから届いたものとして扱う
+    if (player_->read(replay_events_, gamepads_)) {
+      for (const auto& event : replay_events_) {
+        applyInputEvent(event);
+      }
+    }
+    else {
+      DOUT << "Replay finished: " << player_->frames() << " frames" << std::endl;
+      glfwSetWindowShouldClose(window_(), GL_TRUE);
+    }
+  }
+  else if (sampler_) {
+    {
+      // TIPS:読み取りスレッドを止めて、抜き差しと読み取った状況を揃える
+      std::lock_guard<std::mutex> lock(sampler_->glfwMutex());
+      updateGamePad(gamepads_, false);
+      sampler_->apply(gamepads_);
+      sampler_->watch(gamepads_);
+    }
+
+    pad_samples_.clear();
+    GamePadSample sample;
+    while (sampler_->pop(sample)) {
+      pad_samples_.push_back(sample);
+    }
+  }
+  else {
+    updateGamePad(gamepads_);
+  }
 
-  push_buttons_.clear();
-  pull_buttons_.clear();
+  if (recorder_) {
+    recorder_->write(input_events_, gamepads_);
+  }
 }
 
 // 画面モード判定
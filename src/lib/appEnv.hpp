@@ -11,14 +11,18 @@
 
 
 #include "defines.hpp"
-#include <set>
+#include <bitset>
 #include <vector>
+#include <string>
+#include <memory>
 #include "glfwWindow.hpp"
 #include "vector.hpp"
 #include "camera2D.hpp"
 #include "graph.hpp"
 #include "audio.hpp"
 #include "gamePad.hpp"
+#include "inputRecord.hpp"
+#include "inputSampler.hpp"
 #include "os.hpp"
 
 
@@ -79,24 +83,46 @@ class AppEnv {
   Color bg_color_;
   
   // キー入力関連
+  // TIPS:GLFWのキーコードをそのまま添字にする
   u_int pushed_key_;
 
-  std::set<int> push_keys_;
-  std::set<int> pull_keys_;
-  std::set<int> press_keys_;
+  typedef std::bitset<GLFW_KEY_LAST + 1> KeyBits;
+  KeyBits push_keys_;
+  KeyBits pull_keys_;
+  KeyBits press_keys_;
 
   // マウス関連
   Vec2f mouse_current_pos_;
-
-  std::set<int> push_buttons_;
-  std::set<int> pull_buttons_;
-  std::set<int> press_buttons_;
+  // 前のフレームからの移動量
+  Vec2f mouse_motion_;
+  // rawMouseMotion() で消す前のカーソルの状態
+  int cursor_mode_;
+
+  typedef std::bitset<GLFW_MOUSE_BUTTON_LAST + 1> ButtonBits;
+  ButtonBits push_buttons_;
+  ButtonBits pull_buttons_;
+  ButtonBits press_buttons_;
+
+  // 前のフレームから届いた入力イベント
+  // TIPS:毎フレーム中身を消すだけなので、一度確保した領域を使い回す
+  std::vector<InputEvent> input_events_;
+  // フレームの途中で起きた入力(次のフレームの入力として記録する)
+  std::vector<InputEvent> pending_events_;
 
   // Windowのフォーカス
   bool is_focus_;
   
   // GamePad
   std::vector<GamePad> gamepads_;
+
+  // GamePadを別スレッドで読み取る
+  std::unique_ptr<InputSampler> sampler_;
+  std::vector<GamePadSample> pad_samples_;
+
+  // 入力の記録と再生
+  std::unique_ptr<InputRecorder> recorder_;
+  std::unique_ptr<InputPlayer> player_;
+  std::vector<InputEvent> replay_events_;
   
   // サウンド関連
   Audio audio_;
@@ -108,6 +134,7 @@ public:
   // dynamic_size  true: ウインドウサイズにあわせて画面を変更
   AppEnv(const int width, const int height,
          const Screen type = Screen::DEFAULT);
+  ~AppEnv();
 
   // TIPS:このクラスはコピー禁止
   AppEnv(const AppEnv&) = delete;
@@ -179,6 +206,17 @@ public:
   // マウスカーソルのON/OFF
   void mouseCursor(const bool disp);
   
+  // 前のフレームからのマウスの移動量
+  // TIPS:画面の端で止まらずに動かしたい時は rawMouseMotion() と組み合わせる
+  const Vec2f& mouseMotion() const;
+
+  // マウスの移動量をOSから直接受け取る
+  // TIPS:カーソルは消えて、画面の端でも止まらなくなる
+  //      画面の拡大や加速がかからない値になる(対応していない環境では加速がかかる)
+  //      falseにすると、カーソルは有効にする前の状態(mouseCursor() の設定)に戻る
+  // 戻り値 OSから直接受け取れるならtrue
+  bool rawMouseMotion(const bool enable);
+
   // 当該ボタンが押されているならtrueを返す
   // button Mouse::LEFT
   //        Mouse::Right
@@ -194,14 +232,46 @@ public:
   //        Mouse::RIGHT
   bool isButtonReleased(const Mouse button) const;
 
+  // 前のフレームから届いた入力イベント(届いた順)
+  // TIPS:1フレームの間に押して離したキーや、押した順番・時刻がわかる
+  //      時刻はイベントを受け取った時のもの(glfwPollEvents() の中)
+  const std::vector<InputEvent>& inputEvents() const;
+
+  // 入力をファイルに記録する
+  // TIPS:begin() のたびに1フレームぶん書き込む
+  // seed 乱数の種(再生する時に返す)
+  void recordInput(const std::string& path, const u_int seed);
+
+  // 記録した入力を再生する
+  // TIPS:GLFWからの入力は無視し、垂直同期を待たずに全速力で進める
+  //      最後まで再生したら isOpen() がfalseを返す
+  // headless trueならウインドウを表示しない
+  // 戻り値   記録した時の乱数の種
+  // NOTICE:メインループに入る前に呼ぶこと
+  u_int replayInput(const std::string& path, const bool headless = true);
+
+  // 入力を再生中ならtrue
+  bool isReplaying() const;
+
   // フォーカスの状態
   bool isFocus() const;
   
   // GamePadの接続数
+  // TIPS:抜かれたものも含む(isPresent() がfalseになる)。新しく繋がれると増える
   size_t numGamePad() const;
 
+  // GamePadを別スレッドで読み取る
+  // TIPS:フレームの間に押して離したボタンも、押した瞬間・離した瞬間として扱われる
+  // hz 1秒間に読み取る回数(0で止める)
+  void sampleGamePad(const float hz = 1000.0f);
+
+  // 前のフレームから届いたGamePadの入力の変化(届いた順)
+  // TIPS:sampleGamePad() で読み取っている時だけ届く
+  const std::vector<GamePadSample>& gamePadSamples() const;
+
   // 指定番号のGamePadを取得
   // TIPS:const版も定義
+  // NOTICE:GamePadが増えると再配置されるので、参照を持ち続けないこと
   const GamePad& gamePad(const int index) const;
   GamePad& gamePad(const int index);
 
@@ -233,6 +303,16 @@ private:
   // 入力バッファを切り替える
   void switchInputBuffer();
 
+  // 入力イベントを記録する
+  void addInputEvent(const InputEvent::Type type, const int code, const int action, const int mods);
+
+  // 入力イベントから入力状況を作る
+  void applyInputEvent(const InputEvent& event);
+
+  // フレームの入力を更新する
+  // TIPS:再生中は記録した入力を使う
+  void updateInput();
+
   // 画面モード判定
   static bool isDynamic(const Screen type);
   static bool isFullscreen(const Screen type);
@@ -6,12 +6,32 @@
 #include "audio.hpp"
 #include <iostream>
 #include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
 #include <OpenAL/al.h>
 #include <OpenAL/alc.h>
 #include "wav.hpp"
+#include "sampleConvert.hpp"
+#include "oggVorbis.hpp"
+#include "streaming.hpp"
+#include "fileUtil.hpp"
 #include "vector.hpp"
 
 
+// AL_SOFT_source_latency
+// TIPS:OpenAL Softの拡張。ヘッダにない環境もあるので自前で定義する
+#ifndef AL_SEC_OFFSET_LATENCY_SOFT
+#define AL_SEC_OFFSET_LATENCY_SOFT 0x1201
+#endif
+
+typedef void (*GetSourcedvSoft)(ALuint source, ALenum param, double* values);
+static GetSourcedvSoft get_sourcedv_soft = nullptr;
+
+
 #if defined (_MSC_VER)
 #pragma comment (lib, "openal32.lib")
 #endif
@@ -21,20 +41,43 @@ Audio::Audio() {
   DOUT << "Audio()" << std::endl;
     
   // OpenALの初期化
+  context_ = nullptr;
   device_  = alcOpenDevice(nullptr);
+  if (!device_) {
+    // NOTICE:音を鳴らせない環境でも動くよう、例外は投げない
+    DOUT << "Can't open audio device." << std::endl;
+    return;
+  }
   context_ = alcCreateContext(device_, nullptr);
   alcMakeContextCurrent(context_);
+
+  // 再生位置と一緒に、聞こえるまでの遅れを取得できるか調べる
+  if (alIsExtensionPresent("AL_SOFT_source_latency")) {
+    get_sourcedv_soft = reinterpret_cast<GetSourcedvSoft>(alGetProcAddress("alGetSourcedvSOFT"));
+  }
+  DOUT << "AL_SOFT_source_latency: " << (get_sourcedv_soft ? "yes" : "no") << std::endl;
 }
 
 Audio::~Audio() {
   DOUT << "~Audio()" << std::endl;
 
+  // ストリーミングの再生スレッドを先に終了させる
+  Streaming::shutdown();
+  BufferCache::shutdown();
+
   // OpenALの後始末
+  if (!device_) return;
+
+  get_sourcedv_soft = nullptr;
+
   alcMakeContextCurrent(nullptr);
   alcDestroyContext(context_);
   alcCloseDevice(device_);
 }
 
+// 出力デバイスを開けたらtrue
+bool Audio::isAvailable() const { return device_ != nullptr; }
+
   
 // リスナーの位置を変更
 // x, y, z →位置
@@ -78,26 +121,16 @@ void Audio::lisnerVerocity(const Vec3f& vec) {
 }
 
 
-Buffer::Buffer(const std::string& path) {
-  DOUT << "Buffer()" << std::endl;
-
-  // バッファを１つ確保
-  alGenBuffers(1, &id_);
-
-  // WAVファイルの読み込み
-  Wav wav_data(path);
-  duration_sec_ = wav_data.time();
-  
-  // 波形データをバッファにコピー
-  alBufferData(id_,
-               wav_data.isStereo() ? AL_FORMAT_STEREO16 : AL_FORMAT_MONO16,
-               wav_data.data(),
-               wav_data.size(),
-               wav_data.sampleRate());
+Buffer::Buffer(const std::string& path, const bool mono) :
+  Buffer()
+{
+  load(path, mono);
 }
 
 Buffer::Buffer() :
-  duration_sec_(0.0f)
+  duration_sec_(0.0f),
+  size_(0),
+  ready_(false)
 {
   DOUT << "Buffer()" << std::endl;
 
@@ -117,10 +150,274 @@ Buffer::~Buffer() {
 ALuint Buffer::id() const { return id_; }
 // 再生時間
 float Buffer::duration() const { return duration_sec_; }
+// 波形データのサイズ
+u_int Buffer::size() const { return size_; }
+// 波形データを割り当て済みならtrue
+bool Buffer::isReady() const { return ready_; }
+
+// ファイルを読み込んで波形データを割り当て
+void Buffer::load(const std::string& path, const bool mono) {
+  if (OggVorbis::isOggFile(path)) {
+    // Ogg Vorbisはすべて展開してからバッファにコピー
+    OggVorbis ogg(path);
+    u_int ch = ogg.channel();
+    std::vector<int16_t> pcm(ogg.frames() * ch);
+    size_t frames = ogg.read(pcm.data(), ogg.frames());
+    if (mono && (ch == 2)) {
+      // TIPS:同じ領域に詰めて書いても追い越さない
+      foldChannels(pcm.data(), ch, 0, frames, 1, pcm.data());
+      ch = 1;
+    }
+    duration_sec_ = float(frames) / ogg.sampleRate();
+    size_ = u_int(frames * ch * sizeof(int16_t));
+
+    alBufferData(id_,
+                 (ch == 2) ? AL_FORMAT_STEREO16 : AL_FORMAT_MONO16,
+                 pcm.data(),
+                 ALsizei(size_),
+                 ogg.sampleRate());
+    ready_ = true;
+    return;
+  }
+
+  // WAVファイルの読み込み
+  // TIPS:IMA ADPCMや16bit以外のPCMは読み込み時に変換される
+  Wav wav_data(path, mono);
+  duration_sec_ = wav_data.time();
+  size_ = wav_data.size();
+  
+  // 波形データをバッファにコピー
+  alBufferData(id_,
+               wav_data.isStereo() ? AL_FORMAT_STEREO16 : AL_FORMAT_MONO16,
+               wav_data.data(),
+               wav_data.size(),
+               wav_data.sampleRate());
+  ready_ = true;
+}
 
 void Buffer::bind(const bool stereo,
                   const void* data, const u_int size, const u_int rate) const {
   alBufferData(id_, stereo ? AL_FORMAT_STEREO16 : AL_FORMAT_MONO16, data, size, rate);
+  ready_ = true;
+}
+
+
+// 読み込みスレッド
+// TIPS:OpenALはコンテキストごとにスレッドセーフなので、バッファへの転送もここで行う
+class BufferCache::Loader {
+  struct Request {
+    std::string path;
+    bool mono;
+    std::shared_ptr<Buffer> buffer;
+  };
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Request> requests_;
+  size_t loading_;
+
+  // 読み込みスレッドが読み込んでいる最中のバッファ
+  std::vector<const Buffer*> processing_;
+  std::condition_variable done_cv_;
+  bool finish_;
+
+  std::vector<std::thread> threads_;
+
+
+public:
+  explicit Loader(const int num_threads) :
+    loading_(0),
+    finish_(false)
+  {
+    DOUT << "BufferCache::Loader()" << std::endl;
+
+    for (int i = 0; i < num_threads; ++i) {
+      threads_.emplace_back(&Loader::loadProc, this);
+    }
+  }
+
+  ~Loader() {
+    DOUT << "~BufferCache::Loader()" << std::endl;
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      finish_ = true;
+      requests_.clear();
+    }
+    cv_.notify_all();
+    done_cv_.notify_all();
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  void request(const std::string& path, const bool mono, const std::shared_ptr<Buffer>& buffer) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      requests_.push_back({ path, mono, buffer });
+      loading_ += 1;
+    }
+    cv_.notify_one();
+  }
+
+  size_t loading() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return loading_;
+  }
+
+  // 読み込み待ちのバッファの読み込みが終わるのを待つ
+  // TIPS:まだ順番が来ていなければ、呼び出したスレッドで読み込む
+  void wait(const std::shared_ptr<Buffer>& buffer) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = std::find_if(std::begin(requests_), std::end(requests_),
+                           [&buffer](const Request& request) { return request.buffer == buffer; });
+    if (it != std::end(requests_)) {
+      Request request = std::move(*it);
+      requests_.erase(it);
+      lock.unlock();
+
+      load(request);
+      return;
+    }
+
+    done_cv_.wait(lock, [this, &buffer]() {
+        return finish_
+          || (std::find(std::begin(processing_), std::end(processing_), buffer.get()) == std::end(processing_));
+      });
+  }
+
+
+private:
+  // std::threadによる読み込み処理
+  void loadProc() {
+    while (true) {
+      Request request;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return finish_ || !requests_.empty(); });
+        if (finish_) break;
+
+        request = std::move(requests_.front());
+        requests_.pop_front();
+        processing_.push_back(request.buffer.get());
+      }
+
+      load(request);
+    }
+  }
+
+  void load(const Request& request) {
+    try {
+      request.buffer->load(request.path, request.mono);
+    }
+    catch (const char* message) {
+      // NOTICE:読み込めなかったバッファは isReady() が false のまま
+      DOUT << "BufferCache: " << message << " " << request.path << std::endl;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      loading_ -= 1;
+      auto it = std::find(std::begin(processing_), std::end(processing_), request.buffer.get());
+      if (it != std::end(processing_)) processing_.erase(it);
+    }
+    done_cv_.notify_all();
+  }
+
+};
+
+
+std::unique_ptr<BufferCache::Loader> BufferCache::loader_;
+
+
+std::map<BufferCache::Key, std::shared_ptr<Buffer>>& BufferCache::buffers() {
+  static std::map<Key, std::shared_ptr<Buffer>> buffers;
+  return buffers;
+}
+
+// バッファを受け取る(読み込んでいなければ読み込む)
+std::shared_ptr<Buffer> BufferCache::get(const std::string& path, const bool mono) {
+  Key key(normalizePath(path), mono);
+
+  auto& cache = buffers();
+  auto it = cache.find(key);
+  if (it != std::end(cache)) {
+    // NOTICE:getAsync()で読み込み中なら、読み込みが終わるまで待つ
+    if (loader_ && !it->second->isReady()) loader_->wait(it->second);
+    return it->second;
+  }
+
+  auto buffer = std::make_shared<Buffer>(key.first, mono);
+  cache.insert({ key, buffer });
+  return buffer;
+}
+
+// バッファを受け取る(読み込んでいなければ読み込みスレッドで読み込む)
+std::shared_ptr<Buffer> BufferCache::getAsync(const std::string& path, const bool mono) {
+  Key key(normalizePath(path), mono);
+
+  auto& cache = buffers();
+  auto it = cache.find(key);
+  if (it != std::end(cache)) return it->second;
+
+  if (!loader_) {
+    // TIPS:メインスレッドのぶんを残しておく
+    int num_threads = std::min(std::max(int(std::thread::hardware_concurrency()) - 1, 1), 4);
+    loader_ = std::make_unique<Loader>(num_threads);
+  }
+
+  auto buffer = std::make_shared<Buffer>();
+  cache.insert({ key, buffer });
+  loader_->request(key.first, mono, buffer);
+  return buffer;
+}
+
+// 読み込みスレッドで読み込み中のバッファの数
+size_t BufferCache::loading() {
+  return loader_ ? loader_->loading() : 0;
+}
+
+// どこからも使われていないバッファを破棄する
+size_t BufferCache::unloadUnused() {
+  size_t num = 0;
+  auto& cache = buffers();
+  for (auto it = std::begin(cache); it != std::end(cache); ) {
+    // TIPS:キャッシュだけが持っている
+    if (it->second.use_count() == 1) {
+      DOUT << "BufferCache unload: " << it->first.first << std::endl;
+      it = cache.erase(it);
+      num += 1;
+    }
+    else {
+      ++it;
+    }
+  }
+  return num;
+}
+
+// すべて破棄する
+void BufferCache::clear() {
+  buffers().clear();
+}
+
+// 読み込んでいるバッファの数
+size_t BufferCache::count() {
+  return buffers().size();
+}
+
+// 読み込んでいる波形データの合計サイズ(バイト数)
+size_t BufferCache::residentBytes() {
+  size_t bytes = 0;
+  for (const auto& it : buffers()) {
+    if (it.second->isReady()) bytes += it.second->size();
+  }
+  return bytes;
+}
+
+// 読み込みスレッドを終了して、すべて破棄する
+void BufferCache::shutdown() {
+  loader_.reset();
+  clear();
 }
 
 
@@ -143,6 +440,13 @@ Source::~Source() {
   
 ALuint Source::name() const { return id_; }
 
+// 割り当てられているバッファの識別子
+ALuint Source::buffer() const {
+  ALint buffer_id;
+  alGetSourcei(id_, AL_BUFFER, &buffer_id);
+  return ALuint(buffer_id);
+}
+
   
 // ソースにバッファを割り当てる
 void Source::bindBuffer(const Buffer& buffer) const {
@@ -224,6 +528,29 @@ float Source::currentTime() const {
   return current_time_sec;
 }
 
+// 聞こえるまでの遅れを含めた再生位置
+PlaybackTime Source::playbackTime() const {
+  PlaybackTime time = { 0.0, 0.0, false, isPlaying() };
+
+  if (get_sourcedv_soft) {
+    // 再生位置と遅れを同時に取得する
+    double values[2] = { 0.0, 0.0 };
+    get_sourcedv_soft(id_, AL_SEC_OFFSET_LATENCY_SOFT, values);
+    time.sec     = values[0];
+    time.latency = values[1];
+    time.precise = true;
+  }
+  else {
+    time.sec = currentTime();
+  }
+  return time;
+}
+
+// 再生位置の変更(秒)
+void Source::seek(const float sec) const {
+  alSourcef(id_, AL_SEC_OFFSET, sec);
+}
+
 
 void Source::queueBuffer(const Buffer& buffer) const {
   ALuint buffers = buffer.id();
@@ -247,13 +574,13 @@ int Source::processed() const {
 
 Media::Media() {}
 
-Media::Media(const std::string& path) :
-  buffer_(std::make_shared<Buffer>(path)),
+Media::Media(const std::string& path, const bool async, const bool mono) :
+  buffer_(async ? BufferCache::getAsync(path, mono) : BufferCache::get(path, mono)),
   source_(std::make_shared<Source>())
 {
   DOUT << "Media()" << std::endl;
 
-  source_->bindBuffer(*buffer_);
+  prepare();
 }
   
 Media::~Media() {
@@ -261,8 +588,26 @@ Media::~Media() {
 }
 
   
+// 読み込みが終わったバッファをソースに割り当てる
+// NOTICE:読み込み中のバッファをソースに割り当てると、波形データを割り当てられなくなる
+bool Media::prepare() const {
+  if (!buffer_->isReady()) return false;
+
+  if (source_->buffer() != buffer_->id()) {
+    source_->bindBuffer(*buffer_);
+  }
+  return true;
+}
+
+// 読み込みが終わっていればtrue
+bool Media::isReady() const {
+  return buffer_->isReady();
+}
+
 // 再生開始
 void Media::play() const {
+  if (!prepare()) return;
+
   source_->play();
 }
 
@@ -324,6 +669,11 @@ float Media::currentTime() const {
   return source_->currentTime();
 }
 
+// 聞こえるまでの遅れを含めた再生位置
+PlaybackTime Media::playbackTime() const {
+  return source_->playbackTime();
+}
+
 // 再生時間(秒)
 float Media::duration() const {
   return buffer_->duration();
@@ -11,11 +11,26 @@
 #include "defines.hpp"
 #include <string>
 #include <memory>
+#include <map>
+#include <atomic>
 #include <OpenAL/al.h>
 #include <OpenAL/alc.h>
 #include "vector.hpp"
 
 
+// 再生位置
+// TIPS:AudioClockに渡して、なめらかな時刻にする
+struct PlaybackTime {
+  // 再生位置(秒)
+  double sec;
+  // 実際に聞こえるまでの遅れ(秒)。わからない時は0
+  double latency;
+  // AL_SOFT_source_latencyで取得した(細かく進む)
+  bool precise;
+  bool playing;
+};
+
+
 // OpenALの初期化と後始末を代行
 class Audio {
   ALCdevice*  device_;
@@ -30,6 +45,10 @@ public:
   Audio(const Audio&) = delete;
   Audio& operator=(const Audio&) = delete;
 
+  // 出力デバイスを開けたらtrue
+  // TIPS:開けない環境ではMixerの出力をNullOutputにすると、音なしで動かせる
+  bool isAvailable() const;
+
   
   // リスナーの位置を変更
   // x, y, z →位置
@@ -62,11 +81,17 @@ public:
 class Buffer {
   ALuint id_;
   float duration_sec_;
+  u_int size_;
+
+  // 波形データを割り当て済みか
+  // TIPS:読み込みスレッドから書き換えられる
+  mutable std::atomic<bool> ready_;
 
 
 public:
   Buffer();
-  explicit Buffer(const std::string& path);
+  // mono trueならモノラルにまとめる(3D空間に配置する効果音向け)
+  explicit Buffer(const std::string& path, const bool mono = false);
   ~Buffer();
 
   // このクラスはコピー禁止
@@ -80,12 +105,69 @@ public:
   // 再生時間(秒)
   float duration() const;
 
+  // 波形データのサイズ(バイト数)
+  u_int size() const;
+
+  // 波形データを割り当て済みならtrue
+  bool isReady() const;
+
+  // ファイルを読み込んで波形データを割り当て
+  // TIPS:読み込みスレッドから呼ばれる
+  void load(const std::string& path, const bool mono = false);
+
   // 波形データを割り当て
   // TIPS:割り当て後、dataの内容は破棄できる
   void bind(const bool stereo, const void* data, const u_int size, const u_int rate) const;
 };
 
 
+// 読み込んだバッファを使い回す
+// NOTICE:Media(path)はここからバッファを受け取る
+class BufferCache {
+  // パスとモノラルにまとめるかどうか
+  using Key = std::pair<std::string, bool>;
+  static std::map<Key, std::shared_ptr<Buffer>>& buffers();
+
+  // 読み込みスレッド
+  class Loader;
+  static std::unique_ptr<Loader> loader_;
+
+
+public:
+  // バッファを受け取る(読み込んでいなければ読み込む)
+  // path はnormalizePath()で表記を揃えてから探す
+  // mono trueならモノラルにまとめたバッファ(同じファイルでも別扱い)
+  // NOTICE:getAsync()で読み込み中のバッファは、読み込みが終わるまで待ってから返す
+  static std::shared_ptr<Buffer> get(const std::string& path, const bool mono = false);
+
+  // バッファを受け取る(読み込んでいなければ読み込みスレッドで読み込む)
+  // 読み込みが終わるまで Buffer::isReady() は false を返す
+  static std::shared_ptr<Buffer> getAsync(const std::string& path, const bool mono = false);
+
+  // 読み込みスレッドで読み込み中のバッファの数
+  // TIPS:ロード画面の進み具合の表示に使える
+  static size_t loading();
+
+  // どこからも使われていないバッファを破棄する
+  // 戻り値 破棄したバッファの数
+  static size_t unloadUnused();
+
+  // すべて破棄する
+  // TIPS:使われているバッファは、使っている側が破棄するまで残る
+  static void clear();
+
+  // 読み込んでいるバッファの数
+  static size_t count();
+
+  // 読み込んでいる波形データの合計サイズ(バイト数)
+  static size_t residentBytes();
+
+  // 読み込みスレッドを終了して、すべて破棄する
+  // TIPS:Audioの後始末で呼ばれる
+  static void shutdown();
+};
+
+
 // ソースの管理を代行
 class Source {
   ALuint id_;
@@ -102,6 +184,9 @@ public:
   
   ALuint name() const;
 
+  // 割り当てられているバッファの識別子
+  ALuint buffer() const;
+
   
   // ソースにバッファを割り当てる
   void bindBuffer(const Buffer& buffer) const;
@@ -147,8 +232,16 @@ public:
   bool isPlaying() const;
 
   // 再生位置(秒)
+  // NOTICE:OpenALがミキシングする間隔でしか進まない
   float currentTime() const;
 
+  // 聞こえるまでの遅れを含めた再生位置
+  // TIPS:AL_SOFT_source_latencyがあれば、それを使う
+  PlaybackTime playbackTime() const;
+
+  // 再生位置の変更(秒)
+  void seek(const float sec) const;
+
   // Bufferの再生キューイング
   void queueBuffer(const Buffer& buffer) const;
   // 再生完了Bufferのid取得
@@ -165,12 +258,23 @@ class Media {
   std::shared_ptr<Source> source_;
   
 
+  // 読み込みが終わったバッファをソースに割り当てる
+  // 戻り値 再生できるならtrue
+  bool prepare() const;
+
+
 public:
   Media();
 
-  explicit Media(const std::string& path);
+  // async trueなら読み込みスレッドで読み込む
+  //       読み込みが終わるまでの再生は何もしない
+  // mono  trueならモノラルにまとめる(position()で配置する時向け)
+  explicit Media(const std::string& path, const bool async = false, const bool mono = false);
   ~Media();
 
+  // 読み込みが終わっていればtrue
+  bool isReady() const;
+
   // 再生開始
   void play() const;
 
@@ -210,6 +314,9 @@ public:
   // 再生位置(秒)
   float currentTime() const;
 
+  // 聞こえるまでの遅れを含めた再生位置
+  PlaybackTime playbackTime() const;
+
   // 再生時間(秒)
   float duration() const;
 
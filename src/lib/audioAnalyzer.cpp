@@ -0,0 +1,362 @@
+﻿
+//
+// 再生中の音の解析(音量とスペクトル)
+//
+
+#include "audioAnalyzer.hpp"
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define USE_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define USE_NEON
+#include <arm_neon.h>
+#endif
+
+
+namespace {
+
+// 基数2のバタフライ演算をひと段ぶん処理する
+// half 組にする2つの要素の間隔
+// w    回転因子(half 個)
+void butterfly(float* re, float* im, const float* w_re, const float* w_im,
+               const size_t n, const size_t half) {
+  for (size_t top = 0; top < n; top += half * 2) {
+    float* a_re = re + top;
+    float* a_im = im + top;
+    float* b_re = a_re + half;
+    float* b_im = a_im + half;
+
+    size_t k = 0;
+#if defined(USE_SSE2)
+    for (; (k + 4) <= half; k += 4) {
+      __m128 wr = _mm_loadu_ps(w_re + k);
+      __m128 wi = _mm_loadu_ps(w_im + k);
+      __m128 br = _mm_loadu_ps(b_re + k);
+      __m128 bi = _mm_loadu_ps(b_im + k);
+      __m128 tr = _mm_sub_ps(_mm_mul_ps(br, wr), _mm_mul_ps(bi, wi));
+      __m128 ti = _mm_add_ps(_mm_mul_ps(br, wi), _mm_mul_ps(bi, wr));
+      __m128 ar = _mm_loadu_ps(a_re + k);
+      __m128 ai = _mm_loadu_ps(a_im + k);
+      _mm_storeu_ps(b_re + k, _mm_sub_ps(ar, tr));
+      _mm_storeu_ps(b_im + k, _mm_sub_ps(ai, ti));
+      _mm_storeu_ps(a_re + k, _mm_add_ps(ar, tr));
+      _mm_storeu_ps(a_im + k, _mm_add_ps(ai, ti));
+    }
+#elif defined(USE_NEON)
+    for (; (k + 4) <= half; k += 4) {
+      float32x4_t wr = vld1q_f32(w_re + k);
+      float32x4_t wi = vld1q_f32(w_im + k);
+      float32x4_t br = vld1q_f32(b_re + k);
+      float32x4_t bi = vld1q_f32(b_im + k);
+      float32x4_t tr = vmlsq_f32(vmulq_f32(br, wr), bi, wi);
+      float32x4_t ti = vmlaq_f32(vmulq_f32(br, wi), bi, wr);
+      float32x4_t ar = vld1q_f32(a_re + k);
+      float32x4_t ai = vld1q_f32(a_im + k);
+      vst1q_f32(b_re + k, vsubq_f32(ar, tr));
+      vst1q_f32(b_im + k, vsubq_f32(ai, ti));
+      vst1q_f32(a_re + k, vaddq_f32(ar, tr));
+      vst1q_f32(a_im + k, vaddq_f32(ai, ti));
+    }
+#endif
+    for (; k < half; ++k) {
+      float tr = b_re[k] * w_re[k] - b_im[k] * w_im[k];
+      float ti = b_re[k] * w_im[k] + b_im[k] * w_re[k];
+      b_re[k] = a_re[k] - tr;
+      b_im[k] = a_im[k] - ti;
+      a_re[k] += tr;
+      a_im[k] += ti;
+    }
+  }
+}
+
+}
+
+
+AudioAnalyzer::AudioAnalyzer(const size_t fft_size, const u_int band_num, const float update_hz) :
+  ring_(RING_FRAMES),
+  written_(0),
+  rate_(0),
+  fft_size_(64),
+  band_num_(std::max(band_num, 1u)),
+  band_rate_(0),
+  level_(),
+  analyzed_(0),
+  analyze_ns_(0),
+  interval_(1.0 / std::max(update_hz, 1.0f)),
+  finish_(false)
+{
+  DOUT << "AudioAnalyzer()" << std::endl;
+
+  // TIPS:2のべき乗に切り上げる
+  while ((fft_size_ < fft_size) && (fft_size_ < RING_FRAMES / 2)) fft_size_ *= 2;
+
+  const float pi = 3.14159265f;
+  const size_t n = fft_size_;
+  const size_t m = n / 2;
+
+  // ハン窓
+  window_.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    window_[i] = 0.5f - 0.5f * std::cos(2.0f * pi * i / n);
+  }
+
+  // TIPS:実数の波形を、偶数番目を実部、奇数番目を虚部にして半分の長さで変換する
+  bit_reverse_.resize(m);
+  u_int bits = 0;
+  while ((size_t(1) << bits) < m) ++bits;
+  for (size_t i = 0; i < m; ++i) {
+    u_int r = 0;
+    for (u_int b = 0; b < bits; ++b) {
+      if (i & (size_t(1) << b)) r |= 1u << (bits - 1 - b);
+    }
+    bit_reverse_[i] = r;
+  }
+
+  // 段ごとの回転因子
+  // TIPS:間隔 half の段は half - 1 番目から並べる
+  twiddle_re_.resize(m);
+  twiddle_im_.resize(m);
+  for (size_t half = 1; half < m; half *= 2) {
+    for (size_t k = 0; k < half; ++k) {
+      twiddle_re_[half - 1 + k] = std::cos(pi * k / half);
+      twiddle_im_[half - 1 + k] = -std::sin(pi * k / half);
+    }
+  }
+
+  // 半分の長さの結果から、実数の波形の結果を組み立てる時の回転因子
+  post_re_.resize(m);
+  post_im_.resize(m);
+  for (size_t k = 0; k < m; ++k) {
+    post_re_[k] = std::cos(2.0f * pi * k / n);
+    post_im_[k] = -std::sin(2.0f * pi * k / n);
+  }
+
+  // TIPS:帯域にはスペクトルが最低ひとつ入るようにする
+  band_num_ = std::min(band_num_, u_int(m / 2));
+
+  samples_.resize(n);
+  re_.resize(m);
+  im_.resize(m);
+  magnitude_.resize(m);
+  spectrum_.resize(m);
+  bands_.resize(band_num_);
+
+  thread_ = std::thread(&AudioAnalyzer::proc, this);
+}
+
+AudioAnalyzer::~AudioAnalyzer() {
+  DOUT << "~AudioAnalyzer()" << std::endl;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    finish_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+}
+
+
+// 波形を書き込む
+void AudioAnalyzer::write(const int16_t* pcm, const size_t frames, const u_int ch, const u_int rate) {
+  rate_.store(rate, std::memory_order_relaxed);
+
+  const size_t mask = RING_FRAMES - 1;
+  uint64_t pos = written_.load(std::memory_order_relaxed);
+  if (ch == 2) {
+    const float scale = 1.0f / 65536.0f;
+    for (size_t i = 0; i < frames; ++i) {
+      ring_[(pos + i) & mask] = (float(pcm[i * 2]) + float(pcm[i * 2 + 1])) * scale;
+    }
+  }
+  else {
+    const float scale = 1.0f / 32768.0f;
+    for (size_t i = 0; i < frames; ++i) {
+      ring_[(pos + i) & mask] = float(pcm[i * ch]) * scale;
+    }
+  }
+  written_.store(pos + frames, std::memory_order_release);
+}
+
+void AudioAnalyzer::write(const float* samples, const size_t frames, const u_int rate) {
+  rate_.store(rate, std::memory_order_relaxed);
+
+  const size_t mask = RING_FRAMES - 1;
+  uint64_t pos = written_.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < frames; ++i) {
+    ring_[(pos + i) & mask] = (samples[i * 2] + samples[i * 2 + 1]) * 0.5f;
+  }
+  written_.store(pos + frames, std::memory_order_release);
+}
+
+// 書き込んだ波形を捨てる
+void AudioAnalyzer::reset() {
+  written_.store(0, std::memory_order_release);
+}
+
+// 今聞こえている位置を返す関数
+void AudioAnalyzer::clock(std::function<double ()> func) {
+  std::lock_guard<std::mutex> lock(clock_mutex_);
+  clock_ = std::move(func);
+}
+
+// 書き込んだフレーム数
+uint64_t AudioAnalyzer::written() const {
+  return written_.load(std::memory_order_acquire);
+}
+
+size_t AudioAnalyzer::fftSize() const { return fft_size_; }
+
+u_int AudioAnalyzer::bandNum() const { return band_num_; }
+
+
+// 最後に解析した結果
+AudioLevel AudioAnalyzer::level() const {
+  std::lock_guard<std::mutex> lock(result_mutex_);
+  return level_;
+}
+
+void AudioAnalyzer::spectrum(std::vector<float>& out) const {
+  std::lock_guard<std::mutex> lock(result_mutex_);
+  out.assign(std::begin(spectrum_), std::end(spectrum_));
+}
+
+void AudioAnalyzer::bands(std::vector<float>& out) const {
+  std::lock_guard<std::mutex> lock(result_mutex_);
+  out.assign(std::begin(bands_), std::end(bands_));
+}
+
+// 一回の解析にかかった時間の平均(ミリ秒)
+double AudioAnalyzer::analyzeMs() const {
+  u_long count = analyzed_;
+  return count ? analyze_ns_ / (count * 1000000.0) : 0.0;
+}
+
+
+// 解析する
+bool AudioAnalyzer::analyze() {
+  u_int rate = rate_.load(std::memory_order_relaxed);
+  if (!rate) return false;
+
+  const size_t n = fft_size_;
+  const size_t mask = RING_FRAMES - 1;
+
+  // 今聞こえている位置までの波形を解析する
+  uint64_t written = written_.load(std::memory_order_acquire);
+  uint64_t end = written;
+  {
+    std::lock_guard<std::mutex> lock(clock_mutex_);
+    if (clock_) {
+      double sec = std::max(clock_(), 0.0);
+      end = std::min(end, uint64_t(sec * rate));
+    }
+  }
+
+  // TIPS:書き込む前の所は無音として扱う
+  float sum  = 0.0f;
+  float peak = 0.0f;
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t index = end + i;
+    float value = (index >= n) ? ring_[(index - n) & mask] : 0.0f;
+    samples_[i] = value;
+    sum += value * value;
+    peak = std::max(peak, std::fabs(value));
+  }
+
+  // 読んでいる間に上書きされていたら使わない
+  uint64_t now_written = written_.load(std::memory_order_acquire);
+  if ((now_written >= end) && ((now_written - end + n) > RING_FRAMES)) return false;
+
+  if (band_rate_ != rate) setupBands(rate);
+  fft();
+
+  std::lock_guard<std::mutex> lock(result_mutex_);
+  level_.rms  = std::sqrt(sum / n);
+  level_.peak = peak;
+  spectrum_.assign(std::begin(magnitude_), std::end(magnitude_));
+  for (u_int b = 0; b < band_num_; ++b) {
+    bands_[b] = *std::max_element(&magnitude_[band_edge_[b]], &magnitude_[band_edge_[b + 1]]);
+  }
+
+  return true;
+}
+
+// samples_ のスペクトルを magnitude_ に求める
+void AudioAnalyzer::fft() {
+  const size_t n = fft_size_;
+  const size_t m = n / 2;
+
+  // 窓をかけて、ビット反転の順に並べる
+  for (size_t i = 0; i < m; ++i) {
+    u_int j = bit_reverse_[i];
+    re_[j] = samples_[i * 2]     * window_[i * 2];
+    im_[j] = samples_[i * 2 + 1] * window_[i * 2 + 1];
+  }
+
+  for (size_t half = 1; half < m; half *= 2) {
+    butterfly(&re_[0], &im_[0], &twiddle_re_[half - 1], &twiddle_im_[half - 1], m, half);
+  }
+
+  // TIPS:窓の分も補正して、振幅1の正弦波が1になるようにする
+  //      ハン窓の合計は n / 2 で、下の計算では2倍の値が求まる
+  const float scale = 1.0f / (n * 0.5f);
+  for (size_t k = 0; k < m; ++k) {
+    size_t j = k ? m - k : 0;
+    // 偶数番目と奇数番目のそれぞれの結果に分ける
+    float even_re = re_[k] + re_[j];
+    float even_im = im_[k] - im_[j];
+    float odd_re  = im_[k] + im_[j];
+    float odd_im  = re_[j] - re_[k];
+    float x_re = even_re + post_re_[k] * odd_re - post_im_[k] * odd_im;
+    float x_im = even_im + post_re_[k] * odd_im + post_im_[k] * odd_re;
+    magnitude_[k] = std::min(std::sqrt(x_re * x_re + x_im * x_im) * scale, 1.0f);
+  }
+}
+
+// 帯域の範囲を決める
+// TIPS:20Hzからナイキスト周波数までを対数で等間隔に分ける
+void AudioAnalyzer::setupBands(const u_int rate) {
+  const size_t m = fft_size_ / 2;
+  const float bin_hz = float(rate) / fft_size_;
+  const float low  = std::max(20.0f, bin_hz);
+  const float high = rate * 0.5f;
+
+  band_edge_.resize(band_num_ + 1);
+  band_edge_[0] = u_int(low / bin_hz);
+  for (u_int b = 1; b <= band_num_; ++b) {
+    float hz = low * std::pow(high / low, float(b) / band_num_);
+    u_int edge = std::max(u_int(hz / bin_hz + 0.5f), band_edge_[b - 1] + 1);
+    band_edge_[b] = u_int(std::min(size_t(edge), m));
+  }
+  // TIPS:高い方でスペクトルが足りなくなった時は、手前の帯域を詰める
+  for (u_int b = band_num_; b > 0; --b) {
+    if (band_edge_[b - 1] >= band_edge_[b]) band_edge_[b - 1] = band_edge_[b] - 1;
+  }
+  band_rate_ = rate;
+}
+
+// std::threadによる解析処理
+void AudioAnalyzer::proc() {
+  typedef std::chrono::steady_clock Clock;
+  const auto interval = std::chrono::duration_cast<Clock::duration>(interval_);
+
+  Clock::time_point next = Clock::now();
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      next += interval;
+      if (cv_.wait_until(lock, next, [this]() { return finish_; })) break;
+    }
+
+    auto start = Clock::now();
+    if (analyze()) {
+      analyze_ns_ += u_long(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+      analyzed_   += 1;
+    }
+    // TIPS:遅れた時はまとめて解析しない
+    if (next < start) next = start;
+  }
+}
@@ -0,0 +1,144 @@
+﻿
+#pragma once
+
+//
+// 再生中の音の解析(音量とスペクトル)
+// TIPS:再生側が波形を書き込み、解析用のスレッドが一定の間隔で解析する
+//      ゲーム側は最後に解析した結果を受け取るだけ
+//
+// NOTICE:StreamingかMixerに渡して使う
+//
+
+#include "defines.hpp"
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+
+// 音量
+struct AudioLevel {
+  // 実効値と最大値 [0.0, 1.0]
+  float rms;
+  float peak;
+};
+
+
+class AudioAnalyzer {
+  enum {
+    // 波形を溜めておくフレーム数(2のべき乗)
+    // TIPS:Streamingは数秒先まで積むので、その分も溜めておく
+    RING_FRAMES = 1 << 18,
+  };
+
+  // 波形(モノラルにまとめたもの)
+  // TIPS:書き込むのは再生側のスレッドだけなので、書き込んだ位置だけを共有する
+  std::vector<float> ring_;
+  std::atomic<uint64_t> written_;
+  std::atomic<u_int> rate_;
+
+  // 今聞こえている位置(秒)を返す関数
+  std::mutex clock_mutex_;
+  std::function<double ()> clock_;
+
+  size_t fft_size_;
+  u_int band_num_;
+
+  // 以下は解析用のスレッドだけが使う
+  std::vector<float> window_;
+  std::vector<float> samples_;
+  std::vector<float> re_;
+  std::vector<float> im_;
+  std::vector<float> twiddle_re_;
+  std::vector<float> twiddle_im_;
+  std::vector<float> post_re_;
+  std::vector<float> post_im_;
+  std::vector<u_int> bit_reverse_;
+  std::vector<float> magnitude_;
+  // 帯域ごとの範囲(スペクトルの番号)
+  std::vector<u_int> band_edge_;
+  u_int band_rate_;
+
+  // 解析結果
+  mutable std::mutex result_mutex_;
+  AudioLevel level_;
+  std::vector<float> spectrum_;
+  std::vector<float> bands_;
+
+  std::atomic<u_long> analyzed_;
+  std::atomic<u_long> analyze_ns_;
+
+  // 解析用のスレッド
+  std::chrono::duration<double> interval_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool finish_;
+  std::thread thread_;
+
+
+public:
+  // fft_size  スペクトルを求めるサンプル数(2のべき乗)
+  // band_num  スペクトルをまとめる帯域の数(対数で等間隔)
+  // update_hz 1秒間に解析する回数
+  explicit AudioAnalyzer(const size_t fft_size = 2048, const u_int band_num = 16,
+                         const float update_hz = 60.0f);
+  ~AudioAnalyzer();
+
+  // このクラスはコピー禁止
+  AudioAnalyzer(const AudioAnalyzer&) = delete;
+  AudioAnalyzer& operator=(const AudioAnalyzer&) = delete;
+
+
+  // 波形を書き込む(再生側のスレッドから呼ぶ)
+  // pcm モノラルか、左右交互に並んだステレオ
+  void write(const int16_t* pcm, const size_t frames, const u_int ch, const u_int rate);
+
+  // samples 左右交互に並んだステレオ
+  void write(const float* samples, const size_t frames, const u_int rate);
+
+  // 書き込んだ波形を捨てる(シークした時など)
+  void reset();
+
+  // 今聞こえている位置を返す関数
+  // TIPS:書き込んだ波形の先頭からの秒数を返す。指定しなければ最後に書き込んだ位置を解析する
+  void clock(std::function<double ()> func);
+
+  // 書き込んだフレーム数
+  uint64_t written() const;
+
+  size_t fftSize() const;
+  u_int bandNum() const;
+
+  // 最後に解析した結果
+  AudioLevel level() const;
+
+  // 振幅 [0.0, 1.0] (fftSize() / 2 個)
+  // TIPS:n 番目は n * サンプリングレート / fftSize() Hz
+  void spectrum(std::vector<float>& out) const;
+
+  // 帯域ごとの振幅の最大値 [0.0, 1.0] (bandNum() 個)
+  void bands(std::vector<float>& out) const;
+
+  // 一回の解析にかかった時間の平均(ミリ秒)
+  double analyzeMs() const;
+
+
+private:
+  // 解析する
+  // 戻り値 解析できたらtrue
+  bool analyze();
+
+  // samples_ のスペクトルを magnitude_ に求める
+  void fft();
+
+  // 帯域の範囲を決める
+  void setupBands(const u_int rate);
+
+  // std::threadによる解析処理
+  void proc();
+
+};
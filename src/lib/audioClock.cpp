@@ -0,0 +1,167 @@
+﻿
+//
+// 再生位置をなめらかにする時計
+//
+
+#include "audioClock.hpp"
+#include <cmath>
+#include <algorithm>
+
+
+namespace {
+
+enum {
+  // 推定のやり直しから、ずれの補正を始めるまでの時間(ミリ秒)
+  DRIFT_START_MS = 2000,
+};
+
+// これ以上ずれていたら、シークや途切れとみなして推定をやり直す(秒)
+const double SNAP_SEC = 0.1;
+
+// ずれの補正の範囲
+const double MAX_DRIFT = 0.005;
+
+}
+
+
+AudioClock::AudioClock() :
+  valid_(false),
+  playing_(false),
+  base_sec_(0.0),
+  anchor_sec_(0.0),
+  drift_(1.0),
+  pitch_(1.0f),
+  slew_(0.0),
+  last_raw_(-1.0),
+  frame_sec_(1.0 / 60.0)
+{}
+
+
+// 再生位置を渡して推定を更新する
+void AudioClock::update(const PlaybackTime& time, const float pitch) {
+  auto now = Clock::now();
+
+  // フレームの間隔
+  if (last_update_ != Clock::time_point()) {
+    double interval = std::chrono::duration<double>(now - last_update_).count();
+    // TIPS:読み込みなどで止まったフレームは使わない
+    if ((interval > 0.0) && (interval < 0.1)) frame_sec_ += (interval - frame_sec_) * 0.1;
+  }
+  last_update_ = now;
+
+  // 実際に聞こえている位置
+  double heard = std::max(time.sec - time.latency, 0.0);
+
+  // 再生速度が変わった時は、今の推定から続ける
+  if (valid_ && (pitch != pitch_)) {
+    base_sec_    = estimate(now);
+    base_time_   = now;
+    anchor_sec_  = base_sec_;
+    anchor_time_ = now;
+  }
+  pitch_ = pitch;
+  slew_  = 0.0;
+
+  if (!time.playing) {
+    // 止まっている間は進めない
+    base_sec_  = heard;
+    base_time_ = now;
+    last_raw_  = time.sec;
+    playing_   = false;
+    valid_     = true;
+    return;
+  }
+
+  if (!valid_ || !playing_) {
+    restart(heard, now);
+    last_raw_ = time.sec;
+    return;
+  }
+
+  // TIPS:細かく進まない再生位置は、値が変わった時だけ使う
+  if (!time.precise && (time.sec == last_raw_)) return;
+  last_raw_ = time.sec;
+
+  double predicted = estimate(now);
+  double error = heard - predicted;
+  if (std::fabs(error) > SNAP_SEC) {
+    // シークしたか、再生が途切れた
+    restart(heard, now);
+    return;
+  }
+
+  // 細かく進まない再生位置は、実際の位置より先に進むことはない
+  // 推定より先なら素早く、後ならゆっくり合わせる
+  double gain = time.precise ? 0.1 : ((error > 0.0) ? 0.5 : 0.05);
+  if (error > 0.0) {
+    base_sec_ = predicted + error * gain;
+  }
+  else {
+    // NOTICE:戻さずに、次のフレームまでの進みを遅くする
+    base_sec_ = predicted;
+    slew_ = std::max(error * gain / frame_sec_, -0.5);
+  }
+  base_time_ = now;
+
+  // ずれの補正
+  // TIPS:長い時間での進みから求めるので、段階的に進む再生位置でも誤差は小さい
+  double elapsed = std::chrono::duration<double>(now - anchor_time_).count();
+  if ((elapsed * 1000.0) > DRIFT_START_MS) {
+    double drift = (heard - anchor_sec_) / (elapsed * pitch_);
+    drift_ = std::min(std::max(drift, 1.0 - MAX_DRIFT), 1.0 + MAX_DRIFT);
+  }
+}
+
+// 推定をやり直す
+void AudioClock::reset() {
+  valid_   = false;
+  playing_ = false;
+  drift_   = 1.0;
+  slew_    = 0.0;
+}
+
+// 今聞こえている再生位置(秒)
+double AudioClock::time() const {
+  return estimate(Clock::now());
+}
+
+// ahead 秒後に聞こえる再生位置(秒)
+double AudioClock::predict(const double ahead) const {
+  return estimate(Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(ahead)));
+}
+
+// 次の垂直同期の時に聞こえる再生位置(秒)
+double AudioClock::nextVsync() const {
+  auto frame = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(frame_sec_));
+  auto vsync = last_update_ + frame;
+  auto now = Clock::now();
+  // TIPS:処理が遅れて過ぎてしまっていたら、その次
+  while (vsync < now) vsync += frame;
+
+  return estimate(vsync);
+}
+
+// update() を呼んでいる間隔(秒)
+double AudioClock::frameInterval() const { return frame_sec_; }
+
+
+double AudioClock::estimate(const Clock::time_point time) const {
+  if (!valid_) return 0.0;
+  if (!playing_) return base_sec_;
+
+  double elapsed = std::chrono::duration<double>(time - base_time_).count();
+  // TIPS:遅くする分は次のフレームまで
+  double slew_sec = std::min(elapsed, frame_sec_);
+  return base_sec_ + (elapsed + slew_sec * slew_) * drift_ * pitch_;
+}
+
+// 推定をやり直す
+void AudioClock::restart(const double sec, const Clock::time_point time) {
+  base_sec_    = sec;
+  base_time_   = time;
+  anchor_sec_  = sec;
+  anchor_time_ = time;
+  drift_       = 1.0;
+  playing_     = true;
+  valid_       = true;
+}
@@ -0,0 +1,75 @@
+﻿
+#pragma once
+
+//
+// 再生位置をなめらかにする時計
+// OpenALの再生位置はミキシングの間隔でしか進まないので、CPUの時計で補間する
+//
+// NOTICE:毎フレーム、画面を更新した直後に update() を呼ぶこと
+//
+
+#include "defines.hpp"
+#include <chrono>
+#include "audio.hpp"
+
+
+class AudioClock {
+  typedef std::chrono::steady_clock Clock;
+
+  bool valid_;
+  bool playing_;
+
+  // この時刻にこの再生位置だった、という推定の基準
+  Clock::time_point base_time_;
+  double base_sec_;
+
+  // CPUの時計に対する進み具合(ずれの補正)
+  // TIPS:推定をやり直してからの再生位置の進みから求める
+  Clock::time_point anchor_time_;
+  double anchor_sec_;
+  double drift_;
+  float pitch_;
+
+  // 推定が進み過ぎた時は、次のフレームまでゆっくり進める
+  // TIPS:再生位置が戻らないようにする
+  double slew_;
+
+  // 最後に受け取った再生位置(段階的に進む値が変わったか調べる)
+  double last_raw_;
+
+  // フレームの間隔
+  Clock::time_point last_update_;
+  double frame_sec_;
+
+
+public:
+  AudioClock();
+
+  // 再生位置を渡して推定を更新する
+  // pitch 再生速度
+  void update(const PlaybackTime& time, const float pitch = 1.0f);
+
+  // 推定をやり直す(シークした時など)
+  void reset();
+
+  // 今聞こえている再生位置(秒)
+  double time() const;
+
+  // ahead 秒後に聞こえる再生位置(秒)
+  double predict(const double ahead) const;
+
+  // 次の垂直同期の時に聞こえる再生位置(秒)
+  // TIPS:update() を呼ぶ間隔から次の垂直同期の時刻を見積もる
+  double nextVsync() const;
+
+  // update() を呼んでいる間隔(秒)
+  double frameInterval() const;
+
+
+private:
+  double estimate(const Clock::time_point time) const;
+
+  // 推定をやり直す
+  void restart(const double sec, const Clock::time_point time);
+
+};
@@ -0,0 +1,130 @@
+﻿//
+// 描画をまとめる
+//
+
+#include "batch.hpp"
+#include <vector>
+#include <algorithm>
+
+
+enum {
+  // これ以上溜まったら描画してしまう
+  MAX_VERTICES = 4096 * 3,
+};
+
+static std::vector<BatchVertex> vertices;
+static GLuint current_texture = 0;
+static GLuint current_program = 0;
+
+static std::vector<Mat4> matrices;
+
+// テクスチャなしの描画に使う白一色のテクスチャ
+// TIPS:テクスチャのあり・なしで描画を分けなくて済む
+// FIXME:終了時に解放していない
+static GLuint whiteTexture() {
+  static GLuint id = 0;
+  if (!id) {
+    const GLubyte pixel[] = { 255, 255, 255, 255 };
+
+    glGenTextures(1, &id);
+    glBindTexture(GL_TEXTURE_2D, id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixel);
+  }
+  return id;
+}
+
+// テクスチャやシェーダーが変わる時や溜まりすぎた時は先に描画する
+static BatchVertex* allocVertices(const GLuint texture, const GLuint program, const size_t num) {
+  if (!vertices.empty()
+      && ((texture != current_texture) || (program != current_program)
+          || (vertices.size() + num > MAX_VERTICES))) {
+    flushBatch();
+  }
+  current_texture = texture;
+  current_program = program;
+
+  size_t size = vertices.size();
+  vertices.resize(size + num);
+  return &vertices[size];
+}
+
+static void transform(BatchVertex* vtx, const size_t num) {
+  if (matrices.empty()) return;
+
+  const Mat4& m = matrices.back();
+  for (size_t i = 0; i < num; ++i) {
+    Vec4f v = m * Vec4f(vtx[i].x, vtx[i].y, 0.0f, 1.0f);
+    vtx[i].x = v.x;
+    vtx[i].y = v.y;
+  }
+}
+
+
+// 三角形を追加
+// texture テクスチャのID(0 ならテクスチャなし)
+// vtx     頂点(3つで三角形ひとつ)
+// num     頂点数
+// program 描画に使うシェーダー(0 なら固定機能)
+void batchTriangles(const GLuint texture, const BatchVertex* vtx, const size_t num,
+                    const GLuint program) {
+  BatchVertex* dst = allocVertices(texture, program, num);
+  std::copy(vtx, vtx + num, dst);
+  transform(dst, num);
+}
+
+// 三角形を追加(位置と色を変更)
+// offset 全頂点に加える値
+// color  全頂点の色
+void batchTriangles(const GLuint texture, const BatchVertex* vtx, const size_t num,
+                    const Vec2f& offset, const GLuint color,
+                    const GLuint program) {
+  BatchVertex* dst = allocVertices(texture, program, num);
+  for (size_t i = 0; i < num; ++i) {
+    dst[i].x = vtx[i].x + offset.x;
+    dst[i].y = vtx[i].y + offset.y;
+    dst[i].u = vtx[i].u;
+    dst[i].v = vtx[i].v;
+    dst[i].color = color;
+  }
+  transform(dst, num);
+}
+
+// 溜まっている三角形を描画
+void flushBatch() {
+  if (vertices.empty()) return;
+
+  glBindTexture(GL_TEXTURE_2D, current_texture ? current_texture : whiteTexture());
+  if (current_program) glUseProgram(current_program);
+
+  glEnable(GL_TEXTURE_2D);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+  glEnableClientState(GL_COLOR_ARRAY);
+
+  glVertexPointer(2, GL_FLOAT, sizeof(BatchVertex), &vertices[0].x);
+  glTexCoordPointer(2, GL_FLOAT, sizeof(BatchVertex), &vertices[0].u);
+  glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(BatchVertex), &vertices[0].color);
+
+  glDrawArrays(GL_TRIANGLES, 0, GLsizei(vertices.size()));
+
+  glDisableClientState(GL_COLOR_ARRAY);
+  glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+  glDisable(GL_TEXTURE_2D);
+
+  if (current_program) glUseProgram(0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  vertices.clear();
+}
+
+// 追加する頂点に変換行列を適用する
+void pushBatchMatrix(const Mat4& matrix) {
+  matrices.push_back(matrices.empty() ? matrix : matrices.back() * matrix);
+}
+
+void popBatchMatrix() {
+  matrices.pop_back();
+}
@@ -0,0 +1,50 @@
+﻿#pragma once
+
+//
+// 描画をまとめる
+// 同じテクスチャを使う三角形を頂点配列に溜めておき、一度に描画する
+//
+// NOTICE:OpenGLの状態(行列やテクスチャなど)を直接変更する時は
+//        先にflushBatch()を呼ぶこと
+//
+
+#include "defines.hpp"
+#include <cstddef>
+#include "vector.hpp"
+#include "matrix.hpp"
+
+
+// 頂点
+// color は Color::rgba() でまとめた値
+struct BatchVertex {
+  GLfloat x, y;
+  GLfloat u, v;
+  GLuint color;
+};
+
+
+// 三角形を追加
+// texture テクスチャのID(0 ならテクスチャなし)
+// vtx     頂点(3つで三角形ひとつ)
+// num     頂点数
+// program 描画に使うシェーダー(0 なら固定機能)
+//         uniformを変更する時は先にflushBatch()を呼ぶこと
+void batchTriangles(const GLuint texture, const BatchVertex* vtx, const size_t num,
+                    const GLuint program = 0);
+
+// 三角形を追加(位置と色を変更)
+// 同じ頂点を場所を変えて何度も描画する時に使う
+// offset 全頂点に加える値
+// color  全頂点の色
+void batchTriangles(const GLuint texture, const BatchVertex* vtx, const size_t num,
+                    const Vec2f& offset, const GLuint color,
+                    const GLuint program = 0);
+
+// 溜まっている三角形を描画
+void flushBatch();
+
+// 追加する頂点に変換行列を適用する
+// TIPS:OpenGLの行列を変更すると溜まっている三角形まで影響を受けるので
+//      回転や拡大縮小はCPU側で済ませる
+void pushBatchMatrix(const Mat4& matrix);
+void popBatchMatrix();
@@ -3,6 +3,7 @@
 //
 
 #include "fileUtil.hpp"
+#include <vector>
 
 
 // ディレクトリ名を返す
@@ -46,3 +47,39 @@ bool isValidPath(const std::string& path) {
 	return (result == 0);
 	// TODO: ディレクトリかどうかも判定
 }
+
+// パスの表記を揃える
+// ex) hoge\fuga/./piyo/../foo.txt -> hoge/fuga/foo.txt
+std::string normalizePath(const std::string& path) {
+  bool absolute = !path.empty() && ((path[0] == '/') || (path[0] == '\\'));
+
+  // 区切りごとに分けて、"." と ".." を取り除く
+  std::vector<std::string> names;
+  std::string name;
+  for (size_t i = 0; i <= path.length(); ++i) {
+    if ((i < path.length()) && (path[i] != '/') && (path[i] != '\\')) {
+      name += path[i];
+      continue;
+    }
+
+    if (name == "..") {
+      if (!names.empty() && (names.back() != "..")) {
+        names.pop_back();
+      }
+      else if (!absolute) {
+        names.push_back(name);
+      }
+    }
+    else if (!name.empty() && (name != ".")) {
+      names.push_back(name);
+    }
+    name.clear();
+  }
+
+  std::string result = absolute ? "/" : "";
+  for (size_t i = 0; i < names.size(); ++i) {
+    if (i > 0) result += '/';
+    result += names[i];
+  }
+  return result;
+}
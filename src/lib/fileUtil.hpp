@@ -31,3 +31,7 @@ std::string replaceFilenameExt(const std::string& path, const std::string& ext);
 
 // パスの有効判定
 bool isValidPath(const std::string& path);
+
+// パスの表記を揃える
+// ex) hoge\fuga/./piyo/../foo.txt -> hoge/fuga/foo.txt
+std::string normalizePath(const std::string& path);
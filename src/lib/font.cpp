@@ -4,16 +4,363 @@
 
 #define FONTSTASH_IMPLEMENTATION
 #include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <thread>
+#include <atomic>
 #include "font.hpp"
+#include "matrix.hpp"
+
+
+// アトラスを書き出したファイルの識別子
+static const char atlas_file_id[] = { 'F', 'A', 'T', 'L' };
+enum {
+  ATLAS_FILE_VERSION = 2,
+};
+
+// アトラスを詰め直す時に残すグリフの量(アトラスの面積に対する割合)
+// TIPS:空きを多めに作っておくと、詰め直す回数が減る
+enum {
+  COMPACT_KEEP_PERCENT = 50,
+};
+
+// フォントデータの照合用
+// FNV-1a
+static u_int fontChecksum(const FONSfont* font) {
+  u_int hash = 2166136261u;
+  for (int i = 0; i < font->dataSize; ++i) {
+    hash = (hash ^ font->data[i]) * 16777619u;
+  }
+  return hash;
+}
+
+// SDFのグリフ
+enum {
+  // 輪郭の外側に確保する距離(ピクセル)
+  SDF_PADDING = 6,
+  // 輪郭上の値
+  SDF_ONEDGE  = 128,
+  // fontstashのグリフ情報で、SDFのグリフを区別するための値
+  // TIPS:fontstashのぼかしは0〜20なので重ならない
+  SDF_GLYPH_BLUR = -1,
+};
+
+// 1ピクセルあたりの距離場の値の変化
+static const float sdf_dist_scale = float(SDF_ONEDGE) / SDF_PADDING;
+
+
+// SDF描画用シェーダー
+// TIPS:固定機能の頂点色とテクスチャ座標をそのまま使う
+static const char* sdf_vertex_shader =
+  "#version 120\n"
+  "void main() {\n"
+  "  gl_FrontColor = gl_Color;\n"
+  "  gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+  "  gl_Position = ftransform();\n"
+  "}\n";
+
+static const char* sdf_fragment_shader =
+  "#version 120\n"
+  "uniform sampler2D tex;\n"
+  "uniform float outline_width;\n"
+  "uniform vec4 outline_color;\n"
+  "uniform float glow_width;\n"
+  "uniform vec4 glow_color;\n"
+  "void main() {\n"
+  "  float d = texture2D(tex, gl_TexCoord[0].st).a;\n"
+  "  float w = max(fwidth(d) * 0.5, 0.001);\n"
+  "  float fill = smoothstep(0.5 - w, 0.5 + w, d);\n"
+  "  float edge = 0.5 - outline_width;\n"
+  "  float line = smoothstep(edge - w, edge + w, d);\n"
+  "  vec3 rgb = mix(outline_color.rgb, gl_Color.rgb, fill);\n"
+  "  float a = max(fill, line * outline_color.a) * gl_Color.a;\n"
+  "  float glow = smoothstep(edge - glow_width, edge, d) * glow_color.a * gl_Color.a;\n"
+  "  glow *= step(0.0001, glow_width);\n"
+  "  float out_a = a + glow * (1.0 - a);\n"
+  "  rgb = (rgb * a + glow_color.rgb * glow * (1.0 - a)) / max(out_a, 0.0001);\n"
+  "  gl_FragColor = vec4(rgb, out_a);\n"
+  "}\n";
+
+static GLuint compileShader(const GLenum type, const char* source) {
+  GLuint shader = glCreateShader(type);
+  glShaderSource(shader, 1, &source, nullptr);
+  glCompileShader(shader);
+
+  GLint status;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+  if (!status) {
+    char log[1024];
+    glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+    DOUT << log << std::endl;
+    throw "Can't compile SDF shader.";
+  }
+  return shader;
+}
+
+// TIPS:最初に使う時に作成する(OpenGLの初期化後でないと作れない)
+// FIXME:終了時に解放していない
+static GLuint sdfProgram() {
+  static GLuint program = 0;
+  if (!program) {
+    program = glCreateProgram();
+    glAttachShader(program, compileShader(GL_VERTEX_SHADER, sdf_vertex_shader));
+    glAttachShader(program, compileShader(GL_FRAGMENT_SHADER, sdf_fragment_shader));
+    glLinkProgram(program);
+
+    GLint status;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (!status) throw "Can't link SDF shader.";
+  }
+  return program;
+}
+
+// 縁取りと光彩をシェーダーに設定
+// 設定が変わる時は、溜まっている描画を先に済ませる
+static void applySdfStyle(const SdfStyle& style) {
+  static SdfStyle current;
+  static bool applied = false;
+  if (applied && (style == current)) return;
+
+  flushBatch();
+
+  GLuint program = sdfProgram();
+  glUseProgram(program);
+  glUniform1i(glGetUniformLocation(program, "tex"), 0);
+  // ピクセル数を距離場の値に変換
+  glUniform1f(glGetUniformLocation(program, "outline_width"), style.outline_width * sdf_dist_scale / 255.0f);
+  glUniform4f(glGetUniformLocation(program, "outline_color"),
+              style.outline_color.r(), style.outline_color.g(), style.outline_color.b(), style.outline_color.a());
+  glUniform1f(glGetUniformLocation(program, "glow_width"), style.glow_width * sdf_dist_scale / 255.0f);
+  glUniform4f(glGetUniformLocation(program, "glow_color"),
+              style.glow_color.r(), style.glow_color.g(), style.glow_color.b(), style.glow_color.a());
+  glUseProgram(0);
+
+  current = style;
+  applied = true;
+}
+
+// ラスタライズしたグリフ
+// アトラスに追加する前の状態
+struct StagedGlyph {
+  unsigned int codepoint;
+  // グリフを持っているフォント(代替フォントの場合もある)
+  FONSfont* render_font;
+  int index;
+
+  int width, height;
+  int xoff, yoff;
+  short xadv;
+  std::vector<u_char> pixels;
+};
+
+// fontstashのグリフ情報から探す
+static FONSglyph* lookupGlyph(FONSfont* font, const unsigned int codepoint,
+                              const short isize, const short blur) {
+  u_int hash = fons__hashint(codepoint) & (FONS_HASH_LUT_SIZE - 1);
+  for (int i = font->lut[hash]; i != -1; i = font->glyphs[i].next) {
+    const FONSglyph& glyph = font->glyphs[i];
+    if ((glyph.codepoint == codepoint) && (glyph.size == isize) && (glyph.blur == blur)) {
+      return &font->glyphs[i];
+    }
+  }
+  return nullptr;
+}
+
+// グリフを持っているフォントを探す(代替フォントも探す)
+static void resolveGlyph(FONScontext* context, FONSfont* font, StagedGlyph& staged) {
+  staged.render_font = font;
+  staged.index = fons__tt_getGlyphIndex(&font->font, staged.codepoint);
+  for (int i = 0; !staged.index && (i < font->nfallbacks); ++i) {
+    FONSfont* fallback = context->fonts[font->fallbacks[i]];
+    int index = fons__tt_getGlyphIndex(&fallback->font, staged.codepoint);
+    if (index) {
+      staged.index = index;
+      staged.render_font = fallback;
+    }
+  }
+}
+
+// グリフをラスタライズする
+// info.userdata は作業領域を持つFONScontext
+// TIPS:作業領域を別に用意すれば、別のスレッドから呼び出せる
+static void rasterizeGlyph(const stbtt_fontinfo& info, const short isize, const bool sdf,
+                           StagedGlyph& staged) {
+  // TIPS:stb_truetypeはfontstashの作業領域からメモリを確保する
+  ((FONScontext*)info.userdata)->nscratch = 0;
+
+  float scale = stbtt_ScaleForPixelHeight(&info, isize / 10.0f);
+  int advance, lsb;
+  stbtt_GetGlyphHMetrics(&info, staged.index, &advance, &lsb);
+  staged.xadv = short(scale * advance * 10.0f);
+
+  if (sdf) {
+    int w = 0;
+    int h = 0;
+    int xoff = 0;
+    int yoff = 0;
+    u_char* data = stbtt_GetGlyphSDF(&info, scale, staged.index,
+                                     SDF_PADDING, SDF_ONEDGE, sdf_dist_scale,
+                                     &w, &h, &xoff, &yoff);
+    if (data) {
+      staged.width  = w;
+      staged.height = h;
+      staged.xoff   = xoff;
+      staged.yoff   = yoff;
+      staged.pixels.assign(data, data + w * h);
+    }
+    else {
+      // 空白などは1ピクセルの空き領域を使う
+      staged.width  = 1;
+      staged.height = 1;
+      staged.xoff   = 0;
+      staged.yoff   = 0;
+      staged.pixels.assign(1, 0);
+    }
+    return;
+  }
+
+  // fontstashと同じく周囲に2ピクセルの余白をつける
+  const int pad = 2;
+  int x0, y0, x1, y1;
+  stbtt_GetGlyphBitmapBox(&info, staged.index, scale, scale, &x0, &y0, &x1, &y1);
+  staged.width  = x1 - x0 + pad * 2;
+  staged.height = y1 - y0 + pad * 2;
+  staged.xoff   = x0 - pad;
+  staged.yoff   = y0 - pad;
+  staged.pixels.assign(staged.width * staged.height, 0);
+  stbtt_MakeGlyphBitmap(&info, &staged.pixels[pad + pad * staged.width],
+                        x1 - x0, y1 - y0, staged.width, scale, scale, staged.index);
+}
+
+// ラスタライズしたグリフをアトラスに追加
+static FONSglyph* insertGlyph(FONScontext* context, FONSfont* font, const StagedGlyph& staged,
+                              const short isize, const short blur) {
+  int gw = staged.width;
+  int gh = staged.height;
+
+  int gx, gy;
+  int added = fons__atlasAddRect(context->atlas, gw, gh, &gx, &gy);
+  if (!added && context->handleError) {
+    context->handleError(context->errorUptr, FONS_ATLAS_FULL, 0);
+    added = fons__atlasAddRect(context->atlas, gw, gh, &gx, &gy);
+  }
+  if (!added) return nullptr;
+
+  u_int hash = fons__hashint(staged.codepoint) & (FONS_HASH_LUT_SIZE - 1);
+  FONSglyph* glyph = fons__allocGlyph(font);
+  glyph->codepoint = staged.codepoint;
+  glyph->size  = isize;
+  glyph->blur  = blur;
+  glyph->index = staged.index;
+  glyph->x0    = short(gx);
+  glyph->y0    = short(gy);
+  glyph->x1    = short(gx + gw);
+  glyph->y1    = short(gy + gh);
+  glyph->xadv  = staged.xadv;
+  glyph->xoff  = short(staged.xoff);
+  glyph->yoff  = short(staged.yoff);
+  glyph->next  = font->lut[hash];
+  font->lut[hash] = font->nglyphs - 1;
+
+  u_char* dst = &context->texData[gx + gy * context->params.width];
+  for (int y = 0; y < gh; ++y) {
+    auto src = std::begin(staged.pixels) + y * gw;
+    std::copy(src, src + gw, dst + y * context->params.width);
+  }
+
+  context->dirtyRect[0] = std::min(context->dirtyRect[0], int(glyph->x0));
+  context->dirtyRect[1] = std::min(context->dirtyRect[1], int(glyph->y0));
+  context->dirtyRect[2] = std::max(context->dirtyRect[2], int(glyph->x1));
+  context->dirtyRect[3] = std::max(context->dirtyRect[3], int(glyph->y1));
+
+  return glyph;
+}
+
+// SDFのグリフを探す
+// 見つからなければ基準サイズで作成してアトラスに追加する
+static FONSglyph* sdfGlyph(FONScontext* context, FONSfont* font, const unsigned int codepoint) {
+  const short isize = Font::SDF_SIZE * 10;
+
+  FONSglyph* glyph = lookupGlyph(font, codepoint, isize, SDF_GLYPH_BLUR);
+  if (glyph) return glyph;
+
+  StagedGlyph staged;
+  staged.codepoint = codepoint;
+  resolveGlyph(context, font, staged);
+  rasterizeGlyph(staged.render_font->font.font, isize, true, staged);
+
+  return insertGlyph(context, font, staged, isize, SDF_GLYPH_BLUR);
+}
+
+
+// アトラスの使用率 [0.0, 1.0]
+// TIPS:skylineの高さから求めているので、実際より少し大きめの値になる
+static float atlasUsageOf(const FONScontext* context) {
+  const FONSatlas* atlas = context->atlas;
+
+  double area = 0.0;
+  for (int i = 0; i < atlas->nnodes; ++i) {
+    area += double(atlas->nodes[i].y) * atlas->nodes[i].width;
+  }
+  return float(area / (double(atlas->width) * atlas->height));
+}
+
+
+// 追い出したグリフを覚えておくためのキー
+static uint64_t glyphKey(const int font, const FONSglyph& glyph) {
+  return (uint64_t(font & 0xff) << 56)
+    | (uint64_t(u_short(glyph.blur) & 0xff) << 48)
+    | (uint64_t(u_short(glyph.size)) << 32)
+    | glyph.codepoint;
+}
+
+// グリフを探す(無ければラスタライズする)
+// 使ったフレームと、追い出したグリフのラスタライズし直しを記録する
+static FONSglyph* findGlyph(FontAtlas* atlas, const int font_index,
+                            const unsigned int codepoint, const short isize, const bool sdf) {
+  FONSfont* font = atlas->context->fonts[font_index];
+  int num = font->nglyphs;
+  u_int generation = atlas->generation;
+
+  FONSglyph* glyph = sdf ? sdfGlyph(atlas->context, font, codepoint)
+                         : fons__getGlyph(atlas->context, font, codepoint, isize, 0);
+  if (!glyph) return nullptr;
+
+  int index = int(glyph - font->glyphs);
+  bool created = (index == font->nglyphs - 1)
+    && ((font->nglyphs != num) || (atlas->generation != generation));
+  if (created && atlas->evicted_glyphs.erase(glyphKey(font_index, *glyph))) {
+    atlas->stats.rerasterized += 1;
+  }
+  atlas->touch(font_index, index);
+
+  return glyph;
+}
+
+
+template <typename T>
+static void writeValue(std::ofstream& fstr, const T& value) {
+  fstr.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+static T readValue(std::ifstream& fstr) {
+  T value = T();
+  fstr.read(reinterpret_cast<char*>(&value), sizeof(T));
+  return value;
+}
 
 
 int Font::create(void* userPtr, int width, int height) {
-  Context* gl = (Context*)userPtr;
+  FontAtlas* gl = (FontAtlas*)userPtr;
 
   gl->tex    = std::make_shared<GlTexture>();
   gl->width  = width;
   gl->height = height;
+  gl->generation += 1;
 
   gl->tex->bind();
   glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, gl->width, gl->height, 0, GL_ALPHA, GL_UNSIGNED_BYTE, 0);
@@ -28,7 +375,7 @@ int Font::resize(void* userPtr, int width, int height) {
 }
 
 void Font::update(void* userPtr, int* rect, const unsigned char* data) {
-  Context* gl = (Context*)userPtr;
+  FontAtlas* gl = (FontAtlas*)userPtr;
   if (!gl->tex) return;
 
   int w = rect[2] - rect[0];
@@ -46,37 +393,61 @@ void Font::update(void* userPtr, int* rect, const unsigned char* data) {
 }
 
 void Font::draw(void* userPtr, const float* verts, const float* tcoords, const unsigned int* colors, int nverts) {
-  Context* gl = (Context*)userPtr;
+  FontAtlas* gl = (FontAtlas*)userPtr;
   if (!gl->tex) return;
 
-  gl->tex->bind();
+  std::vector<BatchVertex> vtx(nverts);
+  for (int i = 0; i < nverts; ++i) {
+    vtx[i] = { verts[i * 2], verts[i * 2 + 1], tcoords[i * 2], tcoords[i * 2 + 1], colors[i] };
+  }
+  batchTriangles(gl->tex->id(), &vtx[0], vtx.size());
+}
 
-  glEnable(GL_TEXTURE_2D);
-  glEnableClientState(GL_VERTEX_ARRAY);
-  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-  glEnableClientState(GL_COLOR_ARRAY);
 
-  glVertexPointer(2, GL_FLOAT, sizeof(float) * 2, verts);
-  glTexCoordPointer(2, GL_FLOAT, sizeof(float) * 2, tcoords);
-  glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(unsigned int), colors);
+// アトラスがいっぱいになった時に呼ばれる
+// 最大サイズになるまで縦横を倍に広げる
+// TIPS:グリフの位置は変わらないので、ラスタライズし直さなくて済む
+static void atlasError(void* uptr, int error, int val) {
+  FontAtlas* atlas = (FontAtlas*)uptr;
+  if (error != FONS_ATLAS_FULL) {
+    DOUT << "fontstash error:" << error << " " << val << std::endl;
+    return;
+  }
 
-  glDrawArrays(GL_TRIANGLES, 0, nverts);
+  int width  = atlas->context->params.width;
+  int height = atlas->context->params.height;
+  if ((width >= atlas->max_size) && (height >= atlas->max_size)) {
+    // これ以上広げられないので、使っていないグリフを追い出す
+    if (!atlas->compact()) {
+      DOUT << "Font atlas is full." << std::endl;
+    }
+    return;
+  }
 
-  glDisable(GL_TEXTURE_2D);
-  glDisableClientState(GL_VERTEX_ARRAY);
-  glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-  glDisableClientState(GL_COLOR_ARRAY);
+  width  = std::min(width * 2, atlas->max_size);
+  height = std::min(height * 2, atlas->max_size);
+  fonsExpandAtlas(atlas->context, width, height);
+  DOUT << "Font atlas expanded: " << width << "x" << height << std::endl;
 }
 
 
-// コンストラクタ
-// font_path フォントファイル(ttf,otf)
-Font::Font(const std::string& path) {
+FontAtlas::FontAtlas(const int width, const int height, const int max_size)
+  : context(nullptr),
+    width(0),
+    height(0),
+    max_size(max_size),
+    generation(0),
+    stats()
+{
+  GLint max_texture_size = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+  if (max_texture_size > 0) this->max_size = std::min(max_size, int(max_texture_size));
+
   FONSparams params;
 
   memset(&params, 0, sizeof(params));
-  params.width  = 1024;
-  params.height = 1024;
+  params.width  = width;
+  params.height = height;
   params.flags  = (unsigned char)FONS_ZERO_BOTTOMLEFT;
 
   params.renderCreate = Font::create;
@@ -85,32 +456,397 @@ Font::Font(const std::string& path) {
   params.renderDraw   = Font::draw;
   params.renderDelete = nullptr;
 
-  params.userPtr = &gl_;
+  params.userPtr = this;
+
+  context = fonsCreateInternal(&params);
+  if (!context) throw "Can't create font atlas.";
 
-  context_ = fonsCreateInternal(&params);
+  fonsSetErrorCallback(context, atlasError, this);
 
-  fonsClearState(context_);
-  int handle = fonsAddFont(context_, "font", path.c_str());
-  fonsSetFont(context_, handle);
-  fonsSetSize(context_, DEFAULT_SIZE);
+  fonsClearState(context);
   // TIPS:下揃えにしておくと、下にはみ出す部分も正しく扱える
-  fonsSetAlign(context_, FONS_ALIGN_BOTTOM);
+  fonsSetAlign(context, FONS_ALIGN_BOTTOM);
+}
+
+FontAtlas::~FontAtlas() {
+  fonsDeleteInternal(context);
+}
+
+
+// 現在のフレーム
+u_int FontAtlas::frame = 0;
+
+// フレームを進める
+void FontAtlas::nextFrame() {
+  frame += 1;
+}
+
+// グリフを使ったことを記録
+void FontAtlas::touch(const int font, const int glyph) {
+  if (int(glyph_frames.size()) <= font) glyph_frames.resize(font + 1);
+
+  auto& frames = glyph_frames[font];
+  if (int(frames.size()) <= glyph) frames.resize(glyph + 1, 0);
+  frames[glyph] = frame;
+}
+
+// 最近使ったグリフだけを残してアトラスを詰め直す
+// TIPS:ラスタライズし直さず、ピクセルをコピーして詰め直す
+//      転送は使っている範囲だけ
+bool FontAtlas::compact() {
+  // 溜まっている描画は詰め直す前のアトラスを使っている
+  flushBatch();
+
+  const int width  = context->params.width;
+  const int height = context->params.height;
+
+  struct Entry {
+    int font;
+    int index;
+    u_int frame;
+  };
+
+  std::vector<Entry> entries;
+  for (int f = 0; f < context->nfonts; ++f) {
+    const FONSfont* font = context->fonts[f];
+    for (int i = 0; i < font->nglyphs; ++i) {
+      u_int used = ((f < int(glyph_frames.size())) && (i < int(glyph_frames[f].size())))
+                   ? glyph_frames[f][i] : 0;
+      entries.push_back({ f, i, used });
+    }
+  }
+
+  // 最近使った順に詰めていく
+  std::stable_sort(std::begin(entries), std::end(entries),
+                   [](const Entry& a, const Entry& b) { return a.frame > b.frame; });
+
+  std::vector<u_char> pixels(context->texData, context->texData + width * height);
+  std::fill(context->texData, context->texData + width * height, 0);
+  fons__atlasReset(context->atlas, width, height);
+  fons__addWhiteRect(context, 2, 2);
+
+  std::vector<std::vector<FONSglyph>> glyphs(context->nfonts);
+  std::vector<std::vector<u_int>> frames(context->nfonts);
+  const long limit = long(width) * height * COMPACT_KEEP_PERCENT / 100;
+  long area = 0;
+  u_int evicted = 0;
+  bool moved = false;
+  for (const auto& entry : entries) {
+    FONSglyph glyph = context->fonts[entry.font]->glyphs[entry.index];
+    int gw = glyph.x1 - glyph.x0;
+    int gh = glyph.y1 - glyph.y0;
+
+    // 今のフレームと直前のフレームで使ったグリフは必ず残す
+    bool recent = (frame - entry.frame) <= 1;
+    int gx, gy;
+    if ((recent || (area + gw * gh <= limit))
+        && fons__atlasAddRect(context->atlas, gw, gh, &gx, &gy)) {
+      for (int y = 0; y < gh; ++y) {
+        const u_char* src = &pixels[glyph.x0 + (glyph.y0 + y) * width];
+        std::copy(src, src + gw, &context->texData[gx + (gy + y) * width]);
+      }
+      if ((glyph.x0 != gx) || (glyph.y0 != gy)) moved = true;
+      glyph.x0 = short(gx);
+      glyph.y0 = short(gy);
+      glyph.x1 = short(gx + gw);
+      glyph.y1 = short(gy + gh);
+
+      glyphs[entry.font].push_back(glyph);
+      frames[entry.font].push_back(entry.frame);
+      area += gw * gh;
+    }
+    else {
+      evicted_glyphs.insert(glyphKey(entry.font, glyph));
+      evicted += 1;
+    }
+  }
+
+  // グリフ情報と検索用のハッシュを作り直す
+  for (int f = 0; f < context->nfonts; ++f) {
+    FONSfont* font = context->fonts[f];
+    std::copy(std::begin(glyphs[f]), std::end(glyphs[f]), font->glyphs);
+    font->nglyphs = int(glyphs[f].size());
+
+    std::fill(std::begin(font->lut), std::end(font->lut), -1);
+    for (int i = 0; i < font->nglyphs; ++i) {
+      u_int h = fons__hashint(font->glyphs[i].codepoint) & (FONS_HASH_LUT_SIZE - 1);
+      font->glyphs[i].next = font->lut[h];
+      font->lut[h] = i;
+    }
+  }
+  glyph_frames = std::move(frames);
+
+  // 使っている範囲だけ転送する
+  int max_y = 0;
+  for (int i = 0; i < context->atlas->nnodes; ++i) {
+    max_y = std::max(max_y, int(context->atlas->nodes[i].y));
+  }
+  context->dirtyRect[0] = 0;
+  context->dirtyRect[1] = 0;
+  context->dirtyRect[2] = width;
+  context->dirtyRect[3] = max_y;
+
+  // グリフの位置が変わったら、レイアウトし直してもらう
+  // TIPS:何も変わらなかった時に増やすと、TextBlock::layout() が終わらなくなる
+  if (evicted || moved) generation += 1;
+
+  stats.evicted     += evicted;
+  stats.compactions += 1;
+  DOUT << "Font atlas compacted: evicted " << evicted << " glyphs" << std::endl;
+
+  return evicted > 0;
+}
+
+
+// width, height 最初のアトラスのサイズ
+// max_size      アトラスの最大サイズ
+FontManager::FontManager(const int width, const int height, const int max_size)
+  : atlas_(std::make_shared<FontAtlas>(width, height, max_size))
+{}
+
+// アトラスの現在のサイズ
+Vec2i FontManager::atlasSize() const {
+  return Vec2i(atlas_->context->params.width, atlas_->context->params.height);
+}
+
+// アトラスの使用率 [0.0, 1.0]
+float FontManager::atlasUsage() const {
+  return atlasUsageOf(atlas_->context);
+}
+
+// アトラスの統計
+const FontAtlasStats& FontManager::atlasStats() const {
+  return atlas_->stats;
+}
+
+
+SdfStyle::SdfStyle()
+  : enable(false),
+    outline_width(0.0f),
+    outline_color(Color::black),
+    glow_width(0.0f),
+    glow_color(Color::white)
+{}
+
+bool SdfStyle::operator==(const SdfStyle& rhs) const {
+  auto same = [](const Color& a, const Color& b) {
+    return (a.r() == b.r()) && (a.g() == b.g()) && (a.b() == b.b()) && (a.a() == b.a());
+  };
+
+  return (enable == rhs.enable)
+    && (outline_width == rhs.outline_width) && same(outline_color, rhs.outline_color)
+    && (glow_width == rhs.glow_width) && same(glow_color, rhs.glow_color);
+}
+
+bool SdfStyle::operator!=(const SdfStyle& rhs) const {
+  return !(*this == rhs);
+}
+
+
+TextBlock::TextBlock()
+  : font_(FONS_INVALID),
+    font_size_(0),
+    generation_(0),
+    size_(0.0f, 0.0f)
+{}
+
+TextBlock::TextBlock(const std::shared_ptr<FontAtlas>& atlas, const int font, const int size,
+                     const SdfStyle& sdf, const std::string& text)
+  : atlas_(atlas),
+    font_(font),
+    font_size_(size),
+    sdf_(sdf),
+    text_(text),
+    generation_(0),
+    size_(0.0f, 0.0f)
+{
+  layout();
+}
+
+// レイアウト
+// 途中でアトラスが広がるとUVが変わってしまうので、やり直す
+// TIPS:やり直す時はグリフが揃っているので、普通はもう広がらない
+// NOTICE:1フレームで使うグリフが最大サイズのアトラスにも収まらない時は、
+//        やり直しても変わり続けるので、一度だけにする
+void TextBlock::layout() const {
+  u_int generation = atlas_->generation;
+  build();
+  if (generation == atlas_->generation) return;
+
+  generation = atlas_->generation;
+  build();
+  if (generation != atlas_->generation) {
+    DOUT << "TextBlock: font atlas is too small for this frame." << std::endl;
+  }
+}
+
+// 頂点を生成する
+// TIPS:fonsDrawTextとfonsTextBoundsを一度にやっている
+// SDFの場合は基準サイズでレイアウトしてから拡大縮小する
+void TextBlock::build() const {
+  vtx_.clear();
+  glyphs_.clear();
+  size_ = Vec2f(0.0f, 0.0f);
+
+  FONScontext* context = atlas_->context;
+  FONSfont* font = context->fonts[font_];
+  short isize = short((sdf_.enable ? Font::SDF_SIZE : font_size_) * 10);
+  float scale = fons__tt_getPixelHeightScale(&font->font, isize / 10.0f);
+  float k = sdf_.enable ? float(font_size_) / Font::SDF_SIZE : 1.0f;
+
+  float x = 0.0f;
+  float y = fons__getVertAlign(context, font, FONS_ALIGN_BOTTOM, isize);
+  float max_x = x;
+  float max_y = y * k;
+  // SDFのグリフは輪郭の外側も含んでいる
+  float inset = sdf_.enable ? SDF_PADDING * k : 0.0f;
+
+  vtx_.reserve(text_.size() * 6);
+  unsigned int utf8state = 0;
+  unsigned int codepoint;
+  int prev_index = -1;
+  for (auto c : text_) {
+    if (fons__decutf8(&utf8state, &codepoint, static_cast<u_char>(c))) continue;
+
+    FONSglyph* glyph = findGlyph(atlas_.get(), font_, codepoint, isize, sdf_.enable);
+    if (glyph) {
+      FONSquad q;
+      if (sdf_.enable) {
+        // TIPS:拡大するので、fontstashのようにピクセル単位に丸めない
+        if (prev_index != -1) {
+          x += fons__tt_getGlyphKernAdvance(&font->font, prev_index, glyph->index) * scale;
+        }
+        q.x0 = (x + glyph->xoff) * k;
+        q.y0 = (y - glyph->yoff) * k;
+        q.x1 = q.x0 + (glyph->x1 - glyph->x0) * k;
+        q.y1 = q.y0 - (glyph->y1 - glyph->y0) * k;
+        q.s0 = glyph->x0 * context->itw;
+        q.t0 = glyph->y0 * context->ith;
+        q.s1 = glyph->x1 * context->itw;
+        q.t1 = glyph->y1 * context->ith;
+        x += glyph->xadv / 10.0f;
+      }
+      else {
+        fons__getQuad(context, font, prev_index, glyph, scale, 0.0f, &x, &y, &q);
+      }
+
+      const BatchVertex quad[] = {
+        { q.x0, q.y0, q.s0, q.t0, 0 },
+        { q.x1, q.y1, q.s1, q.t1, 0 },
+        { q.x1, q.y0, q.s1, q.t0, 0 },
+
+        { q.x0, q.y0, q.s0, q.t0, 0 },
+        { q.x0, q.y1, q.s0, q.t1, 0 },
+        { q.x1, q.y1, q.s1, q.t1, 0 },
+      };
+      vtx_.insert(std::end(vtx_), std::begin(quad), std::end(quad));
+      glyphs_.push_back(int(glyph - font->glyphs));
+
+      max_x = std::max(max_x, q.x1 - inset);
+      max_y = std::max(max_y, q.y0 - inset);
+    }
+    prev_index = glyph ? glyph->index : -1;
+  }
+
+  // 新しくラスタライズしたグリフを転送
+  // TIPS:アトラスが作り直されると世代が変わるので、転送後に記録する
+  fons__flush(context);
+  generation_ = atlas_->generation;
+
+  size_ = Vec2f(max_x, max_y);
+}
+
+// 描画した時のサイズ
+const Vec2f& TextBlock::size() const {
+  if (atlas_ && (generation_ != atlas_->generation)) layout();
+  return size_;
+}
+
+// 描画
+// pos   表示位置
+// color 表示色
+void TextBlock::draw(const Vec2f& pos, const Color& color) const {
+  if (!atlas_) return;
+  if (generation_ != atlas_->generation) layout();
+  if (vtx_.empty() || !atlas_->tex) return;
+
+  // 表示中のグリフはアトラスから追い出されないようにする
+  for (int glyph : glyphs_) {
+    atlas_->touch(font_, glyph);
+  }
+
+  // グリフのアトラスも他の画像と同じようにまとめて描画する
+  GLuint program = 0;
+  if (sdf_.enable) {
+    applySdfStyle(sdf_);
+    program = sdfProgram();
+  }
+  batchTriangles(atlas_->tex->id(), &vtx_[0], vtx_.size(), pos, color.rgba(), program);
+}
+
+// 描画(回転、拡大縮小つき)
+// pos       表示位置
+// color     表示色
+// angle_rad 回転角度(ラジアン)
+// scaling   横、縦の拡大縮小率
+// origin    文字列の原点位置
+void TextBlock::draw(const Vec2f& pos, const Color& color,
+                     const float angle_rad,
+                     const Vec2f& scaling,
+                     const Vec2f& origin) const {
+  auto matrix = transformMatrix2D(angle_rad,
+                                  Vec3f(pos.x, pos.y, 0.0f),
+                                  Vec3f(scaling.x, scaling.y, 1.0f));
+
+  pushBatchMatrix(matrix);
+  draw(-origin, color);
+  popBatchMatrix();
+}
+
+
+// コンストラクタ
+// font_path フォントファイル(ttf,otf)
+Font::Font(const std::string& path)
+  : Font(FontManager(), path)
+{}
+
+// コンストラクタ
+// manager アトラスを共有するFontManager
+// path    フォントファイルのパス(ttf,otf)
+Font::Font(const FontManager& manager, const std::string& path)
+  : atlas_(manager.atlas_),
+    size_(DEFAULT_SIZE)
+{
+  font_ = fonsAddFont(atlas_->context, path.c_str(), path.c_str());
+  if (font_ == FONS_INVALID) throw "Can't open font file.";
 
   DOUT << "Font(" << path << ")" << std::endl;
 }
 
+// グリフが無い文字を、別のフォントで表示する
+// 戻り値 true なら成功
+bool Font::addFallback(const Font& font) {
+  if (font.atlas_ != atlas_) {
+    DOUT << "Font::addFallback: fonts don't share the same atlas." << std::endl;
+    return false;
+  }
+
+  if (!fonsAddFallbackFont(atlas_->context, font_, font.font_)) return false;
+
+  // 表示できなかった文字があるかもしれないので作り直す
+  clearLayoutCache();
+  return true;
+}
+
 
 // フォントサイズ指定
 void Font::size(const int size) {
-  fonsSetSize(context_, size);
+  size_ = size;
 }
 
 // 描画した時のサイズを取得
 Vec2f Font::drawSize(const std::string& text) {
-  float bounds[4];
-  fonsTextBounds(context_, 0, 0, text.c_str(), nullptr, bounds);
-
-  return Vec2f{ bounds[2], bounds[3] };
+  return cachedLayout(text).size();
 }
 
 // 描画
@@ -118,6 +854,381 @@ Vec2f Font::drawSize(const std::string& text) {
 // pos   表示位置
 // color 表示色
 void Font::draw(const std::string& text, const Vec2f& pos, const Color& color) {
-  fonsSetColor(context_, color.rgba());
-  fonsDrawText(context_, pos.x, pos.y, text.c_str(), nullptr);
+  cachedLayout(text).draw(pos, color);
+}
+
+// 描画(回転、拡大縮小つき)
+// text      表示文字列
+// pos       表示位置
+// color     表示色
+// angle_rad 回転角度(ラジアン)
+// scaling   横、縦の拡大縮小率
+// origin    文字列の原点位置
+void Font::draw(const std::string& text, const Vec2f& pos, const Color& color,
+                const float angle_rad,
+                const Vec2f& scaling,
+                const Vec2f& origin) {
+  cachedLayout(text).draw(pos, color, angle_rad, scaling, origin);
+}
+
+// SDF(距離場)で描画するか
+void Font::sdf(const bool enable) {
+  if (sdf_.enable == enable) return;
+
+  sdf_.enable = enable;
+  clearLayoutCache();
+}
+
+// SDF描画時の縁取り
+// width 太さ(基準サイズでのピクセル数) 0 で縁取りなし
+void Font::outline(const float width, const Color& color) {
+  sdf_.outline_width = width;
+  sdf_.outline_color = color;
+  clearLayoutCache();
+}
+
+// SDF描画時の光彩
+// width 広がり(基準サイズでのピクセル数) 0 で光彩なし
+void Font::glow(const float width, const Color& color) {
+  sdf_.glow_width = width;
+  sdf_.glow_color = color;
+  clearLayoutCache();
+}
+
+// 現在のフォントサイズでレイアウトした文字列を返す
+TextBlock Font::layout(const std::string& text) const {
+  return TextBlock(atlas_, font_, size_, sdf_, text);
+}
+
+// レイアウト済みの文字列を探す
+// 見つからなければレイアウトして、古いものから捨てる
+const TextBlock& Font::cachedLayout(const std::string& text) {
+  std::string key = std::to_string(size_) + ':' + text;
+
+  auto it = layout_cache_.find(key);
+  if (it != std::end(layout_cache_)) {
+    // 先頭へ移動
+    layouts_.splice(std::begin(layouts_), layouts_, it->second);
+    return it->second->second;
+  }
+
+  if (layouts_.size() >= LAYOUT_CACHE_SIZE) {
+    layout_cache_.erase(layouts_.back().first);
+    layouts_.pop_back();
+  }
+
+  layouts_.emplace_front(key, layout(text));
+  layout_cache_.emplace(key, std::begin(layouts_));
+  return layouts_.front().second;
+}
+
+// 描画方法が変わった時は、レイアウトをすべて作り直す
+void Font::clearLayoutCache() {
+  layouts_.clear();
+  layout_cache_.clear();
+}
+
+
+// 文字をあらかじめアトラスに焼き込む
+// text   焼き込む文字(UTF-8)
+// sizes  フォントサイズ
+// 戻り値 かかった時間(秒)
+double Font::prebake(const std::string& text, const std::vector<int>& sizes) {
+  auto start_time = std::chrono::steady_clock::now();
+
+  FONScontext* context = atlas_->context;
+  // SDFはサイズによらず一度焼き込めばよい
+  const std::vector<int>& bake_sizes = sdf_.enable ? std::vector<int>{ SDF_SIZE } : sizes;
+
+  int num = 0;
+  for (int size : bake_sizes) {
+    unsigned int utf8state = 0;
+    unsigned int codepoint;
+    for (auto c : text) {
+      if (fons__decutf8(&utf8state, &codepoint, static_cast<u_char>(c))) continue;
+
+      // TIPS:未登録のグリフはここでラスタライズされる
+      FONSglyph* glyph = findGlyph(atlas_.get(), font_, codepoint, short(size * 10), sdf_.enable);
+      if (glyph) num += 1;
+    }
+  }
+
+  // まとめてテクスチャへ転送
+  fons__flush(context);
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+  DOUT << "Font::prebake " << num << " glyphs "
+       << elapsed.count() * 1000.0 << "ms "
+       << "atlas:" << atlasUsage() * 100.0f << "%" << std::endl;
+
+  return elapsed.count();
+}
+
+// 表示予定の文字列のグリフを複数のスレッドでラスタライズする
+// texts  表示予定の文字列(UTF-8)
+// 戻り値 ラスタライズしたグリフの数
+int Font::prepare(const std::vector<std::string>& texts) {
+  auto start_time = std::chrono::steady_clock::now();
+
+  FONScontext* context = atlas_->context;
+  FONSfont* font = context->fonts[font_];
+  const short isize = short((sdf_.enable ? SDF_SIZE : size_) * 10);
+  const short blur  = sdf_.enable ? SDF_GLYPH_BLUR : 0;
+
+  // アトラスに無いグリフを集める
+  std::vector<StagedGlyph> jobs;
+  std::unordered_set<unsigned int> codepoints;
+  for (const auto& text : texts) {
+    unsigned int utf8state = 0;
+    unsigned int codepoint;
+    for (auto c : text) {
+      if (fons__decutf8(&utf8state, &codepoint, static_cast<u_char>(c))) continue;
+      if (!codepoints.insert(codepoint).second) continue;
+
+      FONSglyph* glyph = lookupGlyph(font, codepoint, isize, blur);
+      if (glyph) {
+        atlas_->touch(font_, int(glyph - font->glyphs));
+        continue;
+      }
+
+      StagedGlyph staged;
+      staged.codepoint = codepoint;
+      resolveGlyph(context, font, staged);
+      jobs.push_back(std::move(staged));
+    }
+  }
+  if (jobs.empty()) return 0;
+
+  // ラスタライズはスレッドごとに別の作業領域で行う
+  // TIPS:stb_truetypeのフォントデータは読み出しだけなので共有できる
+  int num_threads = std::max(1, std::min(int(std::thread::hardware_concurrency()), int(jobs.size())));
+  std::atomic<int> next_job(0);
+  auto worker = [&]() {
+    std::unique_ptr<FONScontext> scratch_context(new FONScontext());
+    std::vector<u_char> scratch(FONS_SCRATCH_BUF_SIZE);
+    scratch_context->scratch = scratch.data();
+
+    for (int i = next_job++; i < int(jobs.size()); i = next_job++) {
+      stbtt_fontinfo info = jobs[i].render_font->font.font;
+      info.userdata = scratch_context.get();
+      rasterizeGlyph(info, isize, sdf_.enable, jobs[i]);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int i = 1; i < num_threads; ++i) {
+    threads.emplace_back(worker);
+  }
+  // TIPS:メインスレッドも作業に加わる
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  // アトラスへの追加はメインスレッドでまとめて行う
+  int num = 0;
+  for (const auto& staged : jobs) {
+    FONSglyph* glyph = insertGlyph(context, font, staged, isize, blur);
+    if (!glyph) continue;
+
+    if (atlas_->evicted_glyphs.erase(glyphKey(font_, *glyph))) {
+      atlas_->stats.rerasterized += 1;
+    }
+    atlas_->touch(font_, int(glyph - font->glyphs));
+    num += 1;
+  }
+
+  // 更新した範囲を一度に転送
+  fons__flush(context);
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+  DOUT << "Font::prepare " << num << " glyphs "
+       << num_threads << " threads "
+       << elapsed.count() * 1000.0 << "ms" << std::endl;
+
+  return num;
+}
+
+// アトラスの使用率 [0.0, 1.0]
+float Font::atlasUsage() const {
+  return atlasUsageOf(atlas_->context);
+}
+
+// アトラスの統計
+const FontAtlasStats& Font::atlasStats() const {
+  return atlas_->stats;
+}
+
+// アトラスとグリフ情報をファイルへ書き出す
+// 戻り値 true なら成功
+bool Font::saveAtlas(const std::string& path) const {
+  const FONScontext* context = atlas_->context;
+  std::ofstream fstr(path, std::ios::binary);
+  if (!fstr) {
+    DOUT << "Can't write: " << path << std::endl;
+    return false;
+  }
+
+  fstr.write(atlas_file_id, sizeof(atlas_file_id));
+  writeValue(fstr, int(ATLAS_FILE_VERSION));
+  // TIPS:構造体をそのまま書き出すので、大きさが変わっていたら読み込まない
+  writeValue(fstr, int(sizeof(FONSglyph)));
+  writeValue(fstr, int(sizeof(FONSatlasNode)));
+  writeValue(fstr, context->params.width);
+  writeValue(fstr, context->params.height);
+
+  // グリフ情報(フォントごと)
+  writeValue(fstr, context->nfonts);
+  for (int i = 0; i < context->nfonts; ++i) {
+    const FONSfont* font = context->fonts[i];
+    writeValue(fstr, font->dataSize);
+    writeValue(fstr, fontChecksum(font));
+    writeValue(fstr, font->nglyphs);
+    fstr.write(reinterpret_cast<const char*>(font->glyphs), sizeof(FONSglyph) * font->nglyphs);
+  }
+
+  // アトラスの空き領域
+  const FONSatlas* atlas = context->atlas;
+  writeValue(fstr, atlas->nnodes);
+  fstr.write(reinterpret_cast<const char*>(atlas->nodes), sizeof(FONSatlasNode) * atlas->nnodes);
+
+  // ピクセルデータ
+  fstr.write(reinterpret_cast<const char*>(context->texData),
+             context->params.width * context->params.height);
+
+  return bool(fstr);
+}
+
+// saveAtlas()で書き出したファイルを読み込む
+// フォントファイルが書き出した時と異なる場合は読み込まない
+// 戻り値 true なら成功
+bool Font::loadAtlas(const std::string& path) {
+  FONScontext* context = atlas_->context;
+  std::ifstream fstr(path, std::ios::binary | std::ios::ate);
+  if (!fstr) {
+    DOUT << "Can't open: " << path << std::endl;
+    return false;
+  }
+
+  // TIPS:壊れたファイルで巨大な領域を確保しないよう、数はファイルの残りの大きさで確かめる
+  const std::streamoff file_size = fstr.tellg();
+  fstr.seekg(0);
+  auto fits = [&fstr, file_size](const int num, const size_t size) {
+    return fstr && (num >= 0) && (std::streamoff(num * size) <= file_size - std::streamoff(fstr.tellg()));
+  };
+
+  char id[sizeof(atlas_file_id)];
+  fstr.read(id, sizeof(id));
+  if (!fstr || std::strncmp(id, atlas_file_id, sizeof(id))
+      || (readValue<int>(fstr) != ATLAS_FILE_VERSION)
+      || (readValue<int>(fstr) != int(sizeof(FONSglyph)))
+      || (readValue<int>(fstr) != int(sizeof(FONSatlasNode)))) {
+    DOUT << "This file isn't font atlas: " << path << std::endl;
+    return false;
+  }
+
+  int width  = readValue<int>(fstr);
+  int height = readValue<int>(fstr);
+  if ((width <= 0) || (height <= 0)
+      || (width > atlas_->max_size) || (height > atlas_->max_size)) {
+    DOUT << "Broken font atlas: " << path << std::endl;
+    return false;
+  }
+
+  // 先にすべて読み込んで照合してから差し替える
+  int nfonts = readValue<int>(fstr);
+  if (nfonts != context->nfonts) return false;
+
+  std::vector<std::vector<FONSglyph>> glyphs(nfonts);
+  for (int i = 0; i < nfonts; ++i) {
+    const FONSfont* font = context->fonts[i];
+    int data_size = readValue<int>(fstr);
+    u_int checksum = readValue<u_int>(fstr);
+    if ((data_size != font->dataSize) || (checksum != fontChecksum(font))) {
+      DOUT << "Font data mismatch: " << path << std::endl;
+      return false;
+    }
+
+    int num = readValue<int>(fstr);
+    if (!fits(num, sizeof(FONSglyph))) {
+      DOUT << "Broken font atlas: " << path << std::endl;
+      return false;
+    }
+    glyphs[i].resize(num);
+    fstr.read(reinterpret_cast<char*>(glyphs[i].data()), sizeof(FONSglyph) * glyphs[i].size());
+  }
+
+  // TIPS:空き領域の節は横幅より多くならない
+  int node_num = readValue<int>(fstr);
+  if ((node_num <= 0) || (node_num > width) || !fits(node_num, sizeof(FONSatlasNode))) {
+    DOUT << "Broken font atlas: " << path << std::endl;
+    return false;
+  }
+  std::vector<FONSatlasNode> nodes(node_num);
+  fstr.read(reinterpret_cast<char*>(nodes.data()), sizeof(FONSatlasNode) * nodes.size());
+
+  // TIPS:アトラスの外を指していると、グリフを追加した時に範囲外へ書き込んでしまう
+  bool broken = std::any_of(std::begin(nodes), std::end(nodes),
+                            [width, height](const FONSatlasNode& node) {
+                              return (node.x < 0) || (node.y < 0) || (node.width < 0)
+                                || ((node.x + node.width) > width) || (node.y > height);
+                            });
+
+  std::vector<u_char> pixels;
+  if (!broken && fits(width, size_t(height))) {
+    pixels.resize(size_t(width) * height);
+    fstr.read(reinterpret_cast<char*>(pixels.data()), pixels.size());
+  }
+  if (!fstr || pixels.empty()) {
+    DOUT << "Broken font atlas: " << path << std::endl;
+    return false;
+  }
+
+  // アトラスを作り直してから中身を差し替える
+  // TIPS:テクスチャの再生成とグリフ情報のクリアはfontstashにまかせる
+  if (!fonsResetAtlas(context, width, height)) return false;
+
+  for (int i = 0; i < nfonts; ++i) {
+    FONSfont* font = context->fonts[i];
+    int num = int(glyphs[i].size());
+    if (num > font->cglyphs) {
+      font->glyphs  = (FONSglyph*)realloc(font->glyphs, sizeof(FONSglyph) * num);
+      font->cglyphs = num;
+    }
+    std::copy(std::begin(glyphs[i]), std::end(glyphs[i]), font->glyphs);
+    font->nglyphs = num;
+
+    // 検索用のハッシュを作り直す
+    for (int j = 0; j < num; ++j) {
+      u_int h = fons__hashint(font->glyphs[j].codepoint) & (FONS_HASH_LUT_SIZE - 1);
+      font->glyphs[j].next = font->lut[h];
+      font->lut[h] = j;
+    }
+  }
+
+  // グリフの並びが変わったので、使用状況は捨てる
+  atlas_->glyph_frames.clear();
+  atlas_->evicted_glyphs.clear();
+
+  FONSatlas* atlas = context->atlas;
+  if (int(nodes.size()) > atlas->cnodes) {
+    atlas->nodes  = (FONSatlasNode*)realloc(atlas->nodes, sizeof(FONSatlasNode) * nodes.size());
+    atlas->cnodes = int(nodes.size());
+  }
+  std::copy(std::begin(nodes), std::end(nodes), atlas->nodes);
+  atlas->nnodes = int(nodes.size());
+
+  std::copy(std::begin(pixels), std::end(pixels), context->texData);
+
+  // テクスチャ全体を転送
+  context->dirtyRect[0] = 0;
+  context->dirtyRect[1] = 0;
+  context->dirtyRect[2] = width;
+  context->dirtyRect[3] = height;
+  fons__flush(context);
+
+  DOUT << "Font::loadAtlas " << path
+       << " atlas:" << atlasUsage() * 100.0f << "%" << std::endl;
+
+  return true;
 }
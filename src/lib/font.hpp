@@ -3,30 +3,197 @@
 //
 // 文字表示
 //
-// FIXME:FONScontextがメモリリークしている
-//
 
 #include "defines.hpp"
 #include <fontstash.h>
 #include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstdint>
 #include <memory>
 #include "vector.hpp"
 #include "graph.hpp"
+#include "batch.hpp"
+
+
+// アトラスの統計
+struct FontAtlasStats {
+  // 追い出したグリフの数
+  u_int evicted;
+  // 追い出した後、もう一度ラスタライズしたグリフの数
+  u_int rerasterized;
+  // 追い出しを行った回数
+  u_int compactions;
+};
+
+
+// グリフアトラス
+// fontstashのコンテキストとテクスチャをまとめて管理する
+// 複数のフォントで共有でき、いっぱいになると最大サイズまで広がる
+// 最大サイズでもいっぱいになったら、しばらく使っていないグリフを追い出す
+struct FontAtlas {
+  FONScontext* context;
+  std::shared_ptr<GlTexture> tex;
+  int width, height;
+  int max_size;
+  // アトラスを作り直すたびに増える
+  // レイアウト済みの頂点(UV)が使えるか、この値で判断する
+  u_int generation;
+
+  // グリフを最後に使ったフレーム(フォント、グリフの順)
+  std::vector<std::vector<u_int>> glyph_frames;
+  // 追い出したグリフ
+  std::unordered_set<uint64_t> evicted_glyphs;
+  FontAtlasStats stats;
+
+  // 現在のフレーム
+  static u_int frame;
+
+
+  FontAtlas(const int width, const int height, const int max_size);
+  ~FontAtlas();
+
+  // グリフを使ったことを記録
+  void touch(const int font, const int glyph);
+
+  // 最近使ったグリフだけを残してアトラスを詰め直す
+  // 戻り値 true なら空きができた
+  bool compact();
+
+  // フレームを進める(AppEnv::end()から呼ばれる)
+  static void nextFrame();
+
+  FontAtlas(const FontAtlas&) = delete;
+  FontAtlas& operator=(const FontAtlas&) = delete;
+};
+
+
+// SDF(距離場)描画の設定
+// 幅は基準サイズ(Font::SDF_SIZE)でのピクセル数
+// NOTICE:縁取りと光彩の幅の合計は6ピクセルまで(それ以上は距離場の外になる)
+struct SdfStyle {
+  bool enable;
+
+  // 縁取り
+  float outline_width;
+  Color outline_color;
+
+  // 光彩(縁取りの外側に広がる)
+  float glow_width;
+  Color glow_color;
+
+  SdfStyle();
+
+  bool operator==(const SdfStyle& rhs) const;
+  bool operator!=(const SdfStyle& rhs) const;
+};
+
+
+// レイアウト済みの文字列
+// 一度レイアウトしておけば、位置を変えて何度でも描画できる
+// アトラスが作り直された時は、次の描画で自動的にレイアウトし直す
+class TextBlock {
+  std::shared_ptr<FontAtlas> atlas_;
+  int font_;
+  int font_size_;
+  SdfStyle sdf_;
+  std::string text_;
+
+  mutable u_int generation_;
+  // 1文字6頂点
+  mutable std::vector<BatchVertex> vtx_;
+  // 使っているグリフ(アトラスの追い出し用)
+  mutable std::vector<int> glyphs_;
+  mutable Vec2f size_;
+
+  void layout() const;
+  void build() const;
+
+
+public:
+  TextBlock();
+  TextBlock(const std::shared_ptr<FontAtlas>& atlas, const int font, const int size,
+            const SdfStyle& sdf, const std::string& text);
+
+  // 描画した時のサイズ
+  const Vec2f& size() const;
+
+  // 描画
+  // pos   表示位置
+  // color 表示色
+  void draw(const Vec2f& pos, const Color& color) const;
+
+  // 描画(回転、拡大縮小つき)
+  // pos       表示位置
+  // color     表示色
+  // angle_rad 回転角度(ラジアン)
+  // scaling   横、縦の拡大縮小率
+  // origin    文字列の原点位置
+  // TIPS:SDFで描画すると、拡大してもぼやけない
+  void draw(const Vec2f& pos, const Color& color,
+            const float angle_rad,
+            const Vec2f& scaling,
+            const Vec2f& origin) const;
+
+};
+
+
+// 複数のフォントでひとつのアトラスを共有する
+// 同じFontManagerから作ったフォントは、まとめて描画できる
+//
+//   FontManager manager;
+//   Font ui(manager, "ui.ttf");
+//   Font jp(manager, "jp.otf");
+//   ui.addFallback(jp);
+//
+class FontManager {
+  friend class Font;
+
+  std::shared_ptr<FontAtlas> atlas_;
+
+
+public:
+  // width, height 最初のアトラスのサイズ
+  // max_size      アトラスの最大サイズ
+  explicit FontManager(const int width = 256, const int height = 256,
+                       const int max_size = 4096);
+
+  // アトラスの現在のサイズ
+  Vec2i atlasSize() const;
+
+  // アトラスの使用率 [0.0, 1.0]
+  float atlasUsage() const;
+
+  // アトラスの統計
+  const FontAtlasStats& atlasStats() const;
+
+};
 
 
 class Font {
+  friend struct FontAtlas;
+
   enum {
     DEFAULT_SIZE = 20,
+    // レイアウトを覚えておく文字列の数
+    LAYOUT_CACHE_SIZE = 256,
   };
 
-  struct Context
-  {
-    std::shared_ptr<GlTexture> tex;
-    int width, height;
-  };
+  std::shared_ptr<FontAtlas> atlas_;
+  int font_;
+  int size_;
+  SdfStyle sdf_;
 
-  Context gl_;
-  FONScontext* context_;
+  // レイアウト済みの文字列(先頭ほど最近使った)
+  // TIPS:HUDやメニューは毎フレーム同じ文字列を表示するので
+  //      UTF-8の解析や頂点の生成を省略できる
+  std::list<std::pair<std::string, TextBlock>> layouts_;
+  std::unordered_map<std::string, std::list<std::pair<std::string, TextBlock>>::iterator> layout_cache_;
+
+  const TextBlock& cachedLayout(const std::string& text);
+  void clearLayoutCache();
 
 
   // 以下、fontstashからのコールバック関数
@@ -37,10 +204,29 @@ class Font {
 
 
 public:
+  enum {
+    // SDFでグリフを焼き込む時のサイズ
+    // どのサイズで描画する時も、このサイズのグリフを使う
+    SDF_SIZE = 32,
+  };
+
   // コンストラクタ
   // path フォントファイルのパス(ttf,otf)
+  // TIPS:アトラスはこのフォント専用になる
   Font(const std::string& path);
 
+  // コンストラクタ
+  // manager アトラスを共有するFontManager
+  // path    フォントファイルのパス(ttf,otf)
+  Font(const FontManager& manager, const std::string& path);
+
+  // グリフが無い文字を、別のフォントで表示する
+  // 追加した順に探す
+  // TIPS:同じFontManagerから作ったフォントでないと追加できない
+  // NOTICE:描画する前に追加しておくこと
+  // 戻り値 true なら成功
+  bool addFallback(const Font& font);
+
   // フォントサイズ指定
   void size(const int size);
 
@@ -53,4 +239,63 @@ public:
   // color 表示色
   void draw(const std::string& text, const Vec2f& pos, const Color& color);
 
+  // 描画(回転、拡大縮小つき)
+  // text      表示文字列
+  // pos       表示位置
+  // color     表示色
+  // angle_rad 回転角度(ラジアン)
+  // scaling   横、縦の拡大縮小率
+  // origin    文字列の原点位置
+  void draw(const std::string& text, const Vec2f& pos, const Color& color,
+            const float angle_rad,
+            const Vec2f& scaling,
+            const Vec2f& origin);
+
+  // SDF(距離場)で描画するか
+  // 有効にすると、グリフは基準サイズで一度だけ焼き込まれ
+  // どのサイズや回転でも同じグリフから描画される
+  // TIPS:サイズを頻繁に変える文字はこちらの方がアトラスを消費しない
+  void sdf(const bool enable);
+
+  // SDF描画時の縁取り
+  // width 太さ(基準サイズでのピクセル数) 0 で縁取りなし
+  void outline(const float width, const Color& color);
+
+  // SDF描画時の光彩
+  // width 広がり(基準サイズでのピクセル数) 0 で光彩なし
+  void glow(const float width, const Color& color);
+
+  // 現在のフォントサイズでレイアウトした文字列を返す
+  // 内容の変わらない文字列は、これを保持して描画するのが一番速い
+  TextBlock layout(const std::string& text) const;
+
+
+  // 文字をあらかじめアトラスに焼き込む
+  // 初めて表示する時の描画負荷を減らせる
+  // text   焼き込む文字(UTF-8)
+  // sizes  フォントサイズ(SDF描画の時は無視される)
+  // 戻り値 かかった時間(秒)
+  double prebake(const std::string& text, const std::vector<int>& sizes);
+
+  // 表示予定の文字列のグリフを複数のスレッドでラスタライズする
+  // 足りないグリフだけをラスタライズし、テクスチャへの転送は一度にまとめる
+  // texts  表示予定の文字列(UTF-8)
+  // 戻り値 ラスタライズしたグリフの数
+  int prepare(const std::vector<std::string>& texts);
+
+  // アトラスの使用率 [0.0, 1.0]
+  float atlasUsage() const;
+
+  // アトラスの統計
+  const FontAtlasStats& atlasStats() const;
+
+  // アトラスとグリフ情報をファイルへ書き出す
+  // 戻り値 true なら成功
+  bool saveAtlas(const std::string& path) const;
+
+  // saveAtlas()で書き出したファイルを読み込む
+  // フォントファイルが書き出した時と異なる場合は読み込まない
+  // 戻り値 true なら成功
+  bool loadAtlas(const std::string& path);
+
 };
@@ -7,8 +7,13 @@
 
 #include "defines.hpp"
 #include "appEnv.hpp"
+#include "batch.hpp"
 #include "fileUtil.hpp"
 #include "font.hpp"
 #include "random.hpp"
+#include "soundPool.hpp"
+#include "mixer.hpp"
+#include "audioClock.hpp"
+#include "audioAnalyzer.hpp"
 #include "utils.hpp"
 #include "streaming.hpp"
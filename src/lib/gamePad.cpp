@@ -1,28 +1,82 @@
 ﻿//
 // Game Pad
-// FIXME:アプリ起動後の抜き差しには対応していません
 //
 
 #include "gamePad.hpp"
 #include <iostream>
 #include <cassert>
+#include <algorithm>
+#include <cmath>
+
+
+namespace {
+
+// 抜き差しの通知
+struct Hotplug {
+  int id;
+  int event;
+};
+
+// TIPS:コールバックは glfwPollEvents() の中で呼ばれるので、ロックしなくてよい
+std::vector<Hotplug> hotplugs;
+
+// GamePadが抜かれた時に呼ぶ関数
+std::function<void (const int id)> disconnect_callback;
+
+void joystickCallback(int id, int event) {
+  hotplugs.push_back({ id, event });
+  if ((event == GLFW_DISCONNECTED) && disconnect_callback) disconnect_callback(id);
+}
+
+
+// 軸の値に遊びを適用する
+// TIPS:分岐を使わずに書いて、コンパイラがSIMD命令にできるようにしている
+void applyDeadzone(float* axes, const int num, const float deadzone) {
+  const float scale = 1.0f / (1.0f - deadzone);
+  for (int i = 0; i < num; ++i) {
+    float value = std::max(std::fabs(axes[i]) - deadzone, 0.0f) * scale;
+    axes[i] = std::copysign(std::min(value, 1.0f), axes[i]);
+  }
+}
+
+// 遊びを適用する軸の数
+// TIPS:標準の配置ではトリガーが最後に並んでいて、離した時が-1.0なので遊びを適用しない
+int deadzoneAxes(const bool standard, const int axis_num) {
+  return standard ? std::min(axis_num, int(GLFW_GAMEPAD_AXIS_LEFT_TRIGGER)) : axis_num;
+}
+
+}
 
 
 GamePad::GamePad(const int id) :
   id_(id),
-  name_(glfwGetJoystickName(id)),
+  gamepad_(glfwJoystickIsGamepad(id) == GLFW_TRUE),
+  connected_(true),
+  deadzone_(0.0f),
   axis_button_(false),
   press_axis_button_(AXIS_BUTTON_NUM),
   push_axis_button_(AXIS_BUTTON_NUM),
   pull_axis_button_(AXIS_BUTTON_NUM)
 {
-  glfwGetJoystickButtons(id_, &button_num_);
-  glfwGetJoystickAxes(id_, &axis_num_);
+  if (gamepad_) {
+    // 標準の配置で読み取る
+    const char* name = glfwGetGamepadName(id_);
+    if (name) name_ = name;
+    button_num_ = GLFW_GAMEPAD_BUTTON_LAST + 1;
+    axis_num_   = GLFW_GAMEPAD_AXIS_LAST + 1;
+  }
+  else {
+    const char* name = glfwGetJoystickName(id_);
+    if (name) name_ = name;
+    glfwGetJoystickButtons(id_, &button_num_);
+    glfwGetJoystickAxes(id_, &axis_num_);
+  }
 
   DOUT << "GamePad: id:" << id_
        << " name:"       << name_
        << " button:"     << button_num_
        << " axis:"       << axis_num_
+       << " mapping:"    << gamepad_
        << std::endl;
 
   // ボタンの数に応じた変数の初期化
@@ -37,12 +91,47 @@ GamePad::GamePad(const int id) :
 
   axis_value_.resize(axis_num_);
   std::fill(std::begin(axis_value_), std::end(axis_value_), 0.0f);
+
+  raw_axis_.resize(axis_num_);
 }
 
 
+// 実際には繋がっていないGamePad
+GamePad::GamePad(const std::string& name, const int button_num, const int axis_num) :
+  id_(-1),
+  name_(name),
+  gamepad_(false),
+  connected_(true),
+  button_num_(button_num),
+  axis_num_(axis_num),
+  press_button_(button_num, 0),
+  push_button_(button_num, 0),
+  pull_button_(button_num, 0),
+  axis_value_(axis_num, 0.0f),
+  deadzone_(0.0f),
+  raw_axis_(axis_num, 0.0f),
+  axis_button_(false),
+  press_axis_button_(AXIS_BUTTON_NUM),
+  push_axis_button_(AXIS_BUTTON_NUM),
+  pull_axis_button_(AXIS_BUTTON_NUM)
+{
+  DOUT << "GamePad: virtual"
+       << " name:"   << name_
+       << " button:" << button_num_
+       << " axis:"   << axis_num_
+       << std::endl;
+}
+
+
+// GLFWのジョイスティック番号
+int GamePad::id() const { return id_; }
+
 // GamePad名
 const std::string& GamePad::name() const { return name_; }
 
+// 標準の配置で読み取っているならtrue
+bool GamePad::isStandardMapping() const { return gamepad_; }
+
 // ボタン数を返す
 int GamePad::buttons() const { return button_num_; }
 
@@ -86,6 +175,13 @@ float GamePad::axis(const int index) const {
   return axis_value_[index];
 }
 
+// 軸の遊び
+void GamePad::deadzone(const float value) {
+  deadzone_ = std::min(std::max(value, 0.0f), 0.99f);
+}
+
+float GamePad::deadzone() const { return deadzone_; }
+
 
 // 2軸を簡易ボタンとして登録
 // x_index        左右ボタンとみなす軸番号
@@ -152,8 +248,9 @@ bool GamePad::isPullAxisButton(const int index) const {
 
 
 // GamePadが有効ならtrueを返す
+// TIPS:抜き差しの通知で更新するので、GLFWには問い合わせない
 bool GamePad::isPresent() const {
-  return (glfwJoystickPresent(id_) == GL_TRUE) ? true : false;
+  return connected_;
 }
   // 入力をクリア
 void GamePad::flush() {
@@ -167,13 +264,47 @@ void GamePad::flush() {
   std::fill(std::begin(pull_axis_button_), std::end(pull_axis_button_), 0);
 }
 
+// 抜かれた
+void GamePad::disconnect() {
+  flush();
+  connected_ = false;
+}
+
 
 // 内部状態の更新
 void GamePad::update() {
+  if (gamepad_) {
+    // 標準の配置で、ボタンと軸をまとめて取得
+    GLFWgamepadstate state;
+    if (!glfwGetGamepadState(id_, &state)) return;
+
+    applyDeadzone(state.axes, deadzoneAxes(gamepad_, axis_num_), deadzone_);
+    update(state.buttons, button_num_, state.axes, axis_num_);
+    return;
+  }
+
   // ボタンのpress状況を取得
   int button_num;
   const auto* buttons = glfwGetJoystickButtons(id_, &button_num);
 
+  // 軸の状況を取得
+  int axis_num;
+  const auto* axes = glfwGetJoystickAxes(id_, &axis_num);
+  axis_num = std::min(axis_num, axis_num_);
+  if (axis_num > 0) {
+    std::copy(axes, axes + axis_num, std::begin(raw_axis_));
+    applyDeadzone(raw_axis_.data(), axis_num, deadzone_);
+  }
+
+  update(buttons, button_num, raw_axis_.data(), axis_num);
+}
+
+// 与えたボタンと軸の状況で内部状態を更新
+void GamePad::update(const u_char* buttons, int button_num, const float* axes, int axis_num) {
+  // TIPS:生成した時より多い数は扱わない
+  button_num = std::min(button_num, button_num_);
+  axis_num   = std::min(axis_num, axis_num_);
+
   if (button_num > 0) {
     for (int i = 0; i < button_num; ++i) {
       // ボタンの Press / Push / Pull 情報を生成
@@ -185,9 +316,6 @@ void GamePad::update() {
     }
   }
 
-  // 軸の状況を取得
-  int axis_num;
-  const auto* axes = glfwGetJoystickAxes(id_, &axis_num);
   if (axis_num > 0) {
     for (int i = 0; i < axis_num; ++i) {
       axis_value_[i] = axes[i];
@@ -219,6 +347,32 @@ void GamePad::update() {
 }
 
 
+// 別のスレッドで読み取った状況で内部状態を更新
+// pushed, pulled 前のフレームから押した・離したボタン
+void GamePad::update(const u_char* buttons, const u_char* pushed, const u_char* pulled, const int button_num,
+                     const float* axes, int axis_num) {
+  axis_num = std::min(axis_num, axis_num_);
+  if (axis_num > 0) {
+    std::copy(axes, axes + axis_num, std::begin(raw_axis_));
+    applyDeadzone(raw_axis_.data(), deadzoneAxes(gamepad_, axis_num), deadzone_);
+  }
+
+  update(buttons, button_num, raw_axis_.data(), axis_num);
+
+  // TIPS:フレームの間に押して離したボタンも取りこぼさない
+  mergeButtonEdges(pushed, pulled, button_num);
+}
+
+// 押した瞬間・離した瞬間を加える
+void GamePad::mergeButtonEdges(const u_char* pushed, const u_char* pulled, const int button_num) {
+  int num = std::min(button_num, button_num_);
+  for (int i = 0; i < num; ++i) {
+    if (pushed[i]) push_button_[i] = 1;
+    if (pulled[i]) pull_button_[i] = 1;
+  }
+}
+
+
 // PCに繋がれているGamePad情報の収集
 std::vector<GamePad> initGamePad() {
   std::vector<GamePad> gamepads;
@@ -231,11 +385,41 @@ std::vector<GamePad> initGamePad() {
     }
   }
 
+  // 以降の抜き差しはコールバックで受け取る
+  hotplugs.clear();
+  glfwSetJoystickCallback(joystickCallback);
+
   return gamepads;
 }
 
 // コンテナのGamePadの状態をまとめて更新
-void updateGamePad(std::vector<GamePad>& gamepads) {
+void updateGamePad(std::vector<GamePad>& gamepads, const bool poll) {
+  // 抜き差しを反映
+  for (const auto& hotplug : hotplugs) {
+    auto it = std::find_if(std::begin(gamepads), std::end(gamepads),
+                           [&hotplug](const GamePad& pad) { return pad.id() == hotplug.id; });
+
+    if (hotplug.event == GLFW_CONNECTED) {
+      DOUT << "GamePad connected: " << hotplug.id << std::endl;
+      if (it != std::end(gamepads)) {
+        // TIPS:繋ぎ直されたものは同じ場所を使う(遊びの設定は引き継ぐ)
+        float deadzone = it->deadzone();
+        *it = GamePad(hotplug.id);
+        it->deadzone(deadzone);
+      }
+      else {
+        gamepads.emplace_back(hotplug.id);
+      }
+    }
+    else if (it != std::end(gamepads)) {
+      DOUT << "GamePad disconnected: " << hotplug.id << std::endl;
+      it->disconnect();
+    }
+  }
+  hotplugs.clear();
+
+  if (!poll) return;
+
   for (auto& pad : gamepads) {
     if (pad.isPresent()) {
       pad.update();
@@ -252,3 +436,7 @@ void flushGamePad(std::vector<GamePad>& gamepads) {
   }
 }
 
+// GamePadが抜かれた時に呼ぶ関数を登録する
+void disconnectGamePadCallback(std::function<void (const int id)> func) {
+  disconnect_callback = func;
+}
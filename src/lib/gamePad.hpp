@@ -2,18 +2,25 @@
 
 //
 // Game Pad
-// FIXME:アプリ起動後の抜き差しには対応していません
+// TIPS:抜き差しはGLFWのコールバックで受け取り、updateGamePad() でまとめて反映する
+//      標準の配置(GLFW_GAMEPAD_BUTTON_*, GLFW_GAMEPAD_AXIS_*)がわかるものはそれを使う
 //
 
 #include "defines.hpp"
 #include <vector>
 #include <string>
+#include <functional>
 
 
 class GamePad {
   int id_;
   std::string name_;
 
+  // 標準の配置で読み取れるならtrue
+  bool gamepad_;
+  // 繋がっているならtrue
+  bool connected_;
+
 
   // ボタン数と軸数
   int button_num_;
@@ -27,6 +34,11 @@ class GamePad {
   // 軸の状況
   std::vector<float> axis_value_;
 
+  // 軸の遊び[0.0, 1.0)
+  float deadzone_;
+  // GLFWから受け取った軸の値に遊びを適用する作業領域
+  std::vector<float> raw_axis_;
+
   // 2軸を簡易ボタンとして扱うための変数
   bool  axis_button_;
   float axis_threshold_;
@@ -53,9 +65,20 @@ public:
   
   explicit GamePad(const int id);
 
+  // 実際には繋がっていないGamePad
+  // TIPS:記録した入力を再生する時に使う
+  GamePad(const std::string& name, const int button_num, const int axis_num);
+
+  // GLFWのジョイスティック番号(実際には繋がっていないGamePadは-1)
+  int id() const;
+
   // GamePad名
   const std::string& name() const;
 
+  // 標準の配置で読み取っているならtrue
+  // TIPS:ボタンはGLFW_GAMEPAD_BUTTON_*、軸はGLFW_GAMEPAD_AXIS_*の番号になる
+  bool isStandardMapping() const;
+
   // GamePadのボタン数と軸数
   int buttons() const;
   int axes() const;
@@ -73,6 +96,12 @@ public:
   // 軸の状況
   float axis(const int index) const;
 
+  // 軸の遊び
+  // TIPS:これより小さい倒れ具合は0.0にして、残りを[0.0, 1.0]に広げ直す
+  //      標準の配置のトリガー(離した時が-1.0)には適用しない
+  void deadzone(const float value);
+  float deadzone() const;
+
   // 2軸を簡易ボタンとして登録
   // x_index        左右ボタンとみなす軸
   // y_index        上下ボタンとみなす軸
@@ -101,17 +130,44 @@ public:
 
   // 入力をクリア
   void flush();
+
+  // 抜かれた
+  void disconnect();
   
   // GamePad 内部状態の更新
   void update();
+
+  // 与えたボタンと軸の状況で内部状態を更新
+  // TIPS:記録した入力を再生する時に使う
+  void update(const u_char* buttons, const int button_num, const float* axes, const int axis_num);
+
+  // 別のスレッドで読み取った状況で内部状態を更新
+  // pushed, pulled 前のフレームから押した・離したボタン
+  // TIPS:フレームの間に押して離したボタンは、押した瞬間と離した瞬間の両方になる
+  //      軸には遊びを適用する
+  void update(const u_char* buttons, const u_char* pushed, const u_char* pulled, const int button_num,
+              const float* axes, const int axis_num);
+
+  // 押した瞬間・離した瞬間を加える
+  // TIPS:update() の後に呼ぶ。記録した入力を再生する時にも使う
+  void mergeButtonEdges(const u_char* pushed, const u_char* pulled, const int button_num);
 };
 
 
 // PCに繋がれたGamePadの情報を収集
+// TIPS:抜き差しを受け取るコールバックも登録する
 std::vector<GamePad> initGamePad();
 
 // GamePadの内部状態をまとめて更新
-void updateGamePad(std::vector<GamePad>& gamepads);
+// TIPS:新しく繋がれたGamePadは末尾に追加される。抜かれたものは isPresent() がfalseになる
+//      繋ぎ直されたものは同じ番号のまま使える
+// poll falseなら抜き差しだけを反映する(別のスレッドで読み取っている時)
+// NOTICE:追加で再配置されることがあるので、GamePadの参照を持ち続けないこと
+void updateGamePad(std::vector<GamePad>& gamepads, const bool poll = true);
 
 // コンテナのGamePadの状態をまとめてクリア
 void flushGamePad(std::vector<GamePad>& gamepads);
+
+// GamePadが抜かれた時に呼ぶ関数を登録する(空の関数で解除)
+// TIPS:glfwPollEvents() の中で、抜かれたGLFWのジョイスティック番号を渡して呼ばれる
+void disconnectGamePadCallback(std::function<void (const int id)> func);
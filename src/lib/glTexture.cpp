@@ -4,6 +4,7 @@
 
 #include "glTexture.hpp"
 #include <iostream>
+#include "batch.hpp"
 
 
 GlTexture::GlTexture() {
@@ -13,6 +14,8 @@ GlTexture::GlTexture() {
 
 GlTexture::~GlTexture() {
   DOUT << "~GlTexture()" << std::endl;
+  // TIPS:このテクスチャを使う描画が溜まっているかもしれない
+  flushBatch();
   glDeleteTextures(1, &id_);
 }
 
@@ -26,3 +29,6 @@ void GlTexture::bind() const {
 void GlTexture::unbind() const {
   glBindTexture(GL_TEXTURE_2D, 0);
 }
+
+// OpenGLのテクスチャID
+GLuint GlTexture::id() const { return id_; }
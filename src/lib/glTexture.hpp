@@ -22,5 +22,8 @@ public:
 
   // 拘束を解除
 	void unbind() const;
+
+  // OpenGLのテクスチャID
+  GLuint id() const;
   
 };
@@ -6,6 +6,7 @@
 #include <vector>
 #include <algorithm>
 #include "matrix.hpp"
+#include "batch.hpp"
 
 
 Color::Color() :
@@ -214,6 +215,8 @@ Color colorHSB(const float hue, const float saturation, const float brightness)
 void drawPoint(const float x, const float y,
                const float radius,
                const Color& color) {
+  // まとめ描画の順番を守る
+  flushBatch();
 
   GLfloat vtx[] = {
     x, y
@@ -255,6 +258,8 @@ void drawPoint(const float x, const float y,
                                   Vec3f(scaling.x, scaling.y, 1.0f));
 
   // 行列をOpenGLに設定
+  // TIPS:溜まっている描画に影響しないよう、先に描画しておく
+  flushBatch();
   glPushMatrix();
   glMultMatrixf(glm::value_ptr(matrix));
 
@@ -277,6 +282,8 @@ void drawLine(const float start_x, const float start_y,
               const float end_x, const float end_y,
               const float line_width,
               const Color& color) {
+  // まとめ描画の順番を守る
+  flushBatch();
 
   GLfloat vtx[] = {
     start_x, start_y,
@@ -321,6 +328,8 @@ void drawLine(const float start_x, const float start_y,
                                   Vec3f(scaling.x, scaling.y, 1.0f));
 
   // 行列をOpenGLに設定
+  // TIPS:溜まっている描画に影響しないよう、先に描画しておく
+  flushBatch();
   glPushMatrix();
   glMultMatrixf(glm::value_ptr(matrix));
 
@@ -344,6 +353,8 @@ void drawTriangle(const float x1, const float y1,
                   const float x3, const float y3,
                   const float line_width,
                   const Color& color) {
+  // まとめ描画の順番を守る
+  flushBatch();
 
   GLfloat vtx[] = {
     x1, y1,
@@ -393,6 +404,8 @@ void drawTriangle(const float x1, const float y1,
                                   Vec3f(scaling.x, scaling.y, 1.0f));
 
   // 行列をOpenGLに設定
+  // TIPS:溜まっている描画に影響しないよう、先に描画しておく
+  flushBatch();
   glPushMatrix();
   glMultMatrixf(glm::value_ptr(matrix));
 
@@ -415,23 +428,15 @@ void drawFillTriangle(const float x1, const float y1,
                       const float x3, const float y3,
                       const Color& color) {
 
-  GLfloat vtx[] = {
-    x1, y1,
-    x2, y2,
-    x3, y3,
+  GLuint rgba = color.rgba();
+  BatchVertex vtx[] = {
+    { x1, y1, 0.0f, 0.0f, rgba },
+    { x2, y2, 0.0f, 0.0f, rgba },
+    { x3, y3, 0.0f, 0.0f, rgba },
   };
 
-  glVertexPointer(2, GL_FLOAT, 0, vtx);
-
-  // 色を設定
-  color.setToGl();
-
-  glEnableClientState(GL_VERTEX_ARRAY);
-
-  // OpenGLに三角ポリゴンの描画を指示
-  glDrawArrays(GL_TRIANGLES, 0, 3);
-
-  glDisableClientState(GL_VERTEX_ARRAY);
+  // まとめて描画する
+  batchTriangles(0, vtx, 3);
 }
 
 // 塗りつぶし三角形を描画(回転、拡大縮小つき)
@@ -457,9 +462,9 @@ void drawFillTriangle(const float x1, const float y1,
                                   Vec3f(min_x, min_y, 0.0f),
                                   Vec3f(scaling.x, scaling.y, 1.0f));
 
-  // 行列をOpenGLに設定
-  glPushMatrix();
-  glMultMatrixf(glm::value_ptr(matrix));
+  // 行列を頂点に適用
+  // TIPS:OpenGLの行列を変更すると、まとめ描画できなくなる
+  pushBatchMatrix(matrix);
 
   // 描画
   drawFillTriangle((x1 - min_x) - origin.x, (y1 - min_y) - origin.y,
@@ -468,7 +473,7 @@ void drawFillTriangle(const float x1, const float y1,
                    color);
 
   // 行列を元に戻す
-  glPopMatrix();
+  popBatchMatrix();
 }
 
 
@@ -483,6 +488,9 @@ void drawCircle(const float center_x, const float center_y,
                 const int division,
                 const float line_width,
                 const Color& color) {
+  // まとめ描画の順番を守る
+  flushBatch();
+
   // 線分の太さを指示
   glLineWidth(line_width);
 
@@ -532,6 +540,8 @@ void drawCircle(const float center_x, const float center_y,
                                   Vec3f(scaling.x, scaling.y, 1.0f));
 
   // 行列をOpenGLに設定
+  // TIPS:溜まっている描画に影響しないよう、先に描画しておく
+  flushBatch();
   glPushMatrix();
   glMultMatrixf(glm::value_ptr(matrix));
 
@@ -556,6 +566,9 @@ void drawFillCircle(const float center_x, const float center_y,
                     const float radius_x, const float radius_y,
                     const int division,
                     const Color& color) {
+  // まとめ描画の順番を守る
+  flushBatch();
+
   // 色を設定
   color.setToGl();
 
@@ -603,6 +616,8 @@ void drawFillCircle(const float center_x, const float center_y,
                                   Vec3f(scaling.x, scaling.y, 1.0f));
 
   // 行列をOpenGLに設定
+  // TIPS:溜まっている描画に影響しないよう、先に描画しておく
+  flushBatch();
   glPushMatrix();
   glMultMatrixf(glm::value_ptr(matrix));
 
@@ -630,6 +645,9 @@ void drawArc(const float center_x, const float center_y,
              const int division,
              const float line_width,
              const Color& color) {
+  // まとめ描画の順番を守る
+  flushBatch();
+
   // 線分の太さを指示
   glLineWidth(line_width);
 
@@ -681,6 +699,8 @@ void drawArc(const float center_x, const float center_y,
                                   Vec3f(scaling.x, scaling.y, 1.0f));
 
   // 行列をOpenGLに設定
+  // TIPS:溜まっている描画に影響しないよう、先に描画しておく
+  flushBatch();
   glPushMatrix();
   glMultMatrixf(glm::value_ptr(matrix));
 
@@ -707,6 +727,9 @@ void drawFillArc(const float center_x, const float center_y,
                  const float start_rad, const float end_rad,
                  const int division,
                  const Color& color) {
+  // まとめ描画の順番を守る
+  flushBatch();
+
   // 色を設定
   color.setToGl();
 
@@ -755,6 +778,8 @@ void drawFillArc(const float center_x, const float center_y,
                                   Vec3f(scaling.x, scaling.y, 1.0f));
 
   // 行列をOpenGLに設定
+  // TIPS:溜まっている描画に影響しないよう、先に描画しておく
+  flushBatch();
   glPushMatrix();
   glMultMatrixf(glm::value_ptr(matrix));
 
@@ -779,6 +804,8 @@ void drawBox(const float start_x, const float start_y,
              const float width, const float height,
              const float line_width,
              const Color& color) {
+  // まとめ描画の順番を守る
+  flushBatch();
 
   // 線分の太さを指示
   glLineWidth(line_width);
@@ -828,6 +855,8 @@ void drawBox(const float start_x, const float start_y,
                                   Vec3f(scaling.x, scaling.y, 1.0f));
 
   // 行列をOpenGLに設定
+  // TIPS:溜まっている描画に影響しないよう、先に描画しておく
+  flushBatch();
   glPushMatrix();
   glMultMatrixf(glm::value_ptr(matrix));
 
@@ -852,25 +881,19 @@ void drawFillBox(const float start_x, const float start_y,
 
   const float end_x = start_x + width;
   const float end_y = start_y + height;
-  
-  GLfloat vtx[] = { 
-    start_x, start_y,
-    end_x,   start_y,
-    start_x, end_y,
-    end_x,   end_y
-  };
-
-  glVertexPointer(2, GL_FLOAT, 0, vtx);
-
-  // 色を設定
-  color.setToGl();
 
-  glEnableClientState(GL_VERTEX_ARRAY);
-
-  // OpenGLに線分の描画を指示
-  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  GLuint rgba = color.rgba();
+  BatchVertex vtx[] = {
+    { start_x, start_y, 0.0f, 0.0f, rgba },
+    { end_x,   start_y, 0.0f, 0.0f, rgba },
+    { start_x, end_y,   0.0f, 0.0f, rgba },
+    { end_x,   start_y, 0.0f, 0.0f, rgba },
+    { end_x,   end_y,   0.0f, 0.0f, rgba },
+    { start_x, end_y,   0.0f, 0.0f, rgba },
+  };
 
-  glDisableClientState(GL_VERTEX_ARRAY);
+  // まとめて描画する
+  batchTriangles(0, vtx, 6);
 }
 
 // 塗り潰し矩形(回転、拡大縮小つき)
@@ -892,9 +915,9 @@ void drawFillBox(const float start_x, const float start_y,
                                   Vec3f(start_x, start_y, 0.0f),
                                   Vec3f(scaling.x, scaling.y, 1.0f));
 
-  // 行列をOpenGLに設定
-  glPushMatrix();
-  glMultMatrixf(glm::value_ptr(matrix));
+  // 行列を頂点に適用
+  // TIPS:OpenGLの行列を変更すると、まとめ描画できなくなる
+  pushBatchMatrix(matrix);
 
   // 描画
   drawFillBox(-origin.x, -origin.y,
@@ -902,7 +925,7 @@ void drawFillBox(const float start_x, const float start_y,
               color);
 
   // 行列を元に戻す
-  glPopMatrix();
+  popBatchMatrix();
 }
 
 
@@ -916,6 +939,8 @@ void drawQuad(const float x1, const float y1,
               const float x4, const float y4,
               const float line_width,
               const Color& color) {
+  // まとめ描画の順番を守る
+  flushBatch();
 
   // 線分の太さを指示
   glLineWidth(line_width);
@@ -967,6 +992,8 @@ void drawQuad(const float x1, const float y1,
                                   Vec3f(scaling.x, scaling.y, 1.0f));
 
   // 行列をOpenGLに設定
+  // TIPS:溜まっている描画に影響しないよう、先に描画しておく
+  flushBatch();
   glPushMatrix();
   glMultMatrixf(glm::value_ptr(matrix));
 
@@ -992,26 +1019,18 @@ void drawFillQuad(const float x1, const float y1,
                   const float x4, const float y4,
                   const Color& color) {
 
-  GLfloat vtx[] = {
-    x1, y1,
-    x2, y2,
-    x4, y4,
-    x2, y2,
-    x3, y3,
-    x4, y4,
+  GLuint rgba = color.rgba();
+  BatchVertex vtx[] = {
+    { x1, y1, 0.0f, 0.0f, rgba },
+    { x2, y2, 0.0f, 0.0f, rgba },
+    { x4, y4, 0.0f, 0.0f, rgba },
+    { x2, y2, 0.0f, 0.0f, rgba },
+    { x3, y3, 0.0f, 0.0f, rgba },
+    { x4, y4, 0.0f, 0.0f, rgba },
   };
 
-  glVertexPointer(2, GL_FLOAT, 0, vtx);
-
-  // 色を設定
-  color.setToGl();
-
-  glEnableClientState(GL_VERTEX_ARRAY);
-
-  // OpenGLに線分の描画を指示
-  glDrawArrays(GL_TRIANGLES, 0, 6);
-
-  glDisableClientState(GL_VERTEX_ARRAY);
+  // まとめて描画する
+  batchTriangles(0, vtx, 6);
 }
 
 // 塗り潰し四角(回転、拡大縮小つき)
@@ -1038,9 +1057,9 @@ void drawFillQuad(const float x1, const float y1,
                                   Vec3f(min_x, min_y, 0.0f),
                                   Vec3f(scaling.x, scaling.y, 1.0f));
 
-  // 行列をOpenGLに設定
-  glPushMatrix();
-  glMultMatrixf(glm::value_ptr(matrix));
+  // 行列を頂点に適用
+  // TIPS:OpenGLの行列を変更すると、まとめ描画できなくなる
+  pushBatchMatrix(matrix);
 
   // 描画
   drawFillQuad((x1 - min_x) - origin.x, (y1 - min_y) - origin.y,
@@ -1050,7 +1069,7 @@ void drawFillQuad(const float x1, const float y1,
                color);
 
   // 行列を元に戻す
-  glPopMatrix();
+  popBatchMatrix();
 }                  
 
 
@@ -1070,41 +1089,24 @@ void drawTextureBox(const float start_x, const float start_y,
 
   const float end_x = start_x + width;
   const float end_y = start_y + height;
-  GLfloat vtx[] = {
-    start_x, start_y,
-    end_x,   start_y,
-    start_x, end_y,
-    end_x,   end_y
-  };
 
-  glVertexPointer(2, GL_FLOAT, 0, vtx);
-  
-  GLfloat uv[] = {
-    start_tx / texture.width(),                   (start_ty + texture_height) / texture.height(),
-    (start_tx + texture_width) / texture.width(), (start_ty + texture_height) / texture.height(),
-    start_tx / texture.width(),                   start_ty / texture.height(),
-    (start_tx + texture_width) / texture.width(), start_ty / texture.height(),
+  const float start_u = start_tx / texture.width();
+  const float end_u   = (start_tx + texture_width) / texture.width();
+  const float start_v = (start_ty + texture_height) / texture.height();
+  const float end_v   = start_ty / texture.height();
+
+  GLuint rgba = color.rgba();
+  BatchVertex vtx[] = {
+    { start_x, start_y, start_u, start_v, rgba },
+    { end_x,   start_y, end_u,   start_v, rgba },
+    { start_x, end_y,   start_u, end_v,   rgba },
+    { end_x,   start_y, end_u,   start_v, rgba },
+    { end_x,   end_y,   end_u,   end_v,   rgba },
+    { start_x, end_y,   start_u, end_v,   rgba },
   };
-  
-  glTexCoordPointer(2, GL_FLOAT, 0, uv);
-  
-  // 色を設定
-  color.setToGl();
 
-  glEnable(GL_TEXTURE_2D);
-  texture.bind();
-  
-  glEnableClientState(GL_VERTEX_ARRAY);
-  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-
-  // OpenGLに線分の描画を指示
-  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-
-  glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-  glDisableClientState(GL_VERTEX_ARRAY);
-  
-  glDisable(GL_TEXTURE_2D);
-  texture.unbind();
+  // 同じ画像が続く間はまとめて描画される
+  batchTriangles(texture.id(), vtx, 6);
 }
 
 // 画像つき矩形の描画(回転、拡大縮小つき)
@@ -1132,9 +1134,9 @@ void drawTextureBox(const float start_x, const float start_y,
                                   Vec3f(start_x, start_y, 0.0f),
                                   Vec3f(scaling.x, scaling.y, 1.0f));
 
-  // 行列をOpenGLに設定
-  glPushMatrix();
-  glMultMatrixf(glm::value_ptr(matrix));
+  // 行列を頂点に適用
+  // TIPS:OpenGLの行列を変更すると、まとめ描画できなくなる
+  pushBatchMatrix(matrix);
 
   // 描画
   drawTextureBox(-origin.x, -origin.y,
@@ -1145,5 +1147,5 @@ void drawTextureBox(const float start_x, const float start_y,
                  color);
 
   // 行列を元に戻す
-  glPopMatrix();
+  popBatchMatrix();
 }
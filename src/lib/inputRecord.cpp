@@ -0,0 +1,339 @@
+﻿//
+// 入力の記録と再生
+//
+
+#include "inputRecord.hpp"
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+
+namespace {
+
+// ファイルの識別子と版
+const char* const MAGIC = "GTIR";
+const u_int VERSION = 2;
+
+
+// 指定バイト数でファイルに書き込む(リトルエンディアン)
+void writeValue(std::ofstream& fstr, const uint64_t value, const int bytes) {
+  for (int i = 0; i < bytes; ++i) {
+    fstr.put(char((value >> (i * 8)) & 0xff));
+  }
+}
+
+void writeFloat(std::ofstream& fstr, const float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  writeValue(fstr, bits, 4);
+}
+
+void writeDouble(std::ofstream& fstr, const double value) {
+  uint64_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  writeValue(fstr, bits, 8);
+}
+
+// 指定バイト数でファイルから読み込む
+// TIPS:読み込めなかったらストリームが失敗状態になる
+uint64_t readValue(std::ifstream& fstr, const int bytes) {
+  u_char data[8];
+  fstr.read(reinterpret_cast<char*>(data), bytes);
+  if (!fstr) return 0;
+
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; ++i) {
+    value |= uint64_t(data[i]) << (i * 8);
+  }
+  return value;
+}
+
+float readFloat(std::ifstream& fstr) {
+  uint32_t bits = uint32_t(readValue(fstr, 4));
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+double readDouble(std::ifstream& fstr) {
+  uint64_t bits = readValue(fstr, 8);
+  double value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+// ボタンの状況を1bitずつに詰めて書き込む
+void writeBits(std::ofstream& fstr, const std::vector<u_char>& values) {
+  for (size_t i = 0; i < values.size(); i += 8) {
+    u_char bits = 0;
+    for (size_t j = i; j < std::min(i + 8, values.size()); ++j) {
+      bits |= values[j] << (j - i);
+    }
+    writeValue(fstr, bits, 1);
+  }
+}
+
+void readBits(std::ifstream& fstr, std::vector<u_char>& values) {
+  for (size_t i = 0; i < values.size(); i += 8) {
+    u_char bits = u_char(readValue(fstr, 1));
+    for (size_t j = i; j < std::min(i + 8, values.size()); ++j) {
+      values[j] = (bits >> (j - i)) & 1;
+    }
+  }
+}
+
+}
+
+
+// seed 乱数の種
+InputRecorder::InputRecorder(const std::string& path, const u_int seed, const std::vector<GamePad>& gamepads) :
+  fstr_(path, std::ios::binary),
+  frames_(0)
+{
+  DOUT << "InputRecorder()" << std::endl;
+
+  if (!fstr_) {
+    DOUT << "Can't file open: " << path << std::endl;
+    throw "Can't file open.";
+  }
+
+  fstr_.write(MAGIC, 4);
+  writeValue(fstr_, VERSION, 4);
+  writeValue(fstr_, seed, 4);
+
+  // GamePadの構成
+  writeValue(fstr_, gamepads.size(), 4);
+  for (const auto& pad : gamepads) {
+    addGamePad(pad);
+  }
+}
+
+// GamePadの構成を書き込んで、記録する対象に加える
+void InputRecorder::addGamePad(const GamePad& pad) {
+  writeValue(fstr_, pad.name().size(), 4);
+  fstr_.write(pad.name().data(), pad.name().size());
+  writeValue(fstr_, pad.buttons(), 4);
+  writeValue(fstr_, pad.axes(), 4);
+
+  buttons_.emplace_back(pad.buttons(), 0);
+  axes_.emplace_back(pad.axes(), 0.0f);
+  connected_.push_back(pad.isPresent());
+}
+
+// 1フレームぶんの入力を書き込む
+// TIPS:イベントの数、イベント、新しく繋がったGamePadの構成、GamePadごとに変化の有無と状況、の順
+void InputRecorder::write(const std::vector<InputEvent>& events, const std::vector<GamePad>& gamepads) {
+  writeValue(fstr_, events.size(), 4);
+  for (const auto& event : events) {
+    writeValue(fstr_, event.type, 1);
+    writeValue(fstr_, uint32_t(event.code), 4);
+    writeValue(fstr_, u_char(event.action), 1);
+    writeValue(fstr_, u_char(event.mods), 1);
+    writeFloat(fstr_, event.pos.x);
+    writeFloat(fstr_, event.pos.y);
+    writeDouble(fstr_, event.time);
+  }
+
+  // 記録中に新しく繋がったGamePad
+  // TIPS:updateGamePad() は末尾に追加するので、増えたぶんだけ書き込む
+  size_t pad_num = buttons_.size();
+  writeValue(fstr_, gamepads.size() - pad_num, 1);
+  for (size_t i = pad_num; i < gamepads.size(); ++i) {
+    addGamePad(gamepads[i]);
+  }
+
+  for (size_t i = 0; i < buttons_.size(); ++i) {
+    const auto& pad = gamepads[i];
+    auto& buttons = buttons_[i];
+    auto& axes    = axes_[i];
+
+    bool changed = false;
+    if (connected_[i] != pad.isPresent()) {
+      connected_[i] = pad.isPresent();
+      changed = true;
+    }
+    bool edged = false;
+    pushed_.assign(buttons.size(), 0);
+    pulled_.assign(buttons.size(), 0);
+    for (size_t j = 0; j < buttons.size(); ++j) {
+      // TIPS:繋ぎ直されて数が変わった時は、足りない分を0にする
+      bool exists = int(j) < pad.buttons();
+      u_char press = exists && pad.isButtonPressing(int(j)) ? 1 : 0;
+
+      // TIPS:press の変化と食い違う、押した・離した瞬間だけを記録する
+      u_char pushed = exists && pad.isButtonPushed(int(j)) ? 1 : 0;
+      u_char pulled = exists && pad.isButtonReleased(int(j)) ? 1 : 0;
+      if ((pushed != (!buttons[j] && press)) || (pulled != (buttons[j] && !press))) {
+        pushed_[j] = pushed;
+        pulled_[j] = pulled;
+        edged = true;
+      }
+
+      if (buttons[j] != press) {
+        buttons[j] = press;
+        changed = true;
+      }
+    }
+    for (size_t j = 0; j < axes.size(); ++j) {
+      float value = (int(j) < pad.axes()) ? pad.axis(int(j)) : 0.0f;
+      if (axes[j] != value) {
+        axes[j] = value;
+        changed = true;
+      }
+    }
+
+    // TIPS:bit0 変化の有無 bit1 繋がっているか bit2 押した・離した瞬間の有無
+    writeValue(fstr_, (changed ? 1 : 0) | (connected_[i] ? 2 : 0) | (edged ? 4 : 0), 1);
+
+    if (changed) {
+      // TIPS:ボタンは1bitずつに詰める
+      writeBits(fstr_, buttons);
+      for (auto value : axes) {
+        writeFloat(fstr_, value);
+      }
+    }
+    if (edged) {
+      writeBits(fstr_, pushed_);
+      writeBits(fstr_, pulled_);
+    }
+  }
+
+  frames_ += 1;
+}
+
+// 書き込んだフレーム数
+u_int InputRecorder::frames() const { return frames_; }
+
+
+InputPlayer::InputPlayer(const std::string& path) :
+  fstr_(path, std::ios::binary),
+  frames_(0)
+{
+  DOUT << "InputPlayer()" << std::endl;
+
+  if (!fstr_) {
+    DOUT << "Can't file open: " << path << std::endl;
+    throw "Can't file open.";
+  }
+
+  char magic[4];
+  fstr_.read(magic, 4);
+  if (!fstr_ || std::memcmp(magic, MAGIC, 4) || (readValue(fstr_, 4) != VERSION)) {
+    DOUT << "This file isn't input record: " << path << std::endl;
+    throw "This file isn't input record.";
+  }
+
+  seed_ = u_int(readValue(fstr_, 4));
+
+  // GamePadの構成
+  u_int pad_num = u_int(readValue(fstr_, 4));
+  for (u_int i = 0; fstr_ && (i < pad_num); ++i) {
+    readGamePad();
+  }
+
+  if (!fstr_) throw "Input record format error.";
+
+  DOUT << "seed:" << seed_ << " gamepad:" << pad_num << std::endl;
+}
+
+// GamePadの構成を読み込む
+void InputPlayer::readGamePad() {
+  std::string name(size_t(readValue(fstr_, 4)), ' ');
+  fstr_.read(&name[0], name.size());
+  int button_num = int(readValue(fstr_, 4));
+  int axis_num   = int(readValue(fstr_, 4));
+  if (!fstr_) return;
+
+  names_.push_back(name);
+  buttons_.emplace_back(button_num, 0);
+  axes_.emplace_back(axis_num, 0.0f);
+}
+
+
+// 記録した時の乱数の種
+u_int InputPlayer::seed() const { return seed_; }
+
+// 記録した時のGamePad
+std::vector<GamePad> InputPlayer::gamePads() const {
+  std::vector<GamePad> gamepads;
+  for (size_t i = 0; i < names_.size(); ++i) {
+    gamepads.emplace_back(names_[i], int(buttons_[i].size()), int(axes_[i].size()));
+  }
+  return gamepads;
+}
+
+// 1フレームぶんの入力を読み込む
+bool InputPlayer::read(std::vector<InputEvent>& events, std::vector<GamePad>& gamepads) {
+  events.clear();
+
+  u_int num = u_int(readValue(fstr_, 4));
+  for (u_int i = 0; fstr_ && (i < num); ++i) {
+    InputEvent event;
+    event.type   = InputEvent::Type(readValue(fstr_, 1));
+    event.code   = int(int32_t(uint32_t(readValue(fstr_, 4))));
+    event.action = int(readValue(fstr_, 1));
+    event.mods   = int(readValue(fstr_, 1));
+    event.pos.x  = readFloat(fstr_);
+    event.pos.y  = readFloat(fstr_);
+    event.time   = readDouble(fstr_);
+    events.push_back(event);
+  }
+
+  // 記録中に新しく繋がったGamePad
+  u_int pad_num = u_int(readValue(fstr_, 1));
+  for (u_int i = 0; fstr_ && (i < pad_num); ++i) {
+    readGamePad();
+    if (fstr_) {
+      gamepads.emplace_back(names_.back(), int(buttons_.back().size()), int(axes_.back().size()));
+    }
+  }
+
+  for (size_t i = 0; fstr_ && (i < buttons_.size()); ++i) {
+    auto& buttons = buttons_[i];
+    auto& axes    = axes_[i];
+    auto& pad     = gamepads[i];
+
+    u_int state = u_int(readValue(fstr_, 1));
+    bool connected = state & 2;
+    if (connected && !pad.isPresent()) {
+      // TIPS:繋ぎ直されたものは同じ場所を使う(遊びの設定は引き継ぐ)
+      float deadzone = pad.deadzone();
+      pad = GamePad(names_[i], int(buttons.size()), int(axes.size()));
+      pad.deadzone(deadzone);
+    }
+    else if (!connected && pad.isPresent()) {
+      pad.disconnect();
+    }
+
+    if (state & 1) {
+      readBits(fstr_, buttons);
+      for (auto& value : axes) {
+        value = readFloat(fstr_);
+      }
+    }
+
+    pushed_.assign(buttons.size(), 0);
+    pulled_.assign(buttons.size(), 0);
+    if (state & 4) {
+      readBits(fstr_, pushed_);
+      readBits(fstr_, pulled_);
+    }
+
+    if (connected) {
+      pad.update(buttons.data(), int(buttons.size()), axes.data(), int(axes.size()));
+      pad.mergeButtonEdges(pushed_.data(), pulled_.data(), int(pushed_.size()));
+    }
+  }
+
+  // TIPS:途中で切れていたフレームは使わない
+  if (!fstr_) {
+    events.clear();
+    return false;
+  }
+
+  frames_ += 1;
+  return true;
+}
+
+// 読み込んだフレーム数
+u_int InputPlayer::frames() const { return frames_; }
@@ -0,0 +1,125 @@
+﻿
+#pragma once
+
+//
+// 入力の記録と再生
+// TIPS:フレームごとの入力(キー・マウス・文字入力・GamePad)と乱数の種をファイルに書き出し、
+//      後から同じ入力を与えて、何度でも同じ内容で実行できるようにする
+//
+// TIPS:記録中のGamePadの抜き差しも記録する(新しく繋がったものは末尾に追加される)
+// NOTICE:再現されるのは入力だけ。経過時間で処理を変えていると同じ結果にならない
+//
+
+#include "defines.hpp"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include "vector.hpp"
+#include "gamePad.hpp"
+
+
+// 入力イベント
+// TIPS:フレーム内で起きた順に並ぶ
+struct InputEvent {
+  enum Type {
+    KEY,                // キー
+    CHAR,               // 文字入力
+    MOUSE_BUTTON,       // マウスボタン
+    MOUSE_MOVE,         // マウスカーソル移動
+    MOUSE_WARP,         // マウスカーソルの位置合わせ(移動量に含めない)
+  };
+  Type type;
+
+  // KEY:キー MOUSE_BUTTON:ボタン CHAR:文字コード
+  int code;
+  // GLFW_PRESS, GLFW_RELEASE, GLFW_REPEAT
+  int action;
+  // GLFW_MOD_SHIFTなど
+  int mods;
+  // マウスカーソルの位置(画面中央が(0, 0))
+  Vec2f pos;
+  // 受け取った時刻(glfwGetTime() の秒数)
+  double time;
+};
+
+
+// 入力を記録する
+class InputRecorder {
+  std::ofstream fstr_;
+
+  // 前のフレームのGamePadの状況
+  // TIPS:変化がなければ書き込まない
+  std::vector<std::vector<u_char>> buttons_;
+  std::vector<std::vector<float>> axes_;
+  std::vector<bool> connected_;
+  // press の変化だけではわからない、押した・離した瞬間
+  // TIPS:sampleGamePad() で読み取っていると、フレームの間に押して離したボタンがこうなる
+  std::vector<u_char> pushed_;
+  std::vector<u_char> pulled_;
+
+  u_int frames_;
+
+  // GamePadの構成を書き込んで、記録する対象に加える
+  void addGamePad(const GamePad& pad);
+
+
+public:
+  // seed 乱数の種
+  InputRecorder(const std::string& path, const u_int seed, const std::vector<GamePad>& gamepads);
+
+  // このクラスはコピー禁止
+  InputRecorder(const InputRecorder&) = delete;
+  InputRecorder& operator=(const InputRecorder&) = delete;
+
+
+  // 1フレームぶんの入力を書き込む
+  void write(const std::vector<InputEvent>& events, const std::vector<GamePad>& gamepads);
+
+  // 書き込んだフレーム数
+  u_int frames() const;
+};
+
+
+// 記録した入力を読み込む
+class InputPlayer {
+  std::ifstream fstr_;
+  u_int seed_;
+
+  // 記録した時のGamePad
+  std::vector<std::string> names_;
+  std::vector<std::vector<u_char>> buttons_;
+  std::vector<std::vector<float>> axes_;
+  std::vector<u_char> pushed_;
+  std::vector<u_char> pulled_;
+
+  u_int frames_;
+
+  // GamePadの構成を読み込む
+  void readGamePad();
+
+
+public:
+  explicit InputPlayer(const std::string& path);
+
+  // このクラスはコピー禁止
+  InputPlayer(const InputPlayer&) = delete;
+  InputPlayer& operator=(const InputPlayer&) = delete;
+
+
+  // 記録した時の乱数の種
+  u_int seed() const;
+
+  // 記録を始めた時のGamePad(実際には繋がっていないもの)
+  // NOTICE:read() の前に呼ぶこと
+  std::vector<GamePad> gamePads() const;
+
+  // 1フレームぶんの入力を読み込む
+  // gamepads gamePads() で作ったもの。記録した状況で更新される
+  //          記録中に繋がったGamePadは末尾に追加される
+  // 戻り値   最後まで読み込んだらfalse
+  bool read(std::vector<InputEvent>& events, std::vector<GamePad>& gamepads);
+
+  // 読み込んだフレーム数
+  u_int frames() const;
+};
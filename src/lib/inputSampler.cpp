@@ -0,0 +1,193 @@
+﻿//
+// GamePadを別スレッドで読み取る
+//
+
+#include "inputSampler.hpp"
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+
+namespace {
+
+// これより小さい軸の変化は記録しない
+// TIPS:軸はいつも細かく揺れているので、全部記録すると溢れてしまう
+const float AXIS_EPSILON = 1.0f / 256.0f;
+
+}
+
+
+// hz 1秒間に読み取る回数
+InputSampler::InputSampler(const float hz) :
+  polls_(0),
+  interval_(1.0 / std::max(hz, 1.0f)),
+  finish_(false)
+{
+  DOUT << "InputSampler()" << std::endl;
+
+  for (auto& pad : pads_) {
+    pad.watch    = false;
+    pad.standard = false;
+  }
+
+  thread_ = std::thread(&InputSampler::proc, this);
+}
+
+InputSampler::~InputSampler() {
+  DOUT << "~InputSampler()" << std::endl;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    finish_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+}
+
+
+// GLFWを触る処理をまとめるためのmutex
+std::mutex& InputSampler::glfwMutex() { return glfw_mutex_; }
+
+// 読み取るGamePadを決める
+void InputSampler::watch(const std::vector<GamePad>& gamepads) {
+  for (auto& pad : pads_) {
+    pad.watch = false;
+  }
+
+  for (const auto& gamepad : gamepads) {
+    // TIPS:実際には繋がっていないGamePadは読み取らない
+    if (!gamepad.isPresent() || (gamepad.id() < 0)) continue;
+
+    auto& pad = pads_[gamepad.id()];
+    if (!pad.watch && (pad.standard != gamepad.isStandardMapping())) {
+      // 繋ぎ直されて読み取り方が変わった
+      pad.buttons.clear();
+      pad.axes.clear();
+    }
+    pad.watch    = true;
+    pad.standard = gamepad.isStandardMapping();
+  }
+}
+
+// 読み取った状況をGamePadに反映する
+void InputSampler::apply(std::vector<GamePad>& gamepads) {
+  for (auto& gamepad : gamepads) {
+    if (!gamepad.isPresent() || (gamepad.id() < 0)) continue;
+
+    auto& pad = pads_[gamepad.id()];
+    // TIPS:まだ一度も読み取っていない
+    if (pad.buttons.empty() && pad.axes.empty()) continue;
+
+    gamepad.update(pad.buttons.data(), pad.pushed.data(), pad.pulled.data(), int(pad.buttons.size()),
+                   pad.axes.data(), int(pad.axes.size()));
+
+    std::fill(std::begin(pad.pushed), std::end(pad.pushed), 0);
+    std::fill(std::begin(pad.pulled), std::end(pad.pulled), 0);
+  }
+}
+
+// 抜かれたGamePadの読み取った状況を捨てる
+void InputSampler::disconnect(const int id) {
+  if ((id < 0) || (id >= PAD_NUM)) return;
+
+  auto& pad = pads_[id];
+  pad.watch = false;
+  pad.buttons.clear();
+  pad.pushed.clear();
+  pad.pulled.clear();
+  pad.axes.clear();
+  pad.sampled_axes.clear();
+}
+
+// 変化の記録を取り出す
+bool InputSampler::pop(GamePadSample& sample) {
+  return samples_.pop(sample);
+}
+
+// 読み取った回数
+u_long InputSampler::polls() const { return polls_; }
+
+
+// GamePadひとつぶんを読み取る
+void InputSampler::poll(const int id, const double time) {
+  auto& pad = pads_[id];
+
+  const u_char* buttons;
+  const float* axes;
+  int button_num;
+  int axis_num;
+
+  GLFWgamepadstate state;
+  if (pad.standard) {
+    if (!glfwGetGamepadState(id, &state)) return;
+
+    buttons    = state.buttons;
+    button_num = GLFW_GAMEPAD_BUTTON_LAST + 1;
+    axes       = state.axes;
+    axis_num   = GLFW_GAMEPAD_AXIS_LAST + 1;
+  }
+  else {
+    buttons = glfwGetJoystickButtons(id, &button_num);
+    axes    = glfwGetJoystickAxes(id, &axis_num);
+    if (!buttons && !axes) return;
+  }
+
+  if (int(pad.buttons.size()) != button_num) {
+    pad.buttons.assign(button_num, 0);
+    pad.pushed.assign(button_num, 0);
+    pad.pulled.assign(button_num, 0);
+  }
+  if (int(pad.axes.size()) != axis_num) {
+    pad.axes.assign(axis_num, 0.0f);
+    pad.sampled_axes.assign(axis_num, 0.0f);
+  }
+
+  for (int i = 0; i < button_num; ++i) {
+    u_char press = buttons[i] ? 1 : 0;
+    if (press == pad.buttons[i]) continue;
+
+    pad.buttons[i] = press;
+    if (press) pad.pushed[i] = 1;
+    else       pad.pulled[i] = 1;
+
+    // TIPS:溢れた時は記録だけを捨てる(状況には反映されている)
+    samples_.push({ GamePadSample::BUTTON, id, i, float(press), time });
+  }
+
+  for (int i = 0; i < axis_num; ++i) {
+    pad.axes[i] = axes[i];
+    if (std::fabs(axes[i] - pad.sampled_axes[i]) < AXIS_EPSILON) continue;
+
+    pad.sampled_axes[i] = axes[i];
+    samples_.push({ GamePadSample::AXIS, id, i, axes[i], time });
+  }
+}
+
+// std::threadによる読み取り処理
+void InputSampler::proc() {
+  typedef std::chrono::steady_clock Clock;
+  const auto interval = std::chrono::duration_cast<Clock::duration>(interval_);
+
+  Clock::time_point next = Clock::now();
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      next += interval;
+      if (cv_.wait_until(lock, next, [this]() { return finish_; })) break;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(glfw_mutex_);
+      // TIPS:glfwGetTime() はどのスレッドから呼んでもよい
+      double time = glfwGetTime();
+      for (int id = 0; id < PAD_NUM; ++id) {
+        if (pads_[id].watch) poll(id, time);
+      }
+    }
+    polls_ += 1;
+
+    // TIPS:遅れた時はまとめて読み取らない
+    auto now = Clock::now();
+    if (next < now) next = now;
+  }
+}
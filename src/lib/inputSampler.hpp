@@ -0,0 +1,128 @@
+﻿
+#pragma once
+
+//
+// GamePadを別スレッドで読み取る
+// TIPS:フレームの間隔より細かく(最大1000回/秒)読み取り、変化した時刻を記録する
+//      フレームの間に押して離したボタンも取りこぼさない
+//
+// NOTICE:GLFWはGamePadの読み取りをメインスレッドに限っているので、
+//        glfwMutex() でメインスレッドのイベント処理と同時に動かないようにしている
+//        イベント処理(glfwPollEvents())の間は読み取りが止まる
+//        ウインドウにフォーカスがない時は glfwWaitEvents() の代わりに少し眠ってからイベントを処理するので、
+//        フォーカスが戻ったことなどに気づくのが最大16ミリ秒ほど遅れる
+//        Windowsでは timeBeginPeriod() で時計の精度を上げないと、1000回/秒にはならない
+//
+
+#include "defines.hpp"
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include "gamePad.hpp"
+#include "spscQueue.hpp"
+
+
+// GamePadの入力の変化
+struct GamePadSample {
+  enum Type {
+    BUTTON,
+    AXIS,
+  };
+  Type type;
+
+  // GLFWのジョイスティック番号(GamePad::id())
+  int id;
+  // ボタンか軸の番号
+  int index;
+  // ボタンは0.0か1.0、軸は遊びを適用する前の値
+  float value;
+  // 読み取った時刻(glfwGetTime() の秒数)
+  double time;
+};
+
+
+class InputSampler {
+  enum {
+    PAD_NUM = GLFW_JOYSTICK_LAST + 1,
+  };
+
+  // 読み取った状況
+  // TIPS:glfw_mutex_ をロックして読み書きする
+  struct Pad {
+    bool watch;
+    bool standard;
+
+    std::vector<u_char> buttons;
+    // 前回 apply() してから、押した・離したボタン
+    std::vector<u_char> pushed;
+    std::vector<u_char> pulled;
+
+    std::vector<float> axes;
+    // 最後に変化として記録した軸の値
+    std::vector<float> sampled_axes;
+  };
+  Pad pads_[PAD_NUM];
+
+  std::mutex glfw_mutex_;
+
+  // 変化の記録
+  // TIPS:書き込むのは読み取りスレッド、取り出すのはメインスレッドだけ
+  SpscQueue<GamePadSample, 4096> samples_;
+
+  std::atomic<u_long> polls_;
+
+  // 読み取りスレッド
+  std::chrono::duration<double> interval_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool finish_;
+  std::thread thread_;
+
+
+public:
+  // hz 1秒間に読み取る回数
+  explicit InputSampler(const float hz = 1000.0f);
+  ~InputSampler();
+
+  // このクラスはコピー禁止
+  InputSampler(const InputSampler&) = delete;
+  InputSampler& operator=(const InputSampler&) = delete;
+
+
+  // GLFWを触る処理をまとめるためのmutex
+  // TIPS:メインスレッドは glfwPollEvents() や watch(), apply() の間ロックする
+  std::mutex& glfwMutex();
+
+  // 読み取るGamePadを決める
+  // NOTICE:glfwMutex() をロックして呼ぶこと
+  void watch(const std::vector<GamePad>& gamepads);
+
+  // 読み取った状況をGamePadに反映する
+  // NOTICE:glfwMutex() をロックして呼ぶこと
+  void apply(std::vector<GamePad>& gamepads);
+
+  // 抜かれたGamePadの読み取った状況を捨てる
+  // TIPS:繋ぎ直された時に、前の状況との差が押した・離したと扱われないようにする
+  // id GLFWのジョイスティック番号(GamePad::id())
+  // NOTICE:glfwMutex() をロックして呼ぶこと
+  void disconnect(const int id);
+
+  // 変化の記録を取り出す(古い順)
+  // 戻り値 空ならfalse
+  bool pop(GamePadSample& sample);
+
+  // 読み取った回数
+  u_long polls() const;
+
+
+private:
+  // GamePadひとつぶんを読み取る
+  void poll(const int id, const double time);
+
+  // std::threadによる読み取り処理
+  void proc();
+
+};
@@ -0,0 +1,102 @@
+﻿
+//
+// ファイルをメモリに割り当てる
+//
+
+#include "mappedFile.hpp"
+#include <iostream>
+
+#if !defined (_MSC_VER)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+#if defined (_MSC_VER)
+
+MappedFile::MappedFile(const std::string& path) :
+  data_(nullptr),
+  size_(0),
+  file_(INVALID_HANDLE_VALUE),
+  mapping_(nullptr)
+{
+  DOUT << "MappedFile()" << std::endl;
+
+  file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file_ == INVALID_HANDLE_VALUE) {
+    DOUT << "Can't open: " << path << std::endl;
+    throw "Can't file open.";
+  }
+
+  LARGE_INTEGER size;
+  GetFileSizeEx(file_, &size);
+  size_ = size_t(size.QuadPart);
+
+  // TIPS:空のファイルは割り当てられない
+  if (size_ > 0) {
+    mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping_) {
+      data_ = static_cast<const char*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+    }
+  }
+  if (!data_) {
+    if (mapping_) CloseHandle(mapping_);
+    CloseHandle(file_);
+    DOUT << "Can't map: " << path << std::endl;
+    throw "Can't file map.";
+  }
+}
+
+MappedFile::~MappedFile() {
+  DOUT << "~MappedFile()" << std::endl;
+
+  UnmapViewOfFile(data_);
+  CloseHandle(mapping_);
+  CloseHandle(file_);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path) :
+  data_(nullptr),
+  size_(0)
+{
+  DOUT << "MappedFile()" << std::endl;
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    DOUT << "Can't open: " << path << std::endl;
+    throw "Can't file open.";
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == 0) size_ = size_t(st.st_size);
+
+  // TIPS:空のファイルは割り当てられない
+  void* ptr = (size_ > 0) ? mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  // TIPS:割り当てた後はファイルを閉じてもよい
+  close(fd);
+  if (ptr == MAP_FAILED) {
+    DOUT << "Can't map: " << path << std::endl;
+    throw "Can't file map.";
+  }
+  data_ = static_cast<const char*>(ptr);
+}
+
+MappedFile::~MappedFile() {
+  DOUT << "~MappedFile()" << std::endl;
+
+  munmap(const_cast<char*>(data_), size_);
+}
+
+#endif
+
+
+// ファイルの内容
+const char* MappedFile::data() const { return data_; }
+
+// ファイルのサイズ(バイト数)
+size_t MappedFile::size() const { return size_; }
@@ -0,0 +1,37 @@
+﻿
+#pragma once
+
+//
+// ファイルをメモリに割り当てる
+// TIPS:読み込みはOSが必要な時に行うので、ファイル全体を読み込む必要がない
+//
+
+#include "defines.hpp"
+#include <string>
+
+
+class MappedFile {
+  const char* data_;
+  size_t size_;
+
+#if defined (_MSC_VER)
+  HANDLE file_;
+  HANDLE mapping_;
+#endif
+
+
+public:
+  explicit MappedFile(const std::string& path);
+  ~MappedFile();
+
+  // このクラスはコピー禁止
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+
+  // ファイルの内容
+  const char* data() const;
+
+  // ファイルのサイズ(バイト数)
+  size_t size() const;
+};
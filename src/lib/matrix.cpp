@@ -4,8 +4,127 @@
 //
 
 #include "matrix.hpp"
+#include <cmath>
 #include <glm/gtx/transform.hpp>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define USE_SSE2
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#define USE_AVX2
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define USE_NEON
+#include <arm_neon.h>
+#endif
+
+
+// TIPS:Vec2fの配列をfloatの配列として読み書きする
+static_assert(sizeof(Vec2f) == sizeof(float) * 2, "Vec2f must be packed.");
+static_assert(sizeof(Affine2D) == sizeof(float) * 6, "Affine2D must be packed.");
+static_assert(sizeof(Bounds2D) == sizeof(float) * 4, "Bounds2D must be packed.");
+
+
+namespace {
+
+// sin, cosを求める多項式の係数
+// SOURCE:cephes
+const float SINCOS_DP1 = -0.78515625f;
+const float SINCOS_DP2 = -2.4187564849853515625e-4f;
+const float SINCOS_DP3 = -3.77489497744594108e-8f;
+const float SIN_P0     = -1.9515295891e-4f;
+const float SIN_P1     =  8.3321608736e-3f;
+const float SIN_P2     = -1.6666654611e-1f;
+const float COS_P0     =  2.443315711809948e-5f;
+const float COS_P1     = -1.388731625493765e-3f;
+const float COS_P2     =  4.166664568298827e-2f;
+const float FOUR_OVER_PI = 1.27323954473516f;
+
+#if defined(USE_SSE2)
+
+// 4つまとめてsin, cosを求める
+// TIPS:π/4 単位で [-π/4, π/4] に畳み込んでから多項式で近似する
+void sinCos(__m128 x, __m128& s, __m128& c) {
+  const __m128 sign_mask = _mm_castsi128_ps(_mm_set1_epi32(int(0x80000000)));
+  __m128 sign_sin = _mm_and_ps(x, sign_mask);
+  x = _mm_andnot_ps(sign_mask, x);
+
+  // 何番目の π/4 か(偶数に揃える)
+  __m128i j = _mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(FOUR_OVER_PI)));
+  j = _mm_and_si128(_mm_add_epi32(j, _mm_set1_epi32(1)), _mm_set1_epi32(~1));
+  __m128 y = _mm_cvtepi32_ps(j);
+
+  const __m128i four = _mm_set1_epi32(4);
+  sign_sin = _mm_xor_ps(sign_sin, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(j, four), 29)));
+  __m128 sign_cos = _mm_castsi128_ps(_mm_slli_epi32(_mm_andnot_si128(_mm_sub_epi32(j, _mm_set1_epi32(2)), four), 29));
+  // sinとcosの多項式を入れ替えるか
+  __m128 poly_mask = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(j, _mm_set1_epi32(2)), _mm_setzero_si128()));
+
+  x = _mm_add_ps(x, _mm_mul_ps(y, _mm_set1_ps(SINCOS_DP1)));
+  x = _mm_add_ps(x, _mm_mul_ps(y, _mm_set1_ps(SINCOS_DP2)));
+  x = _mm_add_ps(x, _mm_mul_ps(y, _mm_set1_ps(SINCOS_DP3)));
+  __m128 z = _mm_mul_ps(x, x);
+
+  __m128 pc = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(COS_P0), z), _mm_set1_ps(COS_P1));
+  pc = _mm_add_ps(_mm_mul_ps(pc, z), _mm_set1_ps(COS_P2));
+  pc = _mm_mul_ps(_mm_mul_ps(pc, z), z);
+  pc = _mm_add_ps(_mm_sub_ps(pc, _mm_mul_ps(z, _mm_set1_ps(0.5f))), _mm_set1_ps(1.0f));
+
+  __m128 ps = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(SIN_P0), z), _mm_set1_ps(SIN_P1));
+  ps = _mm_add_ps(_mm_mul_ps(ps, z), _mm_set1_ps(SIN_P2));
+  ps = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(ps, z), x), x);
+
+  s = _mm_xor_ps(_mm_or_ps(_mm_and_ps(poly_mask, ps), _mm_andnot_ps(poly_mask, pc)), sign_sin);
+  c = _mm_xor_ps(_mm_or_ps(_mm_and_ps(poly_mask, pc), _mm_andnot_ps(poly_mask, ps)), sign_cos);
+}
+
+#elif defined(USE_NEON)
+
+// 4つまとめてsin, cosを求める
+void sinCos(float32x4_t x, float32x4_t& s, float32x4_t& c) {
+  const uint32x4_t sign_mask = vdupq_n_u32(0x80000000);
+  uint32x4_t sign_sin = vandq_u32(vreinterpretq_u32_f32(x), sign_mask);
+  x = vabsq_f32(x);
+
+  uint32x4_t j = vcvtq_u32_f32(vmulq_n_f32(x, FOUR_OVER_PI));
+  j = vandq_u32(vaddq_u32(j, vdupq_n_u32(1)), vdupq_n_u32(~1u));
+  float32x4_t y = vcvtq_f32_u32(j);
+
+  const uint32x4_t four = vdupq_n_u32(4);
+  sign_sin = veorq_u32(sign_sin, vshlq_n_u32(vandq_u32(j, four), 29));
+  uint32x4_t sign_cos = vshlq_n_u32(vbicq_u32(four, vsubq_u32(j, vdupq_n_u32(2))), 29);
+  uint32x4_t poly_mask = vceqq_u32(vandq_u32(j, vdupq_n_u32(2)), vdupq_n_u32(0));
+
+  x = vmlaq_n_f32(x, y, SINCOS_DP1);
+  x = vmlaq_n_f32(x, y, SINCOS_DP2);
+  x = vmlaq_n_f32(x, y, SINCOS_DP3);
+  float32x4_t z = vmulq_f32(x, x);
+
+  float32x4_t pc = vmlaq_n_f32(vdupq_n_f32(COS_P1), z, COS_P0);
+  pc = vmlaq_f32(vdupq_n_f32(COS_P2), pc, z);
+  pc = vmulq_f32(vmulq_f32(pc, z), z);
+  pc = vaddq_f32(vmlsq_n_f32(pc, z, 0.5f), vdupq_n_f32(1.0f));
+
+  float32x4_t ps = vmlaq_n_f32(vdupq_n_f32(SIN_P1), z, SIN_P0);
+  ps = vmlaq_f32(vdupq_n_f32(SIN_P2), ps, z);
+  ps = vmlaq_f32(x, vmulq_f32(ps, z), x);
+
+  s = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(vbslq_f32(poly_mask, ps, pc)), sign_sin));
+  c = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(vbslq_f32(poly_mask, pc, ps)), sign_cos));
+}
+
+#endif
+
+// 平行移動、回転、スケーリングからアフィン変換を生成
+Affine2D compose(const Transform2D& transform, const float s, const float c) {
+  return { Vec2f(c, s) * transform.scaling.x,
+           Vec2f(-s, c) * transform.scaling.y,
+           transform.translate };
+}
+
+}
+
 
 
 // 回転、スケーリング、平行移動から変換行列を生成(2D向け)
@@ -88,3 +207,187 @@ Mat4 frustumMatrix(const GLfloat left, const GLfloat right,
 
   return m;
 }
+
+
+// 4x4行列からアフィン変換を取り出す(2D向け)
+Affine2D affine2D(const Mat4& matrix) {
+  return { Vec2f(matrix[0]), Vec2f(matrix[1]), Vec2f(matrix[3]) };
+}
+
+// アフィン変換を4x4行列にする
+Mat4 transformMatrix2D(const Affine2D& affine) {
+  Mat4 m(1.0f);
+  m[0] = Vec4f(affine.x_axis, 0.0f, 0.0f);
+  m[1] = Vec4f(affine.y_axis, 0.0f, 0.0f);
+  m[3] = Vec4f(affine.translate, 0.0f, 1.0f);
+
+  return m;
+}
+
+
+// 点をまとめて変換
+void transformPoints(const Affine2D& affine, const Vec2f* in, Vec2f* out, const size_t num) {
+  const float* src = &in[0].x;
+  float* dst = &out[0].x;
+  size_t i = 0;
+#if defined(USE_AVX2)
+  {
+    // TIPS:x0 y0 x1 y1 ... の並びのまま、xとyをそれぞれ複製して掛ける
+    const __m256 ax = _mm256_setr_ps(affine.x_axis.x, affine.x_axis.y, affine.x_axis.x, affine.x_axis.y,
+                                     affine.x_axis.x, affine.x_axis.y, affine.x_axis.x, affine.x_axis.y);
+    const __m256 ay = _mm256_setr_ps(affine.y_axis.x, affine.y_axis.y, affine.y_axis.x, affine.y_axis.y,
+                                     affine.y_axis.x, affine.y_axis.y, affine.y_axis.x, affine.y_axis.y);
+    const __m256 t  = _mm256_setr_ps(affine.translate.x, affine.translate.y, affine.translate.x, affine.translate.y,
+                                     affine.translate.x, affine.translate.y, affine.translate.x, affine.translate.y);
+    for (; (i + 8) <= num; i += 8) {
+      __m256 p0 = _mm256_loadu_ps(src + i * 2);
+      __m256 p1 = _mm256_loadu_ps(src + i * 2 + 8);
+      __m256 r0 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_permute_ps(p0, 0xa0), ax),
+                                              _mm256_mul_ps(_mm256_permute_ps(p0, 0xf5), ay)), t);
+      __m256 r1 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_permute_ps(p1, 0xa0), ax),
+                                              _mm256_mul_ps(_mm256_permute_ps(p1, 0xf5), ay)), t);
+      _mm256_storeu_ps(dst + i * 2, r0);
+      _mm256_storeu_ps(dst + i * 2 + 8, r1);
+    }
+  }
+#endif
+#if defined(USE_SSE2)
+  {
+    const __m128 ax = _mm_setr_ps(affine.x_axis.x, affine.x_axis.y, affine.x_axis.x, affine.x_axis.y);
+    const __m128 ay = _mm_setr_ps(affine.y_axis.x, affine.y_axis.y, affine.y_axis.x, affine.y_axis.y);
+    const __m128 t  = _mm_setr_ps(affine.translate.x, affine.translate.y, affine.translate.x, affine.translate.y);
+    for (; (i + 4) <= num; i += 4) {
+      __m128 p0 = _mm_loadu_ps(src + i * 2);
+      __m128 p1 = _mm_loadu_ps(src + i * 2 + 4);
+      __m128 r0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(p0, p0, _MM_SHUFFLE(2, 2, 0, 0)), ax),
+                                        _mm_mul_ps(_mm_shuffle_ps(p0, p0, _MM_SHUFFLE(3, 3, 1, 1)), ay)), t);
+      __m128 r1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(p1, p1, _MM_SHUFFLE(2, 2, 0, 0)), ax),
+                                        _mm_mul_ps(_mm_shuffle_ps(p1, p1, _MM_SHUFFLE(3, 3, 1, 1)), ay)), t);
+      _mm_storeu_ps(dst + i * 2, r0);
+      _mm_storeu_ps(dst + i * 2 + 4, r1);
+    }
+  }
+#elif defined(USE_NEON)
+  for (; (i + 4) <= num; i += 4) {
+    // TIPS:xとyに分けて読み込む
+    float32x4x2_t p = vld2q_f32(src + i * 2);
+    float32x4_t x = vmlaq_n_f32(vmlaq_n_f32(vdupq_n_f32(affine.translate.x), p.val[0], affine.x_axis.x),
+                                p.val[1], affine.y_axis.x);
+    float32x4_t y = vmlaq_n_f32(vmlaq_n_f32(vdupq_n_f32(affine.translate.y), p.val[0], affine.x_axis.y),
+                                p.val[1], affine.y_axis.y);
+    float32x4x2_t r = { { x, y } };
+    vst2q_f32(dst + i * 2, r);
+  }
+#endif
+  for (; i < num; ++i) {
+    float x = src[i * 2];
+    float y = src[i * 2 + 1];
+    dst[i * 2]     = affine.x_axis.x * x + affine.y_axis.x * y + affine.translate.x;
+    dst[i * 2 + 1] = affine.x_axis.y * x + affine.y_axis.y * y + affine.translate.y;
+  }
+}
+
+// 点をまとめて変換(4x4行列)
+void transformPoints(const Mat4& matrix, const Vec2f* in, Vec2f* out, const size_t num) {
+  transformPoints(affine2D(matrix), in, out, num);
+}
+
+// 平行移動、回転、スケーリングからアフィン変換をまとめて生成
+// TIPS:時間がかかるのはsin, cosなので、そこを4つずつ求める
+void composeTransforms(const Transform2D* in, Affine2D* out, const size_t num) {
+  size_t i = 0;
+#if defined(USE_SSE2) || defined(USE_NEON)
+  alignas(16) float rad[4];
+  alignas(16) float s[4];
+  alignas(16) float c[4];
+  for (; (i + 4) <= num; i += 4) {
+    for (int k = 0; k < 4; ++k) {
+      rad[k] = in[i + k].rotate_rad;
+    }
+#if defined(USE_SSE2)
+    __m128 vs, vc;
+    sinCos(_mm_load_ps(rad), vs, vc);
+    _mm_store_ps(s, vs);
+    _mm_store_ps(c, vc);
+#else
+    float32x4_t vs, vc;
+    sinCos(vld1q_f32(rad), vs, vc);
+    vst1q_f32(s, vs);
+    vst1q_f32(c, vc);
+#endif
+    for (int k = 0; k < 4; ++k) {
+      out[i + k] = compose(in[i + k], s[k], c[k]);
+    }
+  }
+#endif
+  for (; i < num; ++i) {
+    out[i] = compose(in[i], std::sin(in[i].rotate_rad), std::cos(in[i].rotate_rad));
+  }
+}
+
+// 矩形を変換した四角形が収まる矩形をまとめて求める
+// TIPS:中心を変換し、半分の大きさは軸の絶対値で広げる(分岐しない)
+void transformBounds(const Affine2D* affine, const Bounds2D* local, Bounds2D* out, const size_t num) {
+  size_t i = 0;
+#if defined(USE_SSE2)
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  for (; (i + 2) <= num; i += 2) {
+    // TIPS:ふたつ分を x0 y0 x1 y1 の並びにする
+    const auto* a0 = &affine[i].x_axis.x;
+    const auto* a1 = &affine[i + 1].x_axis.x;
+    __m128 ax = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64*>(a0)),
+                             reinterpret_cast<const __m64*>(a1));
+    __m128 ay = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64*>(a0 + 2)),
+                             reinterpret_cast<const __m64*>(a1 + 2));
+    __m128 t  = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64*>(a0 + 4)),
+                             reinterpret_cast<const __m64*>(a1 + 4));
+
+    // min0 max0 min1 max1 → min0 min1, max0 max1
+    __m128 b0 = _mm_loadu_ps(&local[i].min.x);
+    __m128 b1 = _mm_loadu_ps(&local[i + 1].min.x);
+    __m128 lo = _mm_movelh_ps(b0, b1);
+    __m128 hi = _mm_movehl_ps(b1, b0);
+
+    __m128 center = _mm_mul_ps(_mm_add_ps(lo, hi), half);
+    __m128 size   = _mm_mul_ps(_mm_sub_ps(hi, lo), half);
+
+    __m128 c = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(center, center, _MM_SHUFFLE(2, 2, 0, 0)), ax),
+                                     _mm_mul_ps(_mm_shuffle_ps(center, center, _MM_SHUFFLE(3, 3, 1, 1)), ay)), t);
+    __m128 e = _mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(size, size, _MM_SHUFFLE(2, 2, 0, 0)), _mm_and_ps(ax, abs_mask)),
+                          _mm_mul_ps(_mm_shuffle_ps(size, size, _MM_SHUFFLE(3, 3, 1, 1)), _mm_and_ps(ay, abs_mask)));
+
+    lo = _mm_sub_ps(c, e);
+    hi = _mm_add_ps(c, e);
+    _mm_storeu_ps(&out[i].min.x,     _mm_movelh_ps(lo, hi));
+    _mm_storeu_ps(&out[i + 1].min.x, _mm_movehl_ps(hi, lo));
+  }
+#elif defined(USE_NEON)
+  for (; i < num; ++i) {
+    const auto* a = &affine[i].x_axis.x;
+    float32x2_t ax = vld1_f32(a);
+    float32x2_t ay = vld1_f32(a + 2);
+    float32x2_t t  = vld1_f32(a + 4);
+    float32x2_t lo = vld1_f32(&local[i].min.x);
+    float32x2_t hi = vld1_f32(&local[i].max.x);
+
+    float32x2_t center = vmul_n_f32(vadd_f32(lo, hi), 0.5f);
+    float32x2_t size   = vmul_n_f32(vsub_f32(hi, lo), 0.5f);
+
+    float32x2_t c = vmla_lane_f32(vmla_lane_f32(t, ax, center, 0), ay, center, 1);
+    float32x2_t e = vmla_lane_f32(vmul_lane_f32(vabs_f32(ax), size, 0), vabs_f32(ay), size, 1);
+
+    vst1_f32(&out[i].min.x, vsub_f32(c, e));
+    vst1_f32(&out[i].max.x, vadd_f32(c, e));
+  }
+#endif
+  for (; i < num; ++i) {
+    const auto& a = affine[i];
+    Vec2f center = (local[i].min + local[i].max) * 0.5f;
+    Vec2f size   = (local[i].max - local[i].min) * 0.5f;
+
+    Vec2f c = a.x_axis * center.x + a.y_axis * center.y + a.translate;
+    Vec2f e = glm::abs(a.x_axis) * size.x + glm::abs(a.y_axis) * size.y;
+    out[i] = { c - e, c + e };
+  }
+}
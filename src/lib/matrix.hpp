@@ -7,6 +7,7 @@
 
 #include "defines.hpp"
 #include <utility>
+#include <cstddef>
 #include "vector.hpp"
 
 
@@ -14,6 +15,29 @@ using Mat3 = glm::mat3;
 using Mat4 = glm::mat4;
 
 
+// 2D向けのアフィン変換
+// TIPS:p' = x_axis * p.x + y_axis * p.y + translate
+//      Mat4より小さいので、大量の物体をまとめて扱う時に使う
+struct Affine2D {
+  Vec2f x_axis;
+  Vec2f y_axis;
+  Vec2f translate;
+};
+
+// 平行移動、回転、スケーリング(2D向け)
+struct Transform2D {
+  Vec2f translate;
+  float rotate_rad;
+  Vec2f scaling;
+};
+
+// 矩形(軸に平行)
+struct Bounds2D {
+  Vec2f min;
+  Vec2f max;
+};
+
+
 // 回転、スケーリング、平行移動から変換行列を生成(2D向け)
 // rotate    回転量(ラジアン)
 // transtate 平行移動量
@@ -31,3 +55,31 @@ Mat4 orthoMatrix(const GLfloat left, const GLfloat right,
 Mat4 frustumMatrix(const GLfloat left, const GLfloat right,
                       const GLfloat bottom, const GLfloat top,
                       const GLfloat nearval, const GLfloat farval);
+
+
+// 4x4行列からアフィン変換を取り出す(2D向け)
+// TIPS:z = 0, w = 1 の点を変換した時のx, yだけを使う
+Affine2D affine2D(const Mat4& matrix);
+
+// アフィン変換を4x4行列にする
+Mat4 transformMatrix2D(const Affine2D& affine);
+
+
+// 以下はまとめて処理する関数
+// TIPS:SSE2(AVX2でビルドした時はAVX2)かNEONで、4〜8個ずつ処理する
+//      inとoutは同じ配列でもよい
+
+// 点をまとめて変換
+void transformPoints(const Affine2D& affine, const Vec2f* in, Vec2f* out, const size_t num);
+
+// 点をまとめて変換(4x4行列)
+// TIPS:m * Vec4f(p, 0, 1) のx, y。wでは割らない
+void transformPoints(const Mat4& matrix, const Vec2f* in, Vec2f* out, const size_t num);
+
+// 平行移動、回転、スケーリングからアフィン変換をまとめて生成
+// TIPS:transformMatrix2D() と同じく、スケーリング→回転→平行移動の順
+void composeTransforms(const Transform2D* in, Affine2D* out, const size_t num);
+
+// 矩形を変換した四角形が収まる矩形をまとめて求める
+// local 変換する前の矩形
+void transformBounds(const Affine2D* affine, const Bounds2D* local, Bounds2D* out, const size_t num);
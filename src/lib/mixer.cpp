@@ -0,0 +1,635 @@
+﻿
+//
+// ソフトウェアミキサー
+//
+
+#include "mixer.hpp"
+#include <iostream>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "wav.hpp"
+#include "oggVorbis.hpp"
+#include "sampleConvert.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define USE_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define USE_NEON
+#include <arm_neon.h>
+#endif
+
+
+namespace {
+
+// 16bit PCMをfloatにする
+// ch 2なら左右に分ける
+void toFloat(const int16_t* src, const u_int ch, const size_t frames, float* left, float* right) {
+  const float scale = 1.0f / 32768.0f;
+  size_t i = 0;
+#if defined(USE_SSE2)
+  const __m128 s = _mm_set1_ps(scale);
+  if (ch == 1) {
+    for (; (i + 8) <= frames; i += 8) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+      // TIPS:上位16bitに置いてから算術シフトで符号を拡張する
+      __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+      __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+      _mm_storeu_ps(left + i,     _mm_mul_ps(_mm_cvtepi32_ps(lo), s));
+      _mm_storeu_ps(left + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), s));
+    }
+  }
+  else {
+    for (; (i + 4) <= frames; i += 4) {
+      // TIPS:32bitの下位が左、上位が右
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2));
+      __m128i l = _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+      __m128i r = _mm_srai_epi32(v, 16);
+      _mm_storeu_ps(left + i,  _mm_mul_ps(_mm_cvtepi32_ps(l), s));
+      _mm_storeu_ps(right + i, _mm_mul_ps(_mm_cvtepi32_ps(r), s));
+    }
+  }
+#elif defined(USE_NEON)
+  if (ch == 1) {
+    for (; (i + 4) <= frames; i += 4) {
+      int32x4_t v = vmovl_s16(vld1_s16(src + i));
+      vst1q_f32(left + i, vmulq_n_f32(vcvtq_f32_s32(v), scale));
+    }
+  }
+  else {
+    for (; (i + 4) <= frames; i += 4) {
+      int16x4x2_t v = vld2_s16(src + i * 2);
+      vst1q_f32(left + i,  vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(v.val[0])), scale));
+      vst1q_f32(right + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(v.val[1])), scale));
+    }
+  }
+#endif
+  for (; i < frames; ++i) {
+    left[i] = src[i * ch] * scale;
+    if (ch == 2) right[i] = src[i * 2 + 1] * scale;
+  }
+}
+
+// 音量を変えながら足す
+// TIPS:ブロックの間で音量をなめらかに変えて、ノイズが出ないようにする
+void mixRamp(const float* src, const float from, const float to, const size_t frames, float* dst) {
+  const float step = (to - from) / frames;
+  size_t i = 0;
+#if defined(USE_SSE2)
+  __m128 gain = _mm_add_ps(_mm_set1_ps(from), _mm_mul_ps(_mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f), _mm_set1_ps(step)));
+  const __m128 gain_step = _mm_set1_ps(step * 4.0f);
+  for (; (i + 4) <= frames; i += 4) {
+    __m128 v = _mm_mul_ps(_mm_loadu_ps(src + i), gain);
+    _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), v));
+    gain = _mm_add_ps(gain, gain_step);
+  }
+#elif defined(USE_NEON)
+  const float offset[] = { 0.0f, 1.0f, 2.0f, 3.0f };
+  float32x4_t gain = vmlaq_n_f32(vdupq_n_f32(from), vld1q_f32(offset), step);
+  const float32x4_t gain_step = vdupq_n_f32(step * 4.0f);
+  for (; (i + 4) <= frames; i += 4) {
+    vst1q_f32(dst + i, vmlaq_f32(vld1q_f32(dst + i), vld1q_f32(src + i), gain));
+    gain = vaddq_f32(gain, gain_step);
+  }
+#endif
+  for (; i < frames; ++i) {
+    dst[i] += src[i] * (from + step * i);
+  }
+}
+
+// 左右交互に並べる
+void interleave(const float* left, const float* right, const float gain, const size_t frames,
+                float* out) {
+  size_t i = 0;
+#if defined(USE_SSE2)
+  const __m128 g = _mm_set1_ps(gain);
+  for (; (i + 4) <= frames; i += 4) {
+    __m128 l = _mm_mul_ps(_mm_loadu_ps(left + i), g);
+    __m128 r = _mm_mul_ps(_mm_loadu_ps(right + i), g);
+    _mm_storeu_ps(out + i * 2,     _mm_unpacklo_ps(l, r));
+    _mm_storeu_ps(out + i * 2 + 4, _mm_unpackhi_ps(l, r));
+  }
+#elif defined(USE_NEON)
+  for (; (i + 4) <= frames; i += 4) {
+    float32x4x2_t v = { { vmulq_n_f32(vld1q_f32(left + i), gain),
+                          vmulq_n_f32(vld1q_f32(right + i), gain) } };
+    vst2q_f32(out + i * 2, v);
+  }
+#endif
+  for (; i < frames; ++i) {
+    out[i * 2]     = left[i] * gain;
+    out[i * 2 + 1] = right[i] * gain;
+  }
+}
+
+
+// 指定バイト数でファイルに書き込む
+void writeValue(std::ofstream& fstr, const u_int value, const int bytes) {
+  for (int i = 0; i < bytes; ++i) {
+    fstr.put(char((value >> (i * 8)) & 0xff));
+  }
+}
+
+}
+
+
+MixerSound::MixerSound(const std::string& path) {
+  if (OggVorbis::isOggFile(path)) {
+    OggVorbis ogg(path);
+    ch_   = ogg.channel();
+    rate_ = ogg.sampleRate();
+    pcm_.resize(ogg.frames() * ch_);
+    frames_ = ogg.read(pcm_.data(), ogg.frames());
+    pcm_.resize(frames_ * ch_);
+    return;
+  }
+
+  // TIPS:16bit以外のPCMも読み込み時に変換される
+  Wav wav(path);
+  ch_     = wav.channel();
+  rate_   = wav.sampleRate();
+  frames_ = wav.size() / (ch_ * sizeof(int16_t));
+  pcm_.resize(frames_ * ch_);
+  std::memcpy(pcm_.data(), wav.data(), frames_ * ch_ * sizeof(int16_t));
+}
+
+MixerSound::MixerSound(std::vector<int16_t> pcm, const u_int ch, const u_int rate) :
+  pcm_(std::move(pcm)),
+  ch_(ch),
+  rate_(rate),
+  frames_(((ch == 1) || (ch == 2)) ? pcm_.size() / ch : 0)
+{
+  // TIPS:ミキサーはモノラルとステレオしか扱わない
+  if ((ch != 1) && (ch != 2)) {
+    DOUT << "MixerSound channel error: " << ch << std::endl;
+    throw "MixerSound channel error.";
+  }
+}
+
+u_int MixerSound::channel() const { return ch_; }
+u_int MixerSound::sampleRate() const { return rate_; }
+size_t MixerSound::frames() const { return frames_; }
+const int16_t* MixerSound::data() const { return pcm_.data(); }
+
+
+NullOutput::NullOutput(const u_int rate, const size_t latency) :
+  rate_(rate),
+  latency_(latency),
+  started_(false),
+  written_(0)
+{}
+
+size_t NullOutput::available() {
+  // 最初に呼ばれた時から時間を測る
+  auto now = std::chrono::steady_clock::now();
+  if (!started_) {
+    start_   = now;
+    started_ = true;
+  }
+
+  double elapsed = std::chrono::duration<double>(now - start_).count();
+  size_t played = size_t(elapsed * rate_) + latency_;
+  return (played > written_) ? played - written_ : 0;
+}
+
+void NullOutput::write(const float*, const size_t frames) {
+  written_ += frames;
+}
+
+size_t NullOutput::written() const { return written_; }
+
+
+WavOutput::WavOutput(const std::string& path, const u_int rate, const size_t latency) :
+  NullOutput(rate, latency),
+  fstr_(path, std::ios::binary)
+{
+  DOUT << "WavOutput()" << std::endl;
+
+  if (!fstr_) {
+    DOUT << "Can't file open: " << path << std::endl;
+    throw "Can't file open.";
+  }
+
+  // 16bit PCMのステレオ
+  // TIPS:長さは後で書き込む
+  fstr_.write("RIFF", 4);
+  writeValue(fstr_, 0, 4);
+  fstr_.write("WAVEfmt ", 8);
+  writeValue(fstr_, 16, 4);
+  writeValue(fstr_, Wav::FORMAT_PCM, 2);
+  writeValue(fstr_, 2, 2);
+  writeValue(fstr_, rate, 4);
+  writeValue(fstr_, rate * 4, 4);
+  writeValue(fstr_, 4, 2);
+  writeValue(fstr_, 16, 2);
+  fstr_.write("data", 4);
+  writeValue(fstr_, 0, 4);
+}
+
+WavOutput::~WavOutput() {
+  DOUT << "~WavOutput()" << std::endl;
+
+  u_int size = u_int(written() * 4);
+  fstr_.seekp(4);
+  writeValue(fstr_, 36 + size, 4);
+  fstr_.seekp(40);
+  writeValue(fstr_, size, 4);
+}
+
+void WavOutput::write(const float* samples, const size_t frames) {
+  pcm_.resize(frames * 2);
+  convertSamples(SampleFormat::FLOAT32, samples, frames * 2, pcm_.data());
+  fstr_.write(reinterpret_cast<const char*>(pcm_.data()), frames * 2 * sizeof(int16_t));
+
+  NullOutput::write(samples, frames);
+}
+
+
+OpenALOutput::OpenALOutput(const u_int rate, const size_t buffer_frames, const int buffer_num) :
+  buffers_(buffer_num),
+  rate_(rate),
+  buffer_frames_(std::max(buffer_frames, size_t(1))),
+  underruns_(0),
+  started_(false)
+{
+  DOUT << "OpenALOutput()" << std::endl;
+
+  for (const auto& buffer : buffers_) {
+    free_.push_back(buffer.id());
+  }
+  pcm_.reserve(buffer_frames_ * 2);
+}
+
+size_t OpenALOutput::available() {
+  // 再生が終わったバッファを回収
+  int processed = source_.processed();
+  for (int i = 0; i < processed; ++i) {
+    free_.push_back(source_.unqueueBuffer());
+  }
+  if (free_.empty()) return 0;
+
+  // TIPS:溜めている途中のぶんを引く
+  return free_.size() * buffer_frames_ - pcm_.size() / 2;
+}
+
+void OpenALOutput::write(const float* samples, const size_t frames) {
+  size_t offset = 0;
+  bool queued = false;
+  while ((offset < frames) && (available() > 0)) {
+    size_t filled = pcm_.size() / 2;
+    size_t length = std::min(frames - offset, buffer_frames_ - filled);
+    pcm_.resize((filled + length) * 2);
+    convertSamples(SampleFormat::FLOAT32, samples + offset * 2, length * 2, pcm_.data() + filled * 2);
+    offset += length;
+
+    // バッファひとつぶん溜まったら積む
+    if (pcm_.size() < buffer_frames_ * 2) break;
+
+    ALuint id = free_.back();
+    free_.pop_back();
+    auto it = std::find_if(std::begin(buffers_), std::end(buffers_),
+                           [id](const Buffer& buffer) { return buffer.id() == id; });
+    it->bind(true, pcm_.data(), u_int(pcm_.size() * sizeof(int16_t)), rate_);
+    source_.queueBuffer(*it);
+    pcm_.clear();
+    queued = true;
+  }
+
+  // TIPS:積んだ時だけ調べる(溜めている途中は止まっていて当然)
+  if (queued && !source_.isPlaying()) {
+    // すべてのバッファを再生しきって止まっていた
+    if (started_) underruns_ += 1;
+    source_.play();
+    started_ = true;
+  }
+}
+
+u_int OpenALOutput::underruns() const { return underruns_; }
+
+
+struct Mixer::Voice {
+  u_int id;
+  std::shared_ptr<const MixerSound> sound;
+  int bus;
+
+  // 再生位置(フレーム)
+  double pos;
+
+  float gain;
+  float pan;
+  float pitch;
+  bool loop;
+
+  // 前のブロックの左右の音量
+  float last_left;
+  float last_right;
+  bool started;
+};
+
+struct Mixer::Bus {
+  float gain;
+  float last_gain;
+  std::vector<float> left;
+  std::vector<float> right;
+  std::vector<std::shared_ptr<MixerEffect>> effects;
+};
+
+
+Mixer::Mixer(std::unique_ptr<MixerOutput> output, const u_int rate, const size_t block_frames) :
+  output_(std::move(output)),
+  rate_(rate),
+  block_frames_(std::max(block_frames, size_t(1))),
+  work_left_(block_frames_),
+  work_right_(block_frames_),
+  interleaved_(block_frames_ * 2),
+  next_id_(0),
+  bus_num_(0),
+  active_voices_(0),
+  blocks_(0),
+  render_ns_(0),
+  finish_(false)
+{
+  DOUT << "Mixer()" << std::endl;
+
+  // マスター
+  addBus(1.0f);
+}
+
+Mixer::~Mixer() {
+  DOUT << "~Mixer()" << std::endl;
+
+  if (thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      finish_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+  }
+}
+
+
+u_int Mixer::sampleRate() const { return rate_; }
+
+// バスを追加
+int Mixer::addBus(const float gain) {
+  size_t frames = block_frames_;
+  command([this, gain, frames]() {
+      buses_.push_back({ gain, gain, std::vector<float>(frames), std::vector<float>(frames), {} });
+    });
+  return bus_num_++;
+}
+
+// バスの音量
+void Mixer::busGain(const int bus, const float gain) {
+  command([this, bus, gain]() {
+      if ((bus >= 0) && (bus < int(buses_.size()))) buses_[bus].gain = gain;
+    });
+}
+
+// バスにエフェクトを追加
+void Mixer::addEffect(const int bus, std::unique_ptr<MixerEffect> effect) {
+  // TIPS:std::functionはコピーできる関数しか持てないのでshared_ptrにする
+  std::shared_ptr<MixerEffect> shared(std::move(effect));
+  command([this, bus, shared]() {
+      if ((bus >= 0) && (bus < int(buses_.size()))) buses_[bus].effects.push_back(shared);
+    });
+}
+
+// 出力する波形を解析する
+void Mixer::analyzer(const std::shared_ptr<AudioAnalyzer>& analyzer) {
+  command([this, analyzer]() { analyzer_ = analyzer; });
+}
+
+// 再生開始
+u_int Mixer::play(const std::shared_ptr<const MixerSound>& sound, const int bus,
+                  const float gain, const float pan, const float pitch, const bool loop) {
+  u_int id = ++next_id_;
+  command([=]() {
+      voices_.push_back({ id, sound, ((bus >= 0) && (bus < int(buses_.size()))) ? bus : MASTER,
+                          0.0, gain, pan, pitch, loop, 0.0f, 0.0f, false });
+    });
+  return id;
+}
+
+void Mixer::stop(const u_int id) {
+  command([this, id]() {
+      voices_.erase(std::remove_if(std::begin(voices_), std::end(voices_),
+                                   [id](const Voice& voice) { return voice.id == id; }),
+                    std::end(voices_));
+    });
+}
+
+void Mixer::stopAll() {
+  command([this]() { voices_.clear(); });
+}
+
+void Mixer::gain(const u_int id, const float value) {
+  command([this, id, value]() {
+      if (auto* voice = findVoice(id)) voice->gain = value;
+    });
+}
+
+void Mixer::pan(const u_int id, const float value) {
+  command([this, id, value]() {
+      if (auto* voice = findVoice(id)) voice->pan = value;
+    });
+}
+
+void Mixer::pitch(const u_int id, const float value) {
+  command([this, id, value]() {
+      if (auto* voice = findVoice(id)) voice->pitch = value;
+    });
+}
+
+// 処理スレッドを開始
+void Mixer::start() {
+  if (thread_.joinable()) return;
+
+  thread_ = std::thread(&Mixer::proc, this);
+}
+
+// スレッドを使わずに、指定フレーム数ぶん処理する
+void Mixer::process(const size_t frames) {
+  for (size_t i = 0; i < frames; i += block_frames_) {
+    renderBlock();
+  }
+}
+
+MixerStats Mixer::stats() const {
+  return {
+    active_voices_,
+    blocks_,
+    render_ns_ / 1000000.0
+  };
+}
+
+
+void Mixer::command(std::function<void ()> func) {
+  std::lock_guard<std::mutex> lock(command_mutex_);
+  commands_.push_back(std::move(func));
+}
+
+Mixer::Voice* Mixer::findVoice(const u_int id) {
+  auto it = std::find_if(std::begin(voices_), std::end(voices_),
+                         [id](const Voice& voice) { return voice.id == id; });
+  return (it != std::end(voices_)) ? &*it : nullptr;
+}
+
+
+// ブロックひとつぶんを処理して出力する
+void Mixer::renderBlock() {
+  auto start = std::chrono::steady_clock::now();
+
+  {
+    std::vector<std::function<void ()>> commands;
+    {
+      std::lock_guard<std::mutex> lock(command_mutex_);
+      commands.swap(commands_);
+    }
+    for (const auto& func : commands) {
+      func();
+    }
+  }
+
+  for (auto& bus : buses_) {
+    std::fill(std::begin(bus.left),  std::end(bus.left),  0.0f);
+    std::fill(std::begin(bus.right), std::end(bus.right), 0.0f);
+  }
+
+  voices_.erase(std::remove_if(std::begin(voices_), std::end(voices_),
+                               [this](Voice& voice) { return !mixVoice(voice); }),
+                std::end(voices_));
+
+  // バスごとにエフェクトを通してマスターに混ぜる
+  // TIPS:マスターは最後
+  for (size_t i = buses_.size(); i > 0; --i) {
+    auto& bus = buses_[i - 1];
+    for (auto& effect : bus.effects) {
+      effect->process(bus.left.data(), bus.right.data(), block_frames_);
+    }
+    if (i == 1) break;
+
+    auto& master = buses_[MASTER];
+    mixRamp(bus.left.data(),  bus.last_gain, bus.gain, block_frames_, master.left.data());
+    mixRamp(bus.right.data(), bus.last_gain, bus.gain, block_frames_, master.right.data());
+    bus.last_gain = bus.gain;
+  }
+
+  const auto& master = buses_[MASTER];
+  interleave(master.left.data(), master.right.data(), master.gain, block_frames_,
+             interleaved_.data());
+  output_->write(interleaved_.data(), block_frames_);
+  if (analyzer_) analyzer_->write(interleaved_.data(), block_frames_, rate_);
+
+  active_voices_ = u_int(voices_.size());
+  blocks_ += 1;
+  render_ns_ += u_long(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+// ボイスを展開してバスに混ぜる
+bool Mixer::mixVoice(Voice& voice) {
+  const MixerSound& sound = *voice.sound;
+  const int16_t* pcm = sound.data();
+  const u_int ch = sound.channel();
+  const size_t length = sound.frames();
+  if (!length) return false;
+
+  // 再生速度
+  double step = double(sound.sampleRate()) / rate_ * std::max(voice.pitch, 0.0f);
+
+  size_t frames = 0;
+  bool playing = true;
+  if ((step == 1.0) && (voice.pos == std::floor(voice.pos))) {
+    // 等速ならそのまま変換する
+    while (frames < block_frames_) {
+      size_t pos = size_t(voice.pos);
+      size_t count = std::min(block_frames_ - frames, length - pos);
+      toFloat(pcm + pos * ch, ch, count, &work_left_[frames], &work_right_[frames]);
+      frames    += count;
+      voice.pos += count;
+      if (size_t(voice.pos) == length) {
+        if (!voice.loop) {
+          playing = false;
+          break;
+        }
+        voice.pos = 0.0;
+      }
+    }
+  }
+  else {
+    // 線形補間
+    float* out[] = { work_left_.data(), work_right_.data() };
+    for (; frames < block_frames_; ++frames) {
+      size_t pos  = size_t(voice.pos);
+      size_t next = pos + 1;
+      if (next == length) next = voice.loop ? 0 : pos;
+      float frac = float(voice.pos - pos);
+      for (u_int c = 0; c < ch; ++c) {
+        float s0 = pcm[pos * ch + c];
+        float s1 = pcm[next * ch + c];
+        out[c][frames] = (s0 + (s1 - s0) * frac) * (1.0f / 32768.0f);
+      }
+
+      voice.pos += step;
+      if (voice.pos >= length) {
+        if (!voice.loop) {
+          playing = false;
+          ++frames;
+          break;
+        }
+        voice.pos = std::fmod(voice.pos, double(length));
+      }
+    }
+  }
+
+  // 再生しきったら残りは無音
+  std::fill(std::begin(work_left_) + frames, std::end(work_left_), 0.0f);
+  std::fill(std::begin(work_right_) + frames, std::end(work_right_), 0.0f);
+
+  // 左右の音量
+  // TIPS:モノラルは等パワーで振り分ける
+  float pan = std::min(std::max(voice.pan, -1.0f), 1.0f);
+  float left, right;
+  if (ch == 1) {
+    float angle = (pan + 1.0f) * 0.25f * 3.14159265f;
+    left  = voice.gain * std::cos(angle);
+    right = voice.gain * std::sin(angle);
+  }
+  else {
+    left  = voice.gain * std::min(1.0f - pan, 1.0f);
+    right = voice.gain * std::min(1.0f + pan, 1.0f);
+  }
+  if (!voice.started) {
+    voice.last_left  = left;
+    voice.last_right = right;
+    voice.started    = true;
+  }
+
+  auto& bus = buses_[voice.bus];
+  const float* source_right = (ch == 1) ? work_left_.data() : work_right_.data();
+  mixRamp(work_left_.data(), voice.last_left, left, block_frames_, bus.left.data());
+  mixRamp(source_right, voice.last_right, right, block_frames_, bus.right.data());
+  voice.last_left  = left;
+  voice.last_right = right;
+
+  return playing;
+}
+
+// std::threadによる処理
+void Mixer::proc() {
+  // TIPS:ブロックの半分の長さの間隔で様子を見る
+  auto interval = std::chrono::duration<double>(double(block_frames_) / rate_ * 0.5);
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (cv_.wait_for(lock, interval, [this]() { return finish_; })) break;
+    }
+
+    while (output_->available() >= block_frames_) {
+      renderBlock();
+    }
+  }
+}
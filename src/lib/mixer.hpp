@@ -0,0 +1,261 @@
+﻿
+#pragma once
+
+//
+// ソフトウェアミキサー
+// ボイスをfloatのバスで混ぜ、バスごとのエフェクトを通してから出力する
+//
+// TIPS:出力先はOpenAL(ストリーミングのソースひとつ)、WAVファイル、何もしない、から選べる
+//      process()で進めると、音を鳴らせない環境でも毎回同じ結果になる
+// NOTICE:OpenALOutputを使う時は、Audioより先に破棄すること
+//
+
+#include "defines.hpp"
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <cstdint>
+#include "audio.hpp"
+#include "mixerEffect.hpp"
+#include "audioAnalyzer.hpp"
+
+
+// ミキサーで鳴らす波形データ
+// TIPS:16bit PCMのままメモリに置いておく
+class MixerSound {
+  std::vector<int16_t> pcm_;
+  u_int ch_;
+  u_int rate_;
+  size_t frames_;
+
+
+public:
+  // WAVかOgg Vorbisを読み込む
+  explicit MixerSound(const std::string& path);
+
+  // 波形データから作る
+  // pcm モノラルか、左右交互に並んだステレオ
+  // ch  1か2(それ以外は例外を投げる)
+  MixerSound(std::vector<int16_t> pcm, const u_int ch, const u_int rate);
+
+  u_int channel() const;
+  u_int sampleRate() const;
+  size_t frames() const;
+  const int16_t* data() const;
+};
+
+
+// ミキサーの出力先
+class MixerOutput {
+public:
+  virtual ~MixerOutput() = default;
+
+  // 今書き込めるフレーム数
+  virtual size_t available() = 0;
+
+  // 書き込む
+  // samples 左右交互に並んだステレオ
+  virtual void write(const float* samples, const size_t frames) = 0;
+};
+
+
+// 何もしない出力
+// TIPS:書き込めるフレーム数は経過時間から決める
+class NullOutput : public MixerOutput {
+  u_int rate_;
+  size_t latency_;
+  std::chrono::steady_clock::time_point start_;
+  bool started_;
+  size_t written_;
+
+
+public:
+  // latency 先に書き込んでおけるフレーム数
+  NullOutput(const u_int rate, const size_t latency);
+
+  size_t available() override;
+  void write(const float* samples, const size_t frames) override;
+
+  // 書き込んだフレーム数
+  size_t written() const;
+};
+
+
+// WAVファイルへの出力
+// NOTICE:ファイルの長さは破棄する時に書き込まれる
+class WavOutput : public NullOutput {
+  std::ofstream fstr_;
+  std::vector<int16_t> pcm_;
+
+
+public:
+  WavOutput(const std::string& path, const u_int rate, const size_t latency);
+  ~WavOutput();
+
+  void write(const float* samples, const size_t frames) override;
+};
+
+
+// OpenALへの出力
+// TIPS:ソースひとつにバッファを積んでストリーミング再生する
+class OpenALOutput : public MixerOutput {
+  Source source_;
+  std::vector<Buffer> buffers_;
+  // まだ積んでいないバッファ
+  std::vector<ALuint> free_;
+
+  u_int rate_;
+  size_t buffer_frames_;
+  // バッファひとつぶんが溜まるまで書き込んだ波形
+  // TIPS:書き込むフレーム数がバッファより少なくても、バッファはいっぱいにしてから積む
+  std::vector<int16_t> pcm_;
+
+  u_int underruns_;
+  bool started_;
+
+
+public:
+  // buffer_frames バッファひとつぶんのフレーム数(1以上)
+  // buffer_num    バッファの数
+  OpenALOutput(const u_int rate, const size_t buffer_frames, const int buffer_num = 4);
+
+  size_t available() override;
+  void write(const float* samples, const size_t frames) override;
+
+  // 書き込みが間に合わず、再生が途切れた回数
+  u_int underruns() const;
+};
+
+
+// 負荷
+struct MixerStats {
+  // 再生中のボイス
+  u_int voices;
+  // 処理したブロック数
+  u_long blocks;
+  // 処理にかかった時間の合計(ミリ秒)
+  double render_ms;
+};
+
+
+class Mixer {
+  struct Voice;
+  struct Bus;
+
+  std::unique_ptr<MixerOutput> output_;
+  u_int rate_;
+  size_t block_frames_;
+
+  // TIPS:ボイスとバスは処理する側しか触らない
+  std::vector<Voice> voices_;
+  std::vector<Bus> buses_;
+
+  // ボイスを展開する作業領域
+  std::vector<float> work_left_;
+  std::vector<float> work_right_;
+  std::vector<float> interleaved_;
+
+  // 出力した波形の解析
+  std::shared_ptr<AudioAnalyzer> analyzer_;
+
+  // 処理する側への命令
+  // TIPS:ブロックの先頭でまとめて実行する
+  std::mutex command_mutex_;
+  std::vector<std::function<void ()>> commands_;
+
+  u_int next_id_;
+  int bus_num_;
+
+  std::atomic<u_int> active_voices_;
+  std::atomic<u_long> blocks_;
+  std::atomic<u_long> render_ns_;
+
+  // 処理スレッド
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool finish_;
+  std::thread thread_;
+
+
+public:
+  enum {
+    MASTER = 0,
+  };
+
+  // output       出力先
+  // rate         サンプリングレート
+  // block_frames 一度に処理するフレーム数(1以上)
+  Mixer(std::unique_ptr<MixerOutput> output, const u_int rate = 44100,
+        const size_t block_frames = 512);
+  ~Mixer();
+
+  // このクラスはコピー禁止
+  Mixer(const Mixer&) = delete;
+  Mixer& operator=(const Mixer&) = delete;
+
+
+  u_int sampleRate() const;
+
+  // バスを追加
+  // TIPS:バスはエフェクトを通してからマスターに混ぜられる
+  // 戻り値 バスの番号
+  int addBus(const float gain = 1.0f);
+
+  // バスの音量
+  void busGain(const int bus, const float gain);
+
+  // バスにエフェクトを追加(追加した順に処理される)
+  void addEffect(const int bus, std::unique_ptr<MixerEffect> effect);
+
+  // 出力する波形を解析する
+  // TIPS:nullptrで解析をやめる
+  void analyzer(const std::shared_ptr<AudioAnalyzer>& analyzer);
+
+  // 再生開始
+  // pan   -1.0(左)〜1.0(右)
+  // pitch 再生速度
+  // 戻り値 ボイスの識別子
+  u_int play(const std::shared_ptr<const MixerSound>& sound, const int bus = MASTER,
+             const float gain = 1.0f, const float pan = 0.0f, const float pitch = 1.0f,
+             const bool loop = false);
+
+  void stop(const u_int id);
+  void stopAll();
+
+  void gain(const u_int id, const float value);
+  void pan(const u_int id, const float value);
+  void pitch(const u_int id, const float value);
+
+  // 処理スレッドを開始
+  // TIPS:出力先が書き込めるようになるたびにブロックを処理する
+  void start();
+
+  // スレッドを使わずに、指定フレーム数ぶん処理する
+  // NOTICE:start()した後は使わないこと
+  void process(const size_t frames);
+
+  MixerStats stats() const;
+
+
+private:
+  void command(std::function<void ()> func);
+  Voice* findVoice(const u_int id);
+
+  // ブロックひとつぶんを処理して出力する
+  void renderBlock();
+
+  // ボイスを展開してバスに混ぜる
+  // 戻り値 再生が終わったらfalse
+  bool mixVoice(Voice& voice);
+
+  // std::threadによる処理
+  void proc();
+
+};
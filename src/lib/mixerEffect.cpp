@@ -0,0 +1,161 @@
+﻿
+//
+// ソフトウェアミキサーのエフェクト
+//
+
+#include "mixerEffect.hpp"
+#include <cmath>
+#include <algorithm>
+
+
+// 係数はRobert Bristow-Johnsonの "Audio EQ Cookbook" による
+BiquadFilter::BiquadFilter(const Type type, const u_int rate, const float frequency,
+                           const float q, const float gain_db) :
+  z_()
+{
+  const float pi = 3.14159265f;
+  float w0    = 2.0f * pi * std::min(frequency, rate * 0.49f) / rate;
+  float cos0  = std::cos(w0);
+  float alpha = std::sin(w0) / (2.0f * std::max(q, 0.01f));
+  float a     = std::pow(10.0f, gain_db / 40.0f);
+
+  float b0, b1, b2, a0, a1, a2;
+  switch (type) {
+  case LOWPASS:
+    b0 = (1.0f - cos0) * 0.5f;
+    b1 = 1.0f - cos0;
+    b2 = b0;
+    a0 = 1.0f + alpha;
+    a1 = -2.0f * cos0;
+    a2 = 1.0f - alpha;
+    break;
+
+  case HIGHPASS:
+    b0 = (1.0f + cos0) * 0.5f;
+    b1 = -(1.0f + cos0);
+    b2 = b0;
+    a0 = 1.0f + alpha;
+    a1 = -2.0f * cos0;
+    a2 = 1.0f - alpha;
+    break;
+
+  case BANDPASS:
+    b0 = alpha;
+    b1 = 0.0f;
+    b2 = -alpha;
+    a0 = 1.0f + alpha;
+    a1 = -2.0f * cos0;
+    a2 = 1.0f - alpha;
+    break;
+
+  default:
+    // PEAKING
+    b0 = 1.0f + alpha * a;
+    b1 = -2.0f * cos0;
+    b2 = 1.0f - alpha * a;
+    a0 = 1.0f + alpha / a;
+    a1 = -2.0f * cos0;
+    a2 = 1.0f - alpha / a;
+    break;
+  }
+
+  b0_ = b0 / a0;
+  b1_ = b1 / a0;
+  b2_ = b2 / a0;
+  a1_ = a1 / a0;
+  a2_ = a2 / a0;
+}
+
+void BiquadFilter::process(float* left, float* right, const size_t frames) {
+  // TIPS:前のサンプルの結果を使うのでSIMDにはできない
+  float* channels[] = { left, right };
+  for (int c = 0; c < 2; ++c) {
+    float* data = channels[c];
+    float z0 = z_[c][0];
+    float z1 = z_[c][1];
+    for (size_t i = 0; i < frames; ++i) {
+      float in  = data[i];
+      float out = b0_ * in + z0;
+      z0 = b1_ * in - a1_ * out + z1;
+      z1 = b2_ * in - a2_ * out;
+      data[i] = out;
+    }
+    z_[c][0] = z0;
+    z_[c][1] = z1;
+  }
+}
+
+
+Reverb::Reverb(const u_int rate, const float room, const float damping, const float wet) :
+  feedback_(0.7f + std::min(std::max(room, 0.0f), 1.0f) * 0.28f),
+  damping_(std::min(std::max(damping, 0.0f), 1.0f) * 0.4f),
+  wet_(wet)
+{
+  // 44.1kHzでのディレイの長さ(サンプル数)
+  // TIPS:左右で少しずらして広がりを出す
+  const int comb_length[COMB_NUM]       = { 1116, 1188, 1277, 1356 };
+  const int allpass_length[ALLPASS_NUM] = { 556, 441 };
+  const int spread = 23;
+
+  float scale = rate / 44100.0f;
+  for (int c = 0; c < 2; ++c) {
+    for (int i = 0; i < COMB_NUM; ++i) {
+      size_t length = std::max(size_t((comb_length[i] + spread * c) * scale), size_t(1));
+      comb_[c][i] = { std::vector<float>(length), 0, 0.0f };
+    }
+    for (int i = 0; i < ALLPASS_NUM; ++i) {
+      size_t length = std::max(size_t((allpass_length[i] + spread * c) * scale), size_t(1));
+      allpass_[c][i] = { std::vector<float>(length), 0, 0.0f };
+    }
+  }
+}
+
+void Reverb::process(float* left, float* right, const size_t frames) {
+  // TIPS:入力はモノラルにまとめて、左右別々に残響を作る
+  const float input_gain = 0.015f;
+
+  for (size_t i = 0; i < frames; ++i) {
+    float input = (left[i] + right[i]) * input_gain;
+    float* out[] = { &left[i], &right[i] };
+
+    for (int c = 0; c < 2; ++c) {
+      float acc = 0.0f;
+      for (auto& comb : comb_[c]) {
+        float delayed = comb.buffer[comb.pos];
+        comb.store = delayed * (1.0f - damping_) + comb.store * damping_;
+        comb.buffer[comb.pos] = input + comb.store * feedback_;
+        if (++comb.pos == comb.buffer.size()) comb.pos = 0;
+        acc += delayed;
+      }
+
+      for (auto& allpass : allpass_[c]) {
+        float delayed = allpass.buffer[allpass.pos];
+        allpass.buffer[allpass.pos] = acc + delayed * 0.5f;
+        if (++allpass.pos == allpass.buffer.size()) allpass.pos = 0;
+        acc = delayed - acc;
+      }
+
+      *out[c] += acc * wet_;
+    }
+  }
+}
+
+
+Limiter::Limiter(const u_int rate, const float threshold, const float release_ms) :
+  threshold_(threshold),
+  release_(1.0f - std::exp(-1.0f / (std::max(release_ms, 0.1f) * 0.001f * rate))),
+  gain_(1.0f)
+{}
+
+void Limiter::process(float* left, float* right, const size_t frames) {
+  for (size_t i = 0; i < frames; ++i) {
+    float peak = std::max(std::fabs(left[i]), std::fabs(right[i]));
+    float target = (peak > threshold_) ? threshold_ / peak : 1.0f;
+
+    // 超える時はすぐに下げる
+    gain_ = (target < gain_) ? target : gain_ + (target - gain_) * release_;
+
+    left[i]  *= gain_;
+    right[i] *= gain_;
+  }
+}
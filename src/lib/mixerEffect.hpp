@@ -0,0 +1,97 @@
+﻿
+#pragma once
+
+//
+// ソフトウェアミキサーのエフェクト
+// バスごとに並べて、左右のfloatの波形をその場で書き換える
+//
+
+#include "defines.hpp"
+#include <vector>
+
+
+class MixerEffect {
+public:
+  virtual ~MixerEffect() = default;
+
+  // left, right の内容を書き換える
+  virtual void process(float* left, float* right, const size_t frames) = 0;
+};
+
+
+// 双二次フィルタ
+class BiquadFilter : public MixerEffect {
+public:
+  enum Type {
+    LOWPASS,
+    HIGHPASS,
+    BANDPASS,
+    PEAKING,
+  };
+
+  // rate      サンプリングレート
+  // frequency 中心(カットオフ)周波数
+  // gain_db   PEAKINGの増幅量
+  BiquadFilter(const Type type, const u_int rate, const float frequency,
+               const float q = 0.7071f, const float gain_db = 0.0f);
+
+  void process(float* left, float* right, const size_t frames) override;
+
+
+private:
+  float b0_, b1_, b2_;
+  float a1_, a2_;
+
+  // 左右それぞれの状態(Transposed Direct Form II)
+  float z_[2][2];
+};
+
+
+// 簡易リバーブ
+// TIPS:Freeverbと同じく、並列のコムフィルタ4本と直列のオールパスフィルタ2本
+class Reverb : public MixerEffect {
+  struct Delay {
+    std::vector<float> buffer;
+    size_t pos;
+    // コムフィルタの減衰に使う
+    float store;
+  };
+
+  enum {
+    COMB_NUM    = 4,
+    ALLPASS_NUM = 2,
+  };
+  Delay comb_[2][COMB_NUM];
+  Delay allpass_[2][ALLPASS_NUM];
+
+  float feedback_;
+  float damping_;
+  float wet_;
+
+
+public:
+  // room    残響の長さ [0.0, 1.0]
+  // damping 高域の減衰 [0.0, 1.0]
+  // wet     残響の音量
+  Reverb(const u_int rate, const float room = 0.8f, const float damping = 0.3f,
+         const float wet = 0.25f);
+
+  void process(float* left, float* right, const size_t frames) override;
+};
+
+
+// リミッター
+// TIPS:瞬時に下げて、ゆっくり戻す
+class Limiter : public MixerEffect {
+  float threshold_;
+  float release_;
+  float gain_;
+
+
+public:
+  // threshold  これを超えないように音量を下げる
+  // release_ms 元の音量に戻るまでの時間
+  Limiter(const u_int rate, const float threshold = 0.95f, const float release_ms = 50.0f);
+
+  void process(float* left, float* right, const size_t frames) override;
+};
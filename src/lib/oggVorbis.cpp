@@ -0,0 +1,116 @@
+﻿
+//
+// Ogg Vorbisの展開
+//
+
+#include "oggVorbis.hpp"
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+
+#if __has_include(<stb_vorbis.c>)
+#define HAS_STB_VORBIS
+#include <stb_vorbis.c>
+#endif
+
+
+#if defined (HAS_STB_VORBIS)
+
+OggVorbis::OggVorbis(const std::string& path) {
+  DOUT << "OggVorbis()" << std::endl;
+
+  int error = 0;
+  handle_ = stb_vorbis_open_filename(path.c_str(), &error, nullptr);
+  if (!handle_) {
+    DOUT << "Can't open: " << path << " error:" << error << std::endl;
+    throw "Can't open Ogg Vorbis file.";
+  }
+
+  stb_vorbis_info info = stb_vorbis_get_info(handle_);
+  ch_          = u_int(info.channels);
+  sample_rate_ = info.sample_rate;
+  frames_      = stb_vorbis_stream_length_in_samples(handle_);
+
+  // TIPS:OpenALはモノラルとステレオしか扱えない
+  if ((ch_ != 1) && (ch_ != 2)) {
+    stb_vorbis_close(handle_);
+    DOUT << "Ogg Vorbis channel error. " << ch_ << " : " << path << std::endl;
+    throw "Ogg Vorbis channel error.";
+  }
+}
+
+OggVorbis::~OggVorbis() {
+  DOUT << "~OggVorbis()" << std::endl;
+
+  stb_vorbis_close(handle_);
+}
+
+// 16bit PCMに展開する
+size_t OggVorbis::read(int16_t* out, const size_t frames) {
+  size_t total = 0;
+  while (total < frames) {
+    int num = stb_vorbis_get_samples_short_interleaved(handle_, int(ch_),
+                                                       out + total * ch_, int((frames - total) * ch_));
+    if (num <= 0) break;
+    total += num;
+  }
+  return total;
+}
+
+// 先頭に戻す
+void OggVorbis::rewind() {
+  stb_vorbis_seek_start(handle_);
+}
+
+// 指定したサンプルの位置に移動する
+void OggVorbis::seek(const size_t frame) {
+  if (!stb_vorbis_seek(handle_, u_int(std::min(frame, frames_)))) {
+    DOUT << "OggVorbis seek error: " << frame << std::endl;
+  }
+}
+
+// Ogg Vorbisを扱えるならtrue
+bool OggVorbis::isSupported() { return true; }
+
+#else
+
+// NOTICE:stb_vorbisが無い場合は読み込もうとすると例外を投げる
+OggVorbis::OggVorbis(const std::string& path) :
+  handle_(nullptr),
+  ch_(0),
+  sample_rate_(0),
+  frames_(0)
+{
+  DOUT << "Ogg Vorbis isn't supported: " << path << std::endl;
+  throw "Ogg Vorbis isn't supported.";
+}
+
+OggVorbis::~OggVorbis() {}
+
+size_t OggVorbis::read(int16_t*, const size_t) { return 0; }
+void OggVorbis::rewind() {}
+void OggVorbis::seek(const size_t) {}
+
+bool OggVorbis::isSupported() { return false; }
+
+#endif
+
+
+// チャンネル数
+u_int OggVorbis::channel() const { return ch_; }
+
+// サンプリングレート
+u_int OggVorbis::sampleRate() const { return sample_rate_; }
+
+// 全体のサンプル数(1チャンネルあたり)
+size_t OggVorbis::frames() const { return frames_; }
+
+
+// ファイルがOgg形式ならtrue
+bool OggVorbis::isOggFile(const std::string& path) {
+  std::ifstream fstr(path, std::ios::binary);
+  char header[4] = {};
+  fstr.read(header, 4);
+  return fstr && !std::strncmp(header, "OggS", 4);
+}
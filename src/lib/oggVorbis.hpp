@@ -0,0 +1,62 @@
+﻿
+#pragma once
+
+//
+// Ogg Vorbisの展開
+// TIPS:stb_vorbis.c を include/ に置くと有効になる
+// NOTICE:stb_vorbis.c は同梱していない。置いていなければ、Ogg Vorbisのファイルは読み込み時に例外を投げる
+//
+
+#include "defines.hpp"
+#include <string>
+#include <cstdint>
+
+
+struct stb_vorbis;
+
+class OggVorbis {
+  stb_vorbis* handle_;
+
+  u_int ch_;
+  u_int sample_rate_;
+  size_t frames_;
+
+
+public:
+  explicit OggVorbis(const std::string& path);
+  ~OggVorbis();
+
+  // このクラスはコピー禁止
+  OggVorbis(const OggVorbis&) = delete;
+  OggVorbis& operator=(const OggVorbis&) = delete;
+
+
+  // チャンネル数
+  u_int channel() const;
+
+  // サンプリングレート
+  u_int sampleRate() const;
+
+  // 全体のサンプル数(1チャンネルあたり)
+  size_t frames() const;
+
+  // 16bit PCMに展開する
+  // out    展開先(frames * channel() 個ぶんの領域)
+  // frames 展開するサンプル数(1チャンネルあたり)
+  // 戻り値 展開したサンプル数(1チャンネルあたり)
+  size_t read(int16_t* out, const size_t frames);
+
+  // 先頭に戻す
+  void rewind();
+
+  // 指定したサンプル(1チャンネルあたり)の位置に移動する
+  // TIPS:サンプル単位で正確に移動する
+  void seek(const size_t frame);
+
+
+  // Ogg Vorbisを扱えるならtrue
+  static bool isSupported();
+
+  // ファイルがOgg形式ならtrue
+  static bool isOggFile(const std::string& path);
+};
@@ -0,0 +1,275 @@
+﻿
+//
+// 波形データの変換
+//
+
+#include "sampleConvert.hpp"
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define USE_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define USE_NEON
+#include <arm_neon.h>
+#endif
+
+
+namespace {
+
+// 8bit 符号なし
+void convertUint8(const u_char* src, const size_t samples, int16_t* out) {
+  size_t i = 0;
+#if defined(USE_SSE2)
+  const __m128i bias = _mm_set1_epi8(char(0x80));
+  const __m128i zero = _mm_setzero_si128();
+  for (; (i + 16) <= samples; i += 16) {
+    __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), bias);
+    // TIPS:下位に0を詰めると256倍になる
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),     _mm_unpacklo_epi8(zero, v));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 8), _mm_unpackhi_epi8(zero, v));
+  }
+#elif defined(USE_NEON)
+  const uint8x16_t bias = vdupq_n_u8(0x80);
+  for (; (i + 16) <= samples; i += 16) {
+    uint8x16_t v = veorq_u8(vld1q_u8(src + i), bias);
+    vst1q_s16(out + i,     vreinterpretq_s16_u16(vshll_n_u8(vget_low_u8(v), 8)));
+    vst1q_s16(out + i + 8, vreinterpretq_s16_u16(vshll_n_u8(vget_high_u8(v), 8)));
+  }
+#endif
+  for (; i < samples; ++i) {
+    out[i] = int16_t((int(src[i]) - 128) * 256);
+  }
+}
+
+// 24bit 符号付き
+// TIPS:下位8bitを捨てる
+void convertInt24(const u_char* src, const size_t samples, int16_t* out) {
+  size_t i = 0;
+  // TIPS:SSE2にはバイト単位の並べ替えがなく、普通に書いた方が速い
+#if defined(USE_NEON)
+  for (; (i + 16) <= samples; i += 16) {
+    uint8x16x3_t v = vld3q_u8(src + i * 3);
+    uint8x16x2_t hi = { { v.val[1], v.val[2] } };
+    vst2q_u8(reinterpret_cast<uint8_t*>(out + i), hi);
+  }
+#endif
+  for (; i < samples; ++i) {
+    const u_char* p = src + i * 3;
+    out[i] = int16_t(p[1] | (p[2] << 8));
+  }
+}
+
+// 32bit 符号付き
+void convertInt32(const u_char* src, const size_t samples, int16_t* out) {
+  size_t i = 0;
+#if defined(USE_SSE2)
+  for (; (i + 8) <= samples; i += 8) {
+    __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+    __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4 + 16));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                     _mm_packs_epi32(_mm_srai_epi32(lo, 16), _mm_srai_epi32(hi, 16)));
+  }
+#elif defined(USE_NEON)
+  for (; (i + 8) <= samples; i += 8) {
+    int32x4_t lo = vreinterpretq_s32_u8(vld1q_u8(src + i * 4));
+    int32x4_t hi = vreinterpretq_s32_u8(vld1q_u8(src + i * 4 + 16));
+    vst1q_s16(out + i, vcombine_s16(vshrn_n_s32(lo, 16), vshrn_n_s32(hi, 16)));
+  }
+#endif
+  for (; i < samples; ++i) {
+    int32_t value;
+    std::memcpy(&value, src + i * 4, sizeof(value));
+    out[i] = int16_t(value >> 16);
+  }
+}
+
+// 32bit 浮動小数点
+// NOTICE:範囲外の値は-1.0〜1.0に丸める
+void convertFloat32(const u_char* src, const size_t samples, int16_t* out) {
+  size_t i = 0;
+#if defined(USE_SSE2)
+  const __m128 scale = _mm_set1_ps(32767.0f);
+  const __m128 upper = _mm_set1_ps(1.0f);
+  const __m128 lower = _mm_set1_ps(-1.0f);
+  for (; (i + 8) <= samples; i += 8) {
+    __m128 lo = _mm_loadu_ps(reinterpret_cast<const float*>(src + i * 4));
+    __m128 hi = _mm_loadu_ps(reinterpret_cast<const float*>(src + i * 4 + 16));
+    lo = _mm_mul_ps(_mm_max_ps(_mm_min_ps(lo, upper), lower), scale);
+    hi = _mm_mul_ps(_mm_max_ps(_mm_min_ps(hi, upper), lower), scale);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                     _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi)));
+  }
+#elif defined(USE_NEON) && defined(__aarch64__)
+  const float32x4_t scale = vdupq_n_f32(32767.0f);
+  const float32x4_t upper = vdupq_n_f32(1.0f);
+  const float32x4_t lower = vdupq_n_f32(-1.0f);
+  for (; (i + 8) <= samples; i += 8) {
+    float32x4_t lo = vreinterpretq_f32_u8(vld1q_u8(src + i * 4));
+    float32x4_t hi = vreinterpretq_f32_u8(vld1q_u8(src + i * 4 + 16));
+    lo = vmulq_f32(vmaxq_f32(vminq_f32(lo, upper), lower), scale);
+    hi = vmulq_f32(vmaxq_f32(vminq_f32(hi, upper), lower), scale);
+    vst1q_s16(out + i, vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(lo)), vqmovn_s32(vcvtnq_s32_f32(hi))));
+  }
+#endif
+  for (; i < samples; ++i) {
+    float value;
+    std::memcpy(&value, src + i * 4, sizeof(value));
+    // TIPS:SSE2と同じく、NaNは1.0になる
+    value = (value <  1.0f) ? value :  1.0f;
+    value = (value > -1.0f) ? value : -1.0f;
+    out[i] = int16_t(std::lrint(value * 32767.0f));
+  }
+}
+
+
+// ステレオをモノラルにまとめる
+void foldStereo(const int16_t* src, const size_t frames, int16_t* out) {
+  size_t i = 0;
+#if defined(USE_SSE2)
+  const __m128i one = _mm_set1_epi16(1);
+  for (; (i + 8) <= frames; i += 8) {
+    // TIPS:左右を足して32bitにしてから半分にする
+    __m128i lo = _mm_madd_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2)), one);
+    __m128i hi = _mm_madd_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2 + 8)), one);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                     _mm_packs_epi32(_mm_srai_epi32(lo, 1), _mm_srai_epi32(hi, 1)));
+  }
+#elif defined(USE_NEON)
+  for (; (i + 8) <= frames; i += 8) {
+    int16x8x2_t v = vld2q_s16(src + i * 2);
+    vst1q_s16(out + i, vhaddq_s16(v.val[0], v.val[1]));
+  }
+#endif
+  for (; i < frames; ++i) {
+    out[i] = int16_t((src[i * 2] + src[i * 2 + 1]) >> 1);
+  }
+}
+
+
+// スピーカーの配置ごとの左右の音量
+// TIPS:WAVE_FORMAT_EXTENSIBLEのdwChannelMaskのビット順
+const float speaker_gain[][2] = {
+  { 1.0f,   0.0f   },        // FRONT_LEFT
+  { 0.0f,   1.0f   },        // FRONT_RIGHT
+  { 0.707f, 0.707f },        // FRONT_CENTER
+  { 0.0f,   0.0f   },        // LOW_FREQUENCY
+  { 0.707f, 0.0f   },        // BACK_LEFT
+  { 0.0f,   0.707f },        // BACK_RIGHT
+  { 1.0f,   0.0f   },        // FRONT_LEFT_OF_CENTER
+  { 0.0f,   1.0f   },        // FRONT_RIGHT_OF_CENTER
+  { 0.5f,   0.5f   },        // BACK_CENTER
+  { 0.707f, 0.0f   },        // SIDE_LEFT
+  { 0.0f,   0.707f },        // SIDE_RIGHT
+};
+
+// 3チャンネル以上を振り分ける
+void foldSpeakers(const int16_t* src, const u_int ch, u_int channel_mask,
+                  const size_t frames, const u_int out_ch, int16_t* out) {
+  enum {
+    MAX_CHANNELS = 32,
+    GAIN_SHIFT   = 14,
+  };
+
+  // ビットの数がチャンネル数と合わなければ標準の並びとみなす
+  u_int bits = 0;
+  for (u_int m = channel_mask; m; m &= m - 1) bits += 1;
+  if ((bits != ch) || (ch > MAX_CHANNELS)) {
+    channel_mask = (ch < MAX_CHANNELS) ? ((1u << ch) - 1) : ~0u;
+  }
+
+  float gain[MAX_CHANNELS][2] = {};
+  float total[2] = {};
+  u_int c = 0;
+  for (u_int bit = 0; (bit < MAX_CHANNELS) && (c < ch); ++bit) {
+    if (!(channel_mask & (1u << bit))) continue;
+
+    const u_int speakers = sizeof(speaker_gain) / sizeof(speaker_gain[0]);
+    // TIPS:上方のスピーカーなどは真ん中に置く
+    gain[c][0] = (bit < speakers) ? speaker_gain[bit][0] : 0.5f;
+    gain[c][1] = (bit < speakers) ? speaker_gain[bit][1] : 0.5f;
+    if (out_ch == 1) {
+      gain[c][0] = (gain[c][0] + gain[c][1]) * 0.5f;
+    }
+    total[0] += gain[c][0];
+    total[1] += gain[c][1];
+    c += 1;
+  }
+
+  // 音が割れないように、全部鳴った時に1.0になるよう揃える
+  float normalize = std::max(total[0], (out_ch == 1) ? 0.0f : total[1]);
+  if (normalize <= 0.0f) normalize = 1.0f;
+
+  // TIPS:整数で計算する
+  int fixed_gain[MAX_CHANNELS][2];
+  for (u_int i = 0; i < ch; ++i) {
+    fixed_gain[i][0] = int(gain[i][0] / normalize * (1 << GAIN_SHIFT) + 0.5f);
+    fixed_gain[i][1] = int(gain[i][1] / normalize * (1 << GAIN_SHIFT) + 0.5f);
+  }
+
+  for (size_t f = 0; f < frames; ++f, src += ch, out += out_ch) {
+    for (u_int o = 0; o < out_ch; ++o) {
+      int value = 0;
+      for (u_int i = 0; i < ch; ++i) {
+        value += src[i] * fixed_gain[i][o];
+      }
+      out[o] = int16_t(std::min(std::max(value >> GAIN_SHIFT, -32768), 32767));
+    }
+  }
+}
+
+}
+
+
+// 1サンプルのバイト数
+u_int sampleBytes(const SampleFormat format) {
+  switch (format) {
+  case SampleFormat::UINT8:   return 1;
+  case SampleFormat::INT16:   return 2;
+  case SampleFormat::INT24:   return 3;
+  case SampleFormat::INT32:   return 4;
+  case SampleFormat::FLOAT32: return 4;
+  }
+  return 0;
+}
+
+// 16bit PCMに変換する
+void convertSamples(const SampleFormat format, const void* src, const size_t samples,
+                    int16_t* out) {
+  const u_char* ptr = static_cast<const u_char*>(src);
+
+  switch (format) {
+  case SampleFormat::UINT8:
+    convertUint8(ptr, samples, out);
+    break;
+
+  case SampleFormat::INT16:
+    std::memcpy(out, ptr, samples * sizeof(int16_t));
+    break;
+
+  case SampleFormat::INT24:
+    convertInt24(ptr, samples, out);
+    break;
+
+  case SampleFormat::INT32:
+    convertInt32(ptr, samples, out);
+    break;
+
+  case SampleFormat::FLOAT32:
+    convertFloat32(ptr, samples, out);
+    break;
+  }
+}
+
+// チャンネル数を減らす
+void foldChannels(const int16_t* src, const u_int ch, const u_int channel_mask,
+                  const size_t frames, const u_int out_ch, int16_t* out) {
+  if ((ch == 2) && (out_ch == 1)) {
+    foldStereo(src, frames, out);
+    return;
+  }
+
+  foldSpeakers(src, ch, channel_mask, frames, out_ch, out);
+}
@@ -0,0 +1,42 @@
+﻿
+#pragma once
+
+//
+// 波形データの変換
+// 8/24/32bitやfloatのPCMを16bit PCMにそろえ、チャンネル数をまとめる
+// TIPS:SSE2とNEONが使える環境ではSIMDで処理する
+//
+
+#include "defines.hpp"
+#include <cstddef>
+#include <cstdint>
+
+
+// サンプルの形式
+enum class SampleFormat {
+  UINT8,              // 8bit 符号なし
+  INT16,              // 16bit 符号付き
+  INT24,              // 24bit 符号付き(3バイト詰め)
+  INT32,              // 32bit 符号付き
+  FLOAT32,            // 32bit 浮動小数点(-1.0〜1.0)
+};
+
+// 1サンプルのバイト数
+u_int sampleBytes(const SampleFormat format);
+
+// 16bit PCMに変換する
+// src     変換元(アラインメントは揃っていなくてもよい)
+// samples サンプル数(フレーム数 * チャンネル数)
+// out     変換先(samples個ぶんの領域)
+void convertSamples(const SampleFormat format, const void* src, const size_t samples,
+                    int16_t* out);
+
+// チャンネル数を減らす
+// 3チャンネル以上はスピーカーの配置から左右に振り分ける
+// ch           変換元のチャンネル数
+// channel_mask スピーカーの配置(WAVE_FORMAT_EXTENSIBLE)。0なら標準の並び
+// frames       フレーム数
+// out_ch       変換後のチャンネル数(1か2。chより小さいこと)
+// out          変換先(frames * out_ch 個ぶんの領域)
+void foldChannels(const int16_t* src, const u_int ch, const u_int channel_mask,
+                  const size_t frames, const u_int out_ch, int16_t* out);
@@ -0,0 +1,246 @@
+﻿
+//
+// 使い捨てのサウンド再生
+//
+
+#include "soundPool.hpp"
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+
+
+SoundPool::SoundPool(const int num_sources, const float min_gain) :
+  origin_(std::chrono::steady_clock::now()),
+  sources_(num_sources),
+  source_voice_(num_sources, -1),
+  next_id_(0),
+  min_gain_(min_gain),
+  stats_()
+{
+  DOUT << "SoundPool()" << std::endl;
+}
+
+SoundPool::~SoundPool() {
+  DOUT << "~SoundPool()" << std::endl;
+
+  stopAll();
+}
+
+
+double SoundPool::now() const {
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - origin_;
+  return elapsed.count();
+}
+
+// リスナーに届く音量
+// TIPS:OpenALの既定値(AL_INVERSE_DISTANCE_CLAMPED、基準距離1、減衰率1)で計算している
+float SoundPool::audibility(const Voice& voice) const {
+  ALfloat listener[3];
+  alGetListenerfv(AL_POSITION, listener);
+  Vec3f d = voice.position - Vec3f(listener[0], listener[1], listener[2]);
+  float distance = std::max(std::sqrt(d.x * d.x + d.y * d.y + d.z * d.z), 1.0f);
+
+  return voice.gain / distance;
+}
+
+
+// 空いているSourceを探す
+int SoundPool::freeSource() const {
+  for (size_t i = 0; i < source_voice_.size(); ++i) {
+    if (source_voice_[i] < 0) return int(i);
+  }
+  return -1;
+}
+
+// 奪うSourceを探す
+// 優先度が低く、小さく聞こえ、古いものを選ぶ
+// 戻り値 奪えるSourceが無ければ -1
+int SoundPool::victimSource(const Voice& voice) const {
+  int victim = -1;
+  float victim_audibility = 0.0f;
+  for (size_t i = 0; i < source_voice_.size(); ++i) {
+    const Voice& v = voices_[source_voice_[i]];
+    float a = audibility(v);
+    if (victim >= 0) {
+      const Voice& w = voices_[source_voice_[victim]];
+      if (v.priority > w.priority) continue;
+      if (v.priority == w.priority) {
+        if (a > victim_audibility) continue;
+        if ((a == victim_audibility) && (v.start_time >= w.start_time)) continue;
+      }
+    }
+    victim = int(i);
+    victim_audibility = a;
+  }
+  if (victim < 0) return -1;
+
+  // 優先度が同じなら、より大きく聞こえる時だけ奪う
+  const Voice& w = voices_[source_voice_[victim]];
+  if (w.priority > voice.priority) return -1;
+  if ((w.priority == voice.priority) && (victim_audibility > audibility(voice))) return -1;
+
+  return victim;
+}
+
+// Sourceを割り当てて再生
+// time 再生開始位置(秒)
+void SoundPool::start(Voice& voice, const int source, const double time) {
+  const Source& s = sources_[source];
+  s.stop();
+  s.bindBuffer(*voice.buffer);
+  s.looping(false);
+  s.gain(voice.gain);
+  s.pitch(voice.pitch);
+  s.position(voice.position);
+  if (time > 0.0) s.seek(float(time));
+  s.play();
+
+  voice.source = source;
+}
+
+// Sourceを手放す
+void SoundPool::release(Voice& voice) {
+  if (voice.source < 0) return;
+
+  const Source& s = sources_[voice.source];
+  s.stop();
+  s.unbindBuffer();
+  source_voice_[voice.source] = -1;
+  voice.source = -1;
+}
+
+
+// 使い捨ての再生
+u_int SoundPool::playOneShot(const std::shared_ptr<Buffer>& buffer,
+                             const float gain, const float pitch,
+                             const Vec3f& position,
+                             const int priority) {
+  // 読み込み中のバッファは鳴らさない
+  if (!buffer->isReady()) return 0;
+
+  double time = now();
+
+  Voice voice = {
+    ++next_id_,
+    buffer,
+    gain,
+    pitch,
+    position,
+    priority,
+    time,
+    time + buffer->duration() / std::max(pitch, 0.0001f),
+    -1
+  };
+
+  int source = -1;
+  if (audibility(voice) >= min_gain_) {
+    source = freeSource();
+    if (source < 0) {
+      source = victimSource(voice);
+      if (source >= 0) {
+        // 奪われたボイスは仮想ボイスとして残す
+        Voice& victim = voices_[source_voice_[source]];
+        DOUT << "SoundPool stolen:" << victim.id << std::endl;
+        release(victim);
+        stats_.stolen += 1;
+      }
+    }
+  }
+
+  voices_.push_back(voice);
+  if (source >= 0) {
+    start(voices_.back(), source, 0.0);
+    source_voice_[source] = int(voices_.size() - 1);
+  }
+
+  return voice.id;
+}
+
+// 再生停止
+void SoundPool::stop(const u_int id) {
+  for (auto& voice : voices_) {
+    if (voice.id != id) continue;
+
+    release(voice);
+    // TIPS:次のupdate()で片付けられる
+    voice.end_time = 0.0;
+    break;
+  }
+}
+
+// すべて再生停止
+void SoundPool::stopAll() {
+  for (auto& voice : voices_) {
+    release(voice);
+  }
+  voices_.clear();
+}
+
+
+// 再生の終わったボイスを片付け、聞こえるようになった仮想ボイスにSourceを割り当てる
+void SoundPool::update() {
+  double time = now();
+
+  // 再生の終わったボイスを片付ける
+  for (auto& voice : voices_) {
+    bool finished = (voice.source >= 0) ? !sources_[voice.source].isPlaying()
+                                        : (time >= voice.end_time);
+    if (finished || (voice.end_time == 0.0)) {
+      release(voice);
+      voice.end_time = 0.0;
+    }
+  }
+  voices_.erase(std::remove_if(std::begin(voices_), std::end(voices_),
+                               [](const Voice& voice) { return voice.end_time == 0.0; }),
+                std::end(voices_));
+
+  // ボイスの並びが変わったので付け直す
+  std::fill(std::begin(source_voice_), std::end(source_voice_), -1);
+  for (size_t i = 0; i < voices_.size(); ++i) {
+    if (voices_[i].source >= 0) source_voice_[voices_[i].source] = int(i);
+  }
+
+  // 聞こえなくなったボイスのSourceを手放す
+  for (auto& voice : voices_) {
+    if ((voice.source >= 0) && (audibility(voice) < min_gain_)) release(voice);
+  }
+
+  // 聞こえる仮想ボイスを優先度の高い順に並べる
+  std::vector<int> candidates;
+  for (size_t i = 0; i < voices_.size(); ++i) {
+    const Voice& voice = voices_[i];
+    if ((voice.source < 0) && (audibility(voice) >= min_gain_)) {
+      candidates.push_back(int(i));
+    }
+  }
+  std::sort(std::begin(candidates), std::end(candidates),
+            [this](const int a, const int b) {
+              const Voice& va = voices_[a];
+              const Voice& vb = voices_[b];
+              if (va.priority != vb.priority) return va.priority > vb.priority;
+              return audibility(va) > audibility(vb);
+            });
+
+  // 空いているSourceで続きから再生する
+  // TIPS:ここでは奪わない(奪い合いを繰り返さないように)
+  for (int i : candidates) {
+    int source = freeSource();
+    if (source < 0) break;
+
+    Voice& voice = voices_[i];
+    start(voice, source, (time - voice.start_time) * voice.pitch);
+    source_voice_[source] = i;
+  }
+}
+
+// ボイス数
+SoundPoolStats SoundPool::stats() const {
+  SoundPoolStats stats = stats_;
+  stats.active = 0;
+  stats.virtual_voices = 0;
+  for (const auto& voice : voices_) {
+    if (voice.source >= 0) stats.active += 1;
+    else                   stats.virtual_voices += 1;
+  }
+  return stats;
+}
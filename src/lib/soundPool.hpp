@@ -0,0 +1,98 @@
+﻿
+#pragma once
+
+//
+// 使い捨てのサウンド再生
+// あらかじめ確保したSourceを使い回す
+//
+// NOTICE:毎フレーム update() を呼ぶこと
+//
+
+#include "defines.hpp"
+#include <vector>
+#include <memory>
+#include <chrono>
+#include "audio.hpp"
+#include "vector.hpp"
+
+
+// ボイス数
+struct SoundPoolStats {
+  // Sourceを割り当てて再生中
+  u_int active;
+  // 聞こえないのでSourceを持たずに時間だけ進めている
+  u_int virtual_voices;
+  // 他のサウンドにSourceを奪われた回数
+  u_int stolen;
+};
+
+
+class SoundPool {
+  struct Voice {
+    u_int id;
+    std::shared_ptr<Buffer> buffer;
+    float gain;
+    float pitch;
+    Vec3f position;
+    int priority;
+
+    // 再生開始と終了の時刻(秒)
+    double start_time;
+    double end_time;
+
+    // 割り当てたSource(-1 ならSourceを持たない)
+    int source;
+  };
+
+  std::chrono::steady_clock::time_point origin_;
+  std::vector<Source> sources_;
+  // Sourceを使っているボイス(-1 なら空き)
+  std::vector<int> source_voice_;
+  std::vector<Voice> voices_;
+  u_int next_id_;
+  float min_gain_;
+  SoundPoolStats stats_;
+
+  double now() const;
+  float audibility(const Voice& voice) const;
+
+  int freeSource() const;
+  int victimSource(const Voice& voice) const;
+  void start(Voice& voice, const int source, const double time);
+  void release(Voice& voice);
+
+
+public:
+  // num_sources 確保するSourceの数
+  // min_gain    これより小さく聞こえるサウンドはSourceを使わない
+  explicit SoundPool(const int num_sources = 32, const float min_gain = 0.01f);
+  ~SoundPool();
+
+  // このクラスはコピー禁止
+  SoundPool(const SoundPool&) = delete;
+  SoundPool& operator=(const SoundPool&) = delete;
+
+
+  // 使い捨ての再生
+  // Sourceが足りない時は、優先度が低く、小さく聞こえる、古いサウンドから奪う
+  // 奪えない時や聞こえない時は仮想ボイスとして時間だけ進める
+  // priority 優先度(大きい方が優先)
+  // 戻り値   ボイスの識別子(読み込み中のバッファは鳴らさず0を返す)
+  u_int playOneShot(const std::shared_ptr<Buffer>& buffer,
+                    const float gain = 1.0f, const float pitch = 1.0f,
+                    const Vec3f& position = Vec3f(0.0f, 0.0f, 0.0f),
+                    const int priority = 0);
+
+  // 再生停止
+  void stop(const u_int id);
+
+  // すべて再生停止
+  void stopAll();
+
+  // 再生の終わったボイスを片付け、聞こえるようになった仮想ボイスにSourceを割り当てる
+  void update();
+
+  // ボイス数
+  SoundPoolStats stats() const;
+
+};
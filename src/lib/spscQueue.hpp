@@ -0,0 +1,63 @@
+﻿
+#pragma once
+
+//
+// 1対1のスレッド間で使う固定長のキュー
+// TIPS:書き込むスレッドと読み出すスレッドがひとつずつなら、ロックしなくてよい
+//      書き込む側は末尾、読み出す側は先頭の位置だけを書き換える
+//
+// NOTICE:push() と pop() をそれぞれ別のひとつのスレッドからだけ呼ぶこと
+//
+
+#include "defines.hpp"
+#include <atomic>
+#include <utility>
+
+
+template <typename T, size_t N>
+class SpscQueue {
+  static_assert((N > 0) && ((N & (N - 1)) == 0), "N must be a power of 2.");
+
+  T items_[N];
+
+  // TIPS:別のスレッドが書き換える値は、キャッシュラインを分ける
+  alignas(64) std::atomic<size_t> head_;
+  alignas(64) std::atomic<size_t> tail_;
+
+
+public:
+  SpscQueue() :
+    head_(0),
+    tail_(0)
+  {}
+
+  // このクラスはコピー禁止
+  SpscQueue(const SpscQueue&) = delete;
+  SpscQueue& operator=(const SpscQueue&) = delete;
+
+
+  // 末尾に追加
+  // 戻り値 いっぱいで追加できなかったらfalse
+  bool push(T item) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if ((tail - head_.load(std::memory_order_acquire)) == N) return false;
+
+    items_[tail & (N - 1)] = std::move(item);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // 先頭から取り出す
+  // 戻り値 空ならfalse
+  bool pop(T& item) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) return false;
+
+    item = std::move(items_[head & (N - 1)]);
+    // TIPS:取り出した後の要素は空にしておく(shared_ptrなどを早く手放す)
+    items_[head & (N - 1)] = T();
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+};
@@ -4,33 +4,77 @@
 
 #include "streamWav.hpp"
 #include <iostream>
-
-
-StreamWav::StreamWav(const std::string& file) :
-  fstr_(file, std::ios::binary),
-  loop_(false)
+#include <cstring>
+#include <algorithm>
+#include "adpcm.hpp"
+
+
+StreamWav::StreamWav(const std::string& file, const bool mono) :
+  format_(Format::PCM),
+  file_(std::make_unique<MappedFile>(file)),
+  info(),
+  read_pos_(0),
+  sample_format_(SampleFormat::INT16),
+  out_ch_(0),
+  loop_(false),
+  loop_start_(0),
+  loop_end_(0),
+  position_(0),
+  block_index_(0),
+  block_pos_(0)
 {
   DOUT << "StreamWav()" << std::endl;
 
-  if (!fstr_) throw "Can't file open.";
+  if ((file_->size() >= 4) && !std::strncmp(file_->data(), "OggS", 4)) {
+    // Ogg Vorbisはファイルから少しずつ展開する
+    file_.reset();
+    ogg_ = std::make_unique<OggVorbis>(file);
+
+    format_          = Format::OGG_VORBIS;
+    info.ch          = ogg_->channel();
+    info.sample_rate = ogg_->sampleRate();
+    info.bit         = 16;
+    info.frames      = u_int(ogg_->frames());
+    info.size        = info.frames * info.ch * sizeof(int16_t);
+
+    out_ch_   = Wav::outputChannel(info, mono);
+    loop_end_ = info.frames;
+    return;
+  }
   
   // ファイル情報を解析
-  if (!Wav::analyzeWavFile(info, fstr_)) {
+  if (!Wav::analyzeWavFile(info, file_->data(), file_->size())) {
     return;
   }
 
-  if ((info.id != 1) || (info.bit != 16)) {
-    // IDが１で量子化ビット数が16以外は扱わない
+  if (!Wav::isSupported(info)) {
+    // PCMとIMA ADPCM以外は扱わない
     DOUT << "Wav format error. " << info.id << " " << info.bit << std::endl;
     return;
   }
 
-  last_size_ = info.size;
-  // データの先頭位置を覚えておく
-  top_pos_ = static_cast<size_t>(fstr_.tellg());
+  out_ch_ = Wav::outputChannel(info, mono);
+
+  // smplチャンクのループ範囲
+  if (info.loop_end > info.loop_start) {
+    loop_start_ = info.loop_start;
+    loop_end_   = info.loop_end;
+  }
+  else {
+    loop_end_ = info.frames;
+  }
+
+  if (Wav::isImaAdpcm(info)) {
+    format_ = Format::IMA_ADPCM;
+    block_pcm_.resize(imaAdpcmBlockFrames(info.block_size, info.ch) * info.ch);
+    block_pos_ = block_pcm_.size() * sizeof(int16_t);
+    return;
+  }
+
+  sample_format_ = Wav::sampleFormat(info);
 }
 
-bool StreamWav::isStereo() const { return info.ch == 2; }
+bool StreamWav::isStereo() const { return out_ch_ == 2; }
 
 u_int StreamWav::sampleRate() const { return info.sample_rate; }
   
@@ -38,44 +82,172 @@ void StreamWav::loop(const bool loop) {
   loop_ = loop;
 }
 
+// ループ範囲
+void StreamWav::loopRegion(const size_t start, const size_t end) {
+  // TIPS:範囲がおかしい時は全体をループする
+  size_t last = std::min(end, size_t(info.frames));
+  if (start < last) {
+    loop_start_ = start;
+    loop_end_   = last;
+  }
+  else {
+    DOUT << "StreamWav: invalid loop region " << start << "-" << end << std::endl;
+    loop_start_ = 0;
+    loop_end_   = info.frames;
+  }
+}
+
 // 再生位置を先頭に戻す
 void StreamWav::toTop() {
-  fstr_.seekg(top_pos_, fstr_.beg);
-  last_size_ = info.size;
+  seek(0);
 }
 
-bool StreamWav::isEnd() const { return last_size_ == 0; }
+// 再生位置をサンプル単位で変更する
+void StreamWav::seek(const size_t frame) {
+  position_ = std::min(frame, size_t(info.frames));
+
+  switch (format_) {
+  case Format::PCM:
+    read_pos_ = position_ * info.ch * sampleBytes(sample_format_);
+    break;
+
+  case Format::IMA_ADPCM:
+    {
+      // TIPS:含まれるブロックを展開して、途中から読む
+      const size_t block_frames = block_pcm_.size() / info.ch;
+      const size_t blocks       = info.size / info.block_size;
+      block_index_ = position_ / block_frames;
+      if (block_index_ < blocks) {
+        const u_char* adpcm = reinterpret_cast<const u_char*>(file_->data() + info.offset);
+        decodeImaAdpcmBlock(adpcm + block_index_ * info.block_size, info.block_size, info.ch,
+                            &block_pcm_[0]);
+        block_index_ += 1;
+        block_pos_ = (position_ % block_frames) * info.ch * sizeof(int16_t);
+      }
+      else {
+        block_index_ = blocks;
+        block_pos_   = block_pcm_.size() * sizeof(int16_t);
+      }
+    }
+    break;
+
+  case Format::OGG_VORBIS:
+    if (position_ < info.frames) ogg_->seek(position_);
+    break;
+  }
+}
+
+// 今の再生位置(サンプル数)
+size_t StreamWav::position() const { return position_; }
+
+// 全体のサンプル数
+size_t StreamWav::frames() const { return info.frames; }
+
+bool StreamWav::isEnd() const { return !loop_ && (position_ >= info.frames); }
 
 
 // 再生バッファにデータを読み込む
 size_t StreamWav::read(std::vector<char>& buffer) {
-  size_t remain_size = buffer.size();
-
-  // ループしない場合、残りの中途半端なサイズを読み込んで終了
-  if (!loop_ && (last_size_ < remain_size)) remain_size = last_size_;
+  const size_t frame_size = out_ch_ * sizeof(int16_t);
+  if (!frame_size) return 0;
 
-  size_t offset = 0;
-  size_t total_read_size = 0;
+  int16_t* out = reinterpret_cast<int16_t*>(&buffer[0]);
+  size_t remain_frames = buffer.size() / frame_size;
+  size_t total_frames  = 0;
+  bool wrapped = false;
 
   // ループ再生の場合はバッファを満たすまでデータを読み込む
-  while (remain_size > 0) {
-    size_t read_size = readData(buffer, offset, remain_size);
+  while (remain_frames > 0) {
+    size_t end = endFrame();
+    if (position_ >= end) {
+      // TIPS:ループの先頭に戻っても読めない時は諦める
+      if (!loop_ || wrapped) break;
+      seek(loop_start_);
+      wrapped = true;
+      continue;
+    }
+
+    size_t read_frames = readData(out + total_frames * out_ch_, std::min(remain_frames, end - position_));
+    // TIPS:データが壊れていて、読めなかった
+    if (!read_frames) break;
+
+    position_     += read_frames;
+    total_frames  += read_frames;
+    remain_frames -= read_frames;
+    wrapped = false;
+  }
+    
+  return total_frames * frame_size;
+}
 
-    total_read_size += read_size;
-    remain_size     -= read_size;
-    last_size_      -= read_size;
-    offset          += read_size;
 
-    if (loop_ && !last_size_) toTop();
+// 今の再生位置から読める最後の位置
+// TIPS:ループの終わりより後にシークした時は、最後まで再生してからループの先頭に戻る
+size_t StreamWav::endFrame() const {
+  return (loop_ && (position_ <= loop_end_)) ? loop_end_ : info.frames;
+}
+
+// ファイルから16bit PCMでデータを読み込む
+size_t StreamWav::readData(int16_t* out, const size_t frames) {
+  if (out_ch_ != info.ch) {
+    // 展開してからチャンネル数を減らす
+    fold_pcm_.resize(frames * info.ch);
+    size_t read_frames = decode(fold_pcm_.data(), frames);
+    foldChannels(fold_pcm_.data(), info.ch, info.channel_mask, read_frames, out_ch_, out);
+    return read_frames;
   }
-    
-  return total_read_size;
+
+  return decode(out, frames);
+}
+
+// 16bit PCMにして読み込む
+size_t StreamWav::decode(int16_t* out, const size_t frames) {
+  switch (format_) {
+  case Format::PCM:
+    {
+      // TIPS:16bit以外は読み込むたびに変換する
+      size_t frame_bytes = info.ch * sampleBytes(sample_format_);
+      size_t read_frames = std::min(frames, (info.size - read_pos_) / frame_bytes);
+      convertSamples(sample_format_, file_->data() + info.offset + read_pos_,
+                     read_frames * info.ch, out);
+      read_pos_ += read_frames * frame_bytes;
+      return read_frames;
+    }
+
+  case Format::IMA_ADPCM:
+    return decodeAdpcm(out, frames);
+
+  case Format::OGG_VORBIS:
+    return ogg_->read(out, frames);
+  }
+
+  return 0;
 }
 
+// IMA ADPCMを展開して読み込む
+size_t StreamWav::decodeAdpcm(int16_t* out, const size_t frames) {
+  const size_t block_bytes = block_pcm_.size() * sizeof(int16_t);
+  const size_t blocks      = info.size / info.block_size;
+  const u_char* adpcm      = reinterpret_cast<const u_char*>(file_->data() + info.offset);
+
+  const size_t size = frames * info.ch * sizeof(int16_t);
+  size_t read_size = 0;
+  while (read_size < size) {
+    if (block_pos_ == block_bytes) {
+      // 次のブロックを展開
+      if (block_index_ == blocks) break;
+      decodeImaAdpcmBlock(adpcm + block_index_ * info.block_size, info.block_size, info.ch,
+                          &block_pcm_[0]);
+      block_index_ += 1;
+      block_pos_ = 0;
+    }
+
+    size_t copy_size = std::min(size - read_size, block_bytes - block_pos_);
+    std::memcpy(reinterpret_cast<char*>(out) + read_size,
+                reinterpret_cast<const char*>(&block_pcm_[0]) + block_pos_, copy_size);
+    read_size  += copy_size;
+    block_pos_ += copy_size;
+  }
 
-// ファイルからバッファへデータを読み込む
-size_t StreamWav::readData(std::vector<char>& buffer, const size_t offset, const size_t size) {
-  size_t read_size = (size < last_size_) ? size : last_size_;
-  fstr_.read(&buffer[offset], read_size);
-  return read_size;
+  return read_size / (info.ch * sizeof(int16_t));
 }
@@ -2,45 +2,102 @@
 
 //
 // Wavのストリーミング再生
+// TIPS:IMA ADPCMとOgg Vorbisも扱える(どちらも16bit PCMに展開して読み込む)
+//      16bit以外のPCMや3チャンネル以上も、読み込むたびに変換する
 //
 
 #include "defines.hpp"
 #include <string>
-#include <fstream>
 #include <vector>
+#include <memory>
+#include <cstdint>
 #include "wav.hpp"
+#include "oggVorbis.hpp"
+#include "mappedFile.hpp"
 
 
 class StreamWav {
 public:
-  explicit StreamWav(const std::string& file);
+  // mono trueならモノラルにまとめる
+  explicit StreamWav(const std::string& file, const bool mono = false);
   
   bool isStereo() const;
   u_int sampleRate() const;
   
   void loop(const bool loop);
 
+  // ループ範囲(サンプル数、endは含まない)
+  // TIPS:ループ再生では、先頭からendまで再生した後はstartからendを繰り返す(イントロ付きのループ)
+  //      WAVのsmplチャンクにループ範囲があれば、最初からそれが使われる
+  void loopRegion(const size_t start, const size_t end);
+
   // 再生位置を先頭に戻す
   void toTop();
 
+  // 再生位置をサンプル単位で変更する
+  void seek(const size_t frame);
+
+  // 今の再生位置(サンプル数)
+  size_t position() const;
+
+  // 全体のサンプル数(1チャンネルあたり)
+  size_t frames() const;
+
   bool isEnd() const;
   
   // 再生バッファにデータを読み込む
+  // TIPS:ループの終わりに来たら、同じバッファの中でループの先頭へつなぐ
   size_t read(std::vector<char>& buffer);
 
   
 private:
-  std::ifstream fstr_;
+  enum class Format {
+    PCM,
+    IMA_ADPCM,
+    OGG_VORBIS,
+  };
+  Format format_;
+
+  // TIPS:ファイルはメモリに割り当てて、必要なところだけ読み込まれるようにする
+  std::unique_ptr<MappedFile> file_;
 
   Wav::Info info;
-  size_t top_pos_;
+  size_t read_pos_;
+
+  // PCMのサンプルの形式
+  SampleFormat sample_format_;
+  // 再生時のチャンネル数
+  u_int out_ch_;
+  // チャンネル数を減らす前のデータ
+  std::vector<int16_t> fold_pcm_;
 
   bool loop_;
+  size_t loop_start_;
+  size_t loop_end_;
 
-  size_t last_size_;
+  // 再生位置(サンプル数)
+  size_t position_;
+
+  // IMA ADPCMは圧縮したまま、ブロックごとに展開する
+  size_t block_index_;
+  std::vector<int16_t> block_pcm_;
+  size_t block_pos_;
+
+  std::unique_ptr<OggVorbis> ogg_;
 
   
-  // ファイルからバッファへデータを読み込む
-  size_t readData(std::vector<char>& buffer, const size_t offset, const size_t size);
+  // 今の再生位置から読める最後の位置
+  size_t endFrame() const;
+
+  // ファイルから16bit PCMでデータを読み込む
+  // 戻り値 読み込んだフレーム数
+  size_t readData(int16_t* out, const size_t frames);
+
+  // 16bit PCMにして読み込む
+  // 戻り値 読み込んだフレーム数
+  size_t decode(int16_t* out, const size_t frames);
+
+  // IMA ADPCMを展開して読み込む
+  size_t decodeAdpcm(int16_t* out, const size_t frames);
   
 };
@@ -4,113 +4,716 @@
 //
 
 #include "streaming.hpp"
+#include "spscQueue.hpp"
 #include <iostream>
+#include <cmath>
+#include <algorithm>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include <chrono>
+#include <deque>
+#include <numeric>
 
 
-// FIXME:読み込みバッファを引数で渡している
-void Streaming::queueStream(StreamWav& stream, Source& source, Buffer& buffer,
-                            std::vector<char>& sound_buffer) {
-  size_t length = stream.read(sound_buffer);
-  buffer.bind(stream.isStereo(), &sound_buffer[0], static_cast<u_int>(length), stream.sampleRate());
-  source.queueBuffer(buffer);
-}
-  
-// std::threadによる再生
-void Streaming::streamProc(const std::string path, const bool loop,
-                           std::shared_ptr<Source> source, std::shared_ptr<Param> param) {
-  StreamWav stream(path);
-  stream.loop(loop);
-    
-  Buffer buffer[BUFFER_NUM];
+// ゲーム側からの命令
+struct Streaming::Command {
+  enum Type {
+    PLAY,
+    PAUSE,
+    STOP,
+    GAIN,
+    SEEK,
+    LOOP_REGION,
+    ANALYZER,
+  };
+  Type type;
+
+  // 音量、シークする位置(秒)
+  double value;
+  // 音量を変える時間(秒)
+  float sec;
+  // ループ範囲
+  size_t start;
+  size_t end;
+  std::shared_ptr<AudioAnalyzer> analyzer;
+};
+
+// 再生スレッドと共有する状態
+struct Streaming::Stream {
+  typedef std::chrono::steady_clock Clock;
+
+  // 再生スレッドが公開する状態
+  enum State {
+    STARTING,
+    PLAYING,
+    PAUSED,
+    FINISHED,
+  };
+
+  std::string path;
+  bool loop;
+  int buffer_num;
+  int buffer_ms;
+
+  Source source;
+
+  // TIPS:ゲーム側は積むだけで、再生スレッドが取り出して実行する
+  SpscQueue<Command, 64> commands;
+
+  // 以下は再生スレッドだけが使う
+  std::vector<Buffer> buffers;
+  std::vector<char> sound_buffer;
+  float buffer_sec;
+  // キューに積んだバッファの長さ(秒)
+  std::deque<double> queued_sec;
+  bool paused;
+
+  // 音量の変化
+  float gain;
+  float gain_from;
+  float gain_to;
+  Clock::time_point ramp_start;
+  float ramp_sec;
+  bool ramping;
+  // 音量を下げきったら止める
+  bool stopping;
+
+  // まだ処理していないシークとループ範囲
+  // TIPS:先読み中は wav を触れないので、後で処理する
+  double seek_sec;
+  bool region_request;
+  size_t region_start;
+  size_t region_end;
+
+  // 波形の解析
+  std::shared_ptr<AudioAnalyzer> analyzer;
+
+  // 先読み
+  // TIPS:読み込みスレッドが次のバッファのデータを用意しておき、再生スレッドはそれを積むだけにする
+  //      ファイルの読み込みが遅くても再生スレッドは待たされない
+  //      wav を使う時もロックする
+  std::mutex read_mutex;
+  std::unique_ptr<StreamWav> wav;
+  std::vector<char> ahead_buffer;
+  size_t ahead_length;
+  bool ahead_ready;
+  // データを最後まで読み込んだ
+  bool ended;
+
+  // キューから外したバッファの長さの合計(秒)
+  // TIPS:再生スレッドが書き換えている間は time_seq が奇数になる
+  //      読む側はロックしないが、書き換えと重なったら読み直す(書き換えが終わるまで繰り返す)
+  std::atomic<u_int> time_seq;
+  std::atomic<double> played_sec;
+  // 解析に渡し始めた時の再生位置(秒)
+  std::atomic<double> analyzer_sec;
+
+  // 以下は再生スレッドが書き換え、ゲーム側が読む
+  std::atomic<int> state;
+  std::atomic<u_int> underruns;
+
+  Stream(const std::string& path_, const bool loop_,
+         const int buffer_num_, const int buffer_ms_) :
+    path(path_),
+    loop(loop_),
+    buffer_num(std::max(buffer_num_, 2)),
+    buffer_ms(std::max(buffer_ms_, 10)),
+    buffer_sec(0.0f),
+    paused(false),
+    gain(1.0f),
+    gain_from(1.0f),
+    gain_to(1.0f),
+    ramp_sec(0.0f),
+    ramping(false),
+    stopping(false),
+    seek_sec(-1.0),
+    region_request(false),
+    region_start(0),
+    region_end(0),
+    ahead_length(0),
+    ahead_ready(false),
+    ended(false),
+    time_seq(0),
+    played_sec(0.0),
+    analyzer_sec(0.0),
+    state(STARTING),
+    underruns(0)
+  {}
+
+  bool isFinished() const { return state == FINISHED; }
+
+  // 再生位置を書き換える前後に呼ぶ(再生スレッドから)
+  void beginTimeUpdate() {
+    time_seq.store(time_seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  void endTimeUpdate() {
+    time_seq.store(time_seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // 再生位置(秒)
+  // TIPS:再生スレッドが書き換えている最中だったら読み直す
+  // NOTICE:ロックはしないが、書き換えが終わるまでは yield しながら繰り返す
+  PlaybackTime playbackTime() const {
+    while (true) {
+      u_int seq = time_seq.load(std::memory_order_acquire);
+      if (!(seq & 1)) {
+        PlaybackTime time = source.playbackTime();
+        double played = played_sec.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (seq == time_seq.load(std::memory_order_relaxed)) {
+          time.sec += played;
+          return time;
+        }
+      }
+      std::this_thread::yield();
+    }
+  }
+};
+
+
+// すべてのストリーミングを処理するスレッド
+// TIPS:ファイルの読み込みは別のスレッドで先に済ませておく
+class Streaming::Service {
+  typedef std::chrono::steady_clock Clock;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<std::shared_ptr<Stream>> streams_;
+  bool wake_;
+  bool finish_;
+
+  std::thread thread_;
+
+  // 読み込みスレッド
+  std::mutex read_mutex_;
+  std::condition_variable read_cv_;
+  std::deque<std::shared_ptr<Stream>> read_requests_;
+  bool read_finish_;
+
+  std::thread read_thread_;
+
+
+public:
+  Service() :
+    wake_(false),
+    finish_(false),
+    read_finish_(false)
+  {
+    DOUT << "Streaming::Service()" << std::endl;
+
+    thread_      = std::thread(&Service::proc, this);
+    read_thread_ = std::thread(&Service::readProc, this);
+  }
+
+  ~Service() {
+    DOUT << "~Streaming::Service()" << std::endl;
 
-  // 読み込みバッファを1秒ぶんの長さにする
-  u_int buffer_size = stream.sampleRate() * (stream.isStereo() ? 2 : 1) * sizeof(uint16_t);
-  std::vector<char> sound_buffer(buffer_size);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      finish_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+
+    {
+      std::lock_guard<std::mutex> lock(read_mutex_);
+      read_finish_ = true;
+    }
+    read_cv_.notify_one();
+    read_thread_.join();
+
+    for (const auto& stream : streams_) {
+      stream->source.stop();
+      stream->state = Stream::FINISHED;
+    }
+  }
+
+  // ストリーミングを追加
+  void add(const std::shared_ptr<Stream>& stream) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      streams_.push_back(stream);
+    }
+    wake();
+  }
+
+  // 再生スレッドを起こす
+  void wake() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      wake_ = true;
+    }
+    cv_.notify_one();
+  }
+
+
+private:
+  // 再生を始める
+  static void start(Stream& stream) {
+    std::lock_guard<std::mutex> lock(stream.read_mutex);
+
+    try {
+      stream.wav = std::make_unique<StreamWav>(stream.path);
+    }
+    catch (const char* message) {
+      DOUT << "Streaming: " << message << std::endl;
+      stream.state = Stream::FINISHED;
+      return;
+    }
+    StreamWav& wav = *stream.wav;
+    wav.loop(stream.loop);
+
+    // 読み込みバッファの長さ(サンプル単位で切り揃える)
+    u_int frame_size = (wav.isStereo() ? 2 : 1) * sizeof(uint16_t);
+    u_int frames = std::max(u_int(u_long(wav.sampleRate()) * stream.buffer_ms / 1000), 1u);
+    stream.sound_buffer.resize(frames * frame_size);
+    stream.ahead_buffer.resize(frames * frame_size);
+    stream.buffer_sec = float(frames) / wav.sampleRate();
+
+    stream.buffers = std::vector<Buffer>(stream.buffer_num);
+    applyRequest(stream);
+    fill(stream);
+
+    stream.source.gain(stream.gain);
+    if (!stream.paused) stream.source.play();
+    stream.state = stream.paused ? Stream::PAUSED : Stream::PLAYING;
+  }
 
   // すべてのストリームバッファを再生キューに積む
-  for (u_int i = 0; i < BUFFER_NUM; ++i) {
-    queueStream(stream, *source, buffer[i], sound_buffer);
+  // NOTICE:stream.read_mutex をロックしてから呼ぶ
+  static void fill(Stream& stream) {
+    StreamWav& wav = *stream.wav;
+    for (auto& buffer : stream.buffers) {
+      size_t length = wav.read(stream.sound_buffer);
+      if (!length) {
+        stream.ended = true;
+        break;
+      }
+      analyze(stream, stream.sound_buffer, length);
+      stream.queued_sec.push_back(queueStream(wav, stream.source, buffer, stream.sound_buffer, length));
+    }
+    stream.ahead_ready = false;
+  }
+
+  // ゲーム側からの命令を処理する
+  static void command(Stream& stream, const Clock::time_point now) {
+    Command command;
+    while (stream.commands.pop(command)) {
+      switch (command.type) {
+      case Command::PLAY:
+        stream.paused = false;
+        if (stream.state != Stream::STARTING) stream.source.play();
+        break;
+
+      case Command::PAUSE:
+        stream.paused = true;
+        if (stream.state != Stream::STARTING) stream.source.pause();
+        break;
+
+      case Command::STOP:
+        // TIPS:音量を下げきったら止める
+        rampGain(stream, 0.0f, command.sec, now);
+        stream.stopping = true;
+        break;
+
+      case Command::GAIN:
+        if (!stream.stopping) rampGain(stream, float(command.value), command.sec, now);
+        break;
+
+      case Command::SEEK:
+        stream.seek_sec = command.value;
+        break;
+
+      case Command::LOOP_REGION:
+        stream.region_request = true;
+        stream.region_start   = command.start;
+        stream.region_end     = command.end;
+        break;
+
+      case Command::ANALYZER:
+        stream.analyzer = command.analyzer;
+        if (stream.analyzer) stream.analyzer->reset();
+        break;
+      }
+    }
+  }
+
+  // 音量を変え始める
+  static void rampGain(Stream& stream, const float gain, const float sec, const Clock::time_point now) {
+    stream.gain_from  = stream.gain;
+    stream.gain_to    = gain;
+    stream.ramp_start = now;
+    stream.ramp_sec   = sec;
+    stream.ramping    = true;
+  }
+
+  // 音量を変える
+  // 戻り値 変えている途中ならtrue
+  static bool updateGain(Stream& stream, const Clock::time_point now) {
+    if (!stream.ramping) return false;
+
+    float t = 1.0f;
+    if (stream.ramp_sec > 0.0f) {
+      t = std::chrono::duration<float>(now - stream.ramp_start).count() / stream.ramp_sec;
+    }
+    if (t >= 1.0f) {
+      stream.gain    = stream.gain_to;
+      stream.ramping = false;
+    }
+    else {
+      stream.gain = stream.gain_from + (stream.gain_to - stream.gain_from) * t;
+    }
+    stream.source.gain(stream.gain);
+    return stream.ramping;
   }
 
-  source->gain(1.0);
-  source->play();
+  // シークとループ範囲の要求を処理する
+  // NOTICE:stream.read_mutex をロックしてから呼ぶ
+  // 戻り値 シークしたらtrue
+  static bool applyRequest(Stream& stream) {
+    if (stream.region_request) {
+      stream.wav->loopRegion(stream.region_start, stream.region_end);
+      stream.region_request = false;
+    }
+    if (stream.seek_sec < 0.0) return false;
+
+    StreamWav& wav = *stream.wav;
+    size_t frame = size_t(stream.seek_sec * wav.sampleRate() + 0.5);
+    stream.seek_sec = -1.0;
 
-  while (!stream.isEnd()) {
-    param->mutex.lock();
-    bool stopped = param->stopped;
-    param->mutex.unlock();
+    stream.beginTimeUpdate();
+    if (stream.state != Stream::STARTING) {
+      // 積んであるバッファをすべて外す
+      // TIPS:止めると、積んであるバッファはすべて再生済みになる
+      stream.source.stop();
+      for (int processed = stream.source.processed(); processed > 0; --processed) {
+        stream.source.unqueueBuffer();
+      }
+      stream.queued_sec.clear();
+    }
+    stream.played_sec = double(std::min(frame, wav.frames())) / wav.sampleRate();
+    stream.endTimeUpdate();
 
-    if (stopped) break;
-      
-    if (source->processed() > 0) {
-      ALuint buffer_id = source->unqueueBuffer();
+    wav.seek(frame);
+    if (stream.analyzer) stream.analyzer->reset();
+    stream.ended = false;
+    return true;
+  }
+
+  // 再生の終わったバッファにデータを積み直す
+  // 戻り値 次に処理する時刻
+  Clock::time_point service(const std::shared_ptr<Stream>& shared, const Clock::time_point now) {
+    Stream& stream = *shared;
+    command(stream, now);
+    bool ramping = updateGain(stream, now);
+    if (stream.stopping && !ramping) {
+      stream.source.stop();
+      stream.state = Stream::FINISHED;
+      return Clock::time_point::max();
+    }
+
+    if (stream.state == Stream::STARTING) {
+      start(stream);
+      if (stream.isFinished()) return Clock::time_point::max();
+      requestRead(shared);
+    }
+
+    Source& source = stream.source;
+    {
+      // TIPS:読み込み中なら、読み込みスレッドが終わった時に起こしてくれる
+      std::unique_lock<std::mutex> lock(stream.read_mutex, std::try_to_lock);
+      if (lock && applyRequest(stream)) {
+        // FIXME:シークした直後のバッファはこのスレッドで読み込む
+        fill(stream);
+        if (!stream.paused) source.play();
+        lock.unlock();
+        requestRead(shared);
+      }
+    }
+
+    for (int processed = source.processed(); (processed > 0) && !stream.ended; --processed) {
+      std::unique_lock<std::mutex> lock(stream.read_mutex, std::try_to_lock);
+      // TIPS:先読みが間に合っていない
+      if (!lock || !stream.ahead_ready) break;
+
+      stream.ahead_ready = false;
+      if (!stream.ahead_length) {
+        stream.ended = true;
+        break;
+      }
+
+      stream.beginTimeUpdate();
+      ALuint buffer_id = source.unqueueBuffer();
+      stream.played_sec = stream.played_sec + stream.queued_sec.front();
+      stream.queued_sec.pop_front();
+      stream.endTimeUpdate();
 
       // FIXME:再生の終わったBufferのidをわざわざ探している
-      for (u_int i = 0; i < BUFFER_NUM; ++i) {
-        if (buffer_id == buffer[i].id()) {
-          // 再生の終わったバッファを再キューイング
-          queueStream(stream, *source, buffer[i], sound_buffer);
-          break;
+      auto it = std::find_if(std::begin(stream.buffers), std::end(stream.buffers),
+                             [buffer_id](const Buffer& buffer) { return buffer.id() == buffer_id; });
+      if (it != std::end(stream.buffers)) {
+        // 再生の終わったバッファを再キューイング
+        analyze(stream, stream.ahead_buffer, stream.ahead_length);
+        stream.queued_sec.push_back(queueStream(*stream.wav, source, *it,
+                                                stream.ahead_buffer, stream.ahead_length));
+      }
+      lock.unlock();
+      requestRead(shared);
+    }
+
+    ALint state;
+    alGetSourcei(source.name(), AL_SOURCE_STATE, &state);
+    if (stream.ended) {
+      // 積んだデータを再生しきったら終了
+      if ((state == AL_STOPPED) && !stream.paused) {
+        DOUT << "Finish streaming." << std::endl;
+        stream.state = Stream::FINISHED;
+        return Clock::time_point::max();
+      }
+    }
+    else if ((state == AL_STOPPED) && !stream.paused && !source.processed()) {
+      // すべてのバッファを再生しきって止まっていた
+      // TIPS:再生済みのバッファが残っていると、もう一度再生してしまう
+      DOUT << "Streaming underrun." << std::endl;
+      stream.underruns += 1;
+      source.play();
+    }
+
+    stream.state = stream.paused ? Stream::PAUSED : Stream::PLAYING;
+
+    // 先頭のバッファの再生が終わる頃に起きる
+    // TIPS:一時停止中もバッファの長さの間隔で様子を見る
+    //      音量を変えている間は細かく起きる
+    float remain = stream.buffer_sec;
+    if (state == AL_PLAYING) {
+      remain -= std::fmod(source.currentTime(), stream.buffer_sec);
+    }
+    if (ramping) remain = std::min(remain, 0.01f);
+    remain = std::max(remain, 0.005f);
+    return now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(remain));
+  }
+
+  // 積むデータを解析に渡す
+  static void analyze(Stream& stream, const std::vector<char>& data, const size_t length) {
+    const auto& analyzer = stream.analyzer;
+    if (!analyzer) return;
+
+    const StreamWav& wav = *stream.wav;
+    if (!analyzer->written()) {
+      // TIPS:渡し始めたデータは、すでに積んであるぶんの後に聞こえる
+      stream.analyzer_sec = std::accumulate(std::begin(stream.queued_sec), std::end(stream.queued_sec),
+                                            stream.played_sec.load());
+    }
+    u_int ch = wav.isStereo() ? 2 : 1;
+    analyzer->write(reinterpret_cast<const int16_t*>(data.data()), length / (ch * sizeof(int16_t)),
+                    ch, wav.sampleRate());
+  }
+
+  // 次のバッファの先読みを頼む
+  void requestRead(const std::shared_ptr<Stream>& stream) {
+    {
+      std::lock_guard<std::mutex> lock(read_mutex_);
+      read_requests_.push_back(stream);
+    }
+    read_cv_.notify_one();
+  }
+
+  // 次のバッファを読み込んでおく
+  // 戻り値 読み込んだらtrue
+  static bool readAhead(Stream& stream) {
+    std::lock_guard<std::mutex> lock(stream.read_mutex);
+    // TIPS:先読みしたデータがまだ使われていない
+    if (stream.ahead_ready || stream.ended || stream.isFinished()) return false;
+
+    stream.ahead_length = stream.wav->read(stream.ahead_buffer);
+    stream.ahead_ready  = true;
+    return true;
+  }
+
+  // std::threadによる再生処理
+  void proc() {
+    Clock::time_point deadline = Clock::time_point::max();
+
+    while (true) {
+      std::vector<std::shared_ptr<Stream>> streams;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (deadline == Clock::time_point::max()) {
+          cv_.wait(lock, [this]() { return wake_ || finish_; });
+        }
+        else {
+          cv_.wait_until(lock, deadline, [this]() { return wake_ || finish_; });
         }
+        if (finish_) break;
+
+        wake_ = false;
+        streams = streams_;
+      }
+
+      // TIPS:ファイルの読み込み中はロックしない
+      deadline = Clock::time_point::max();
+      for (const auto& stream : streams) {
+        deadline = std::min(deadline, service(stream, Clock::now()));
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        streams_.erase(std::remove_if(std::begin(streams_), std::end(streams_),
+                                      [](const std::shared_ptr<Stream>& stream) { return stream->isFinished(); }),
+                       std::end(streams_));
       }
     }
+  }
+
+  // std::threadによる読み込み処理
+  void readProc() {
+    while (true) {
+      std::shared_ptr<Stream> stream;
+      {
+        std::unique_lock<std::mutex> lock(read_mutex_);
+        read_cv_.wait(lock, [this]() { return !read_requests_.empty() || read_finish_; });
+        if (read_finish_) break;
 
-    // Don't kill the CPU.
-    std::this_thread::sleep_for(std::chrono::milliseconds(SLEEP_TIME_MS));
+        stream = read_requests_.front();
+        read_requests_.pop_front();
+      }
+
+      // 読み込めたら、積むために再生スレッドを起こす
+      if (readAhead(*stream)) wake();
+    }
   }
-    
-  DOUT << "Finish streaming." << std::endl;
+
+};
+
+
+std::unique_ptr<Streaming::Service> Streaming::service_;
+
+
+// FIXME:読み込みバッファを引数で渡している
+double Streaming::queueStream(const StreamWav& stream, const Source& source, Buffer& buffer,
+                              const std::vector<char>& sound_buffer, const size_t length) {
+  buffer.bind(stream.isStereo(), &sound_buffer[0], static_cast<u_int>(length), stream.sampleRate());
+  source.queueBuffer(buffer);
+
+  size_t frame_size = (stream.isStereo() ? 2 : 1) * sizeof(int16_t);
+  return double(length / frame_size) / stream.sampleRate();
 }
 
   
-Streaming::Streaming(const std::string& path, const bool loop) :
-  source_(std::make_shared<Source>()),
-  param_(std::make_shared<Param>()),
-  pause_(false)
+Streaming::Streaming(const std::string& path, const bool loop,
+                     const int buffer_num, const int buffer_ms) :
+  stream_(std::make_shared<Stream>(path, loop, buffer_num, buffer_ms)),
+  pause_(false),
+  stopped_(false)
 {
   DOUT << "Streaming()" << std::endl;
 
-  std::thread thread(streamProc, path, loop, source_, param_);
-  thread.detach();
+  if (!service_) service_ = std::make_unique<Service>();
+  service_->add(stream_);
 }
 
   
-void Streaming::gain(const float gain) {
-  source_->gain(gain);
+// 音量を変える
+void Streaming::gain(const float gain, const float sec) {
+  Command command {};
+  command.type  = Command::GAIN;
+  command.value = gain;
+  command.sec   = sec;
+  send(command);
 }
 
 void Streaming::pause(const bool pause) {
-  param_->mutex.lock();
-  bool stopped = param_->stopped;
-  param_->mutex.unlock();
-  
-  if (stopped) return;
+  if (stopped_ || stream_->isFinished()) return;
     
   pause_ = pause;
-  if (pause) {
-    source_->pause();
+  Command command {};
+  command.type = pause ? Command::PAUSE : Command::PLAY;
+  send(command);
+}
+
+// 再生を止める
+void Streaming::stop(const float sec) {
+  stopped_ = true;
+  Command command {};
+  command.type = Command::STOP;
+  command.sec  = sec;
+  send(command);
+}
+
+// 再生位置を変更する(秒)
+void Streaming::seek(const double sec) {
+  Command command {};
+  command.type  = Command::SEEK;
+  command.value = std::max(sec, 0.0);
+  send(command);
+}
+
+// ループ範囲
+void Streaming::loopRegion(const size_t start, const size_t end) {
+  Command command {};
+  command.type  = Command::LOOP_REGION;
+  command.start = start;
+  command.end   = end;
+  send(command);
+}
+
+bool Streaming::isPlaying() const {
+  if (stopped_ || pause_) return false;
+  // TIPS:再生スレッドが再生を始めるまでは再生中とみなす
+  return !stream_->isFinished();
+}
+
+// 再生位置(秒)
+PlaybackTime Streaming::playbackTime() const {
+  int state = stream_->state;
+  if ((state == Stream::STARTING) || (state == Stream::FINISHED)) {
+    return { stream_->played_sec, 0.0, false, false };
   }
-  else {
-    source_->play();
+
+  return stream_->playbackTime();
+}
+
+// データの読み込みが間に合わず、再生が途切れた回数
+u_int Streaming::underruns() const {
+  return stream_->underruns;
+}
+
+
+// 再生する波形を解析する
+void Streaming::analyzer(const std::shared_ptr<AudioAnalyzer>& analyzer) {
+  if (analyzer) {
+    // TIPS:解析用のスレッドが、今聞こえている位置を読む
+    std::weak_ptr<const Stream> weak = stream_;
+    analyzer->clock([weak]() {
+        auto stream = weak.lock();
+        if (!stream || (stream->state == Stream::STARTING)) return 0.0;
+
+        return stream->playbackTime().sec - stream->analyzer_sec;
+      });
   }
+
+  Command command {};
+  command.type     = Command::ANALYZER;
+  command.analyzer = analyzer;
+  send(command);
 }
 
-// 再生を止めて、スレッドを破棄する
-void Streaming::stop() {
-  gain(0.0);
 
-  std::lock_guard<std::mutex>(param_->mutex);
-  param_->stopped = true;
+// 再生スレッドへ命令を送る
+void Streaming::send(const Command& command) {
+  if (!stream_->commands.push(command)) {
+    DOUT << "Streaming: too many commands." << std::endl;
+    return;
+  }
+  if (service_) service_->wake();
 }
 
-bool Streaming::isPlaying() {
-  param_->mutex.lock();
-  bool stopped = param_->stopped;
-  param_->mutex.unlock();
-  
-  if (stopped) return false;
-    
-  return source_->isPlaying();
+
+// すべてのストリーミングを止めて、再生スレッドを終了する
+void Streaming::shutdown() {
+  service_.reset();
 }
@@ -4,59 +4,101 @@
 // ストリーミングによる再生
 // FIXME:インスタンス生成時に自動的に再生を始める
 //
+// TIPS:すべてのストリーミングをひとつのスレッドで処理する
+//      再生スレッドは、バッファの再生が終わる頃に起きて次のデータを積む
+//      ファイルの読み込みは読み込みスレッドが次のバッファのぶんを先に済ませておく
+//      ゲーム側の操作は命令として再生スレッドに送り、再生スレッドの処理は待たない
+//
+// NOTICE:ひとつのインスタンスは、ひとつのスレッドから操作すること
+//
 
 #include "defines.hpp"
 #include "audio.hpp"
 #include "streamWav.hpp"
+#include "audioAnalyzer.hpp"
 #include <string>
 #include <vector>
 #include <memory>
-#include <mutex>
 
 
 class Streaming {
   enum {
-    BUFFER_NUM    = 2,
-    SLEEP_TIME_MS = 250
+    BUFFER_NUM = 2,
+    BUFFER_MS  = 1000
   };
 
+  // 再生スレッドと共有する状態
   // TIPS:再生スレッドよりStreamingのインスタンスが先に破棄されることがあるので
   //      shared_ptrを使う
-  std::shared_ptr<Source> source_;
+  struct Stream;
+  std::shared_ptr<Stream> stream_;
   bool pause_;
+  bool stopped_;
 
-  // 再生スレッドとの連絡用
-  struct Param {
-    std::mutex mutex;
-    bool stopped;
+  // 再生スレッドへの命令
+  struct Command;
 
-    Param() :
-      stopped(false)
-    {}
-  };
-  std::shared_ptr<Param> param_;
+  // 再生スレッド
+  class Service;
+  static std::unique_ptr<Service> service_;
 
   
 public:
-  Streaming(const std::string& path, const bool loop = false);
+  // buffer_num バッファの数
+  // buffer_ms  バッファひとつぶんの長さ(ミリ秒)
+  Streaming(const std::string& path, const bool loop = false,
+            const int buffer_num = BUFFER_NUM, const int buffer_ms = BUFFER_MS);
 
 
   // gain [0.0, 1.0]
-  void gain(const float gain);
+  // sec  音量を変える時間(秒)
+  void gain(const float gain, const float sec = 0.0f);
   void pause(const bool pause);
 
-  // 再生を止めて、スレッドを破棄する
-  void stop();
+  // 再生を止める
+  // sec 音量を下げきるまでの時間(秒)
+  void stop(const float sec = 0.0f);
+
+  // 再生位置を変更する(秒)
+  // TIPS:サンプル単位で正確に移動する
+  //      AudioClockを使っている場合は、AudioClock::reset() も呼ぶこと
+  // NOTICE:再生し終わった後は何もしない
+  void seek(const double sec);
+
+  // ループ範囲(サンプル数、endは含まない)
+  // TIPS:先頭からendまで再生した後はstartからendを繰り返す(イントロ付きのループ)
+  //      WAVのsmplチャンクにループ範囲があれば、最初からそれが使われる
+  // NOTICE:すでに積んであるバッファは元の範囲のまま再生される
+  void loopRegion(const size_t start, const size_t end);
+
+  bool isPlaying() const;
 
-  bool isPlaying();
+  // 再生位置(秒)
+  // TIPS:再生し終わってキューから外したバッファの長さを足す
+  //      ループ再生では先頭に戻らず進み続ける
+  PlaybackTime playbackTime() const;
+
+  // データの読み込みが間に合わず、再生が途切れた回数
+  u_int underruns() const;
+
+  // 再生する波形を解析する
+  // TIPS:積んだデータを渡し、今聞こえている位置に合わせて解析させる
+  //      nullptrで解析をやめる
+  void analyzer(const std::shared_ptr<AudioAnalyzer>& analyzer);
+
+  // すべてのストリーミングを止めて、再生スレッドを終了する
+  // TIPS:Audioの後始末で呼ばれる
+  static void shutdown();
 
   
 private:
+  // 再生スレッドへ命令を送る
+  // TIPS:命令を積んで再生スレッドを起こすだけで、再生スレッドの処理は待たない
+  void send(const Command& command);
+
   // FIXME:読み込みバッファを引数で渡している
-  static void queueStream(StreamWav& stream, Source& source, Buffer& buffer,
-                          std::vector<char>& sound_buffer);
-  
-  // std::threadによる再生処理
-  static void streamProc(const std::string path, const bool loop,
-                         std::shared_ptr<Source> source, std::shared_ptr<Param> param);
+  // length 積むデータのバイト数
+  // 戻り値 積んだデータの長さ(秒)
+  static double queueStream(const StreamWav& stream, const Source& source, Buffer& buffer,
+                            const std::vector<char>& sound_buffer, const size_t length);
 };
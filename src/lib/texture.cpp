@@ -38,6 +38,12 @@ void Texture::unbind() const {
   glBindTexture(GL_TEXTURE_2D, 0);
 }
 
+// OpenGLのテクスチャID
+GLuint Texture::id() const {
+  assert(gl_texture_ && "Empty texture.");
+  return gl_texture_->id();
+}
+
 // フィルタリングのON/OFF
 void Texture::enableFilter(bool filtering) {
   gl_texture_->bind();
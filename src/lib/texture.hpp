@@ -35,6 +35,9 @@ public:
   // 拘束を解除
 	void unbind() const;
 
+  // OpenGLのテクスチャID
+  GLuint id() const;
+
   // 画素のフィルタリングを有効にする
   // TIPS:無効にすると拡大時にぼんやりした絵にならない
   void enableFilter(bool filtering);
@@ -0,0 +1,435 @@
+﻿//
+// 巨大な画像のタイル分割表示
+//
+
+#include "tiledImage.hpp"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include "image.hpp"
+#include "batch.hpp"
+
+
+// タイル情報ファイル名
+static std::string infoPath(const std::string& dir) {
+  return dir + "/tiles.txt";
+}
+
+// 縮小レベルごとのタイルファイル名
+static std::string levelPath(const std::string& dir, const int level) {
+  return dir + "/level" + std::to_string(level) + ".bin";
+}
+
+
+// 画像をタイルに分割してディレクトリに書き出す(オフライン用)
+// image_path  元画像(stb_imageで読める形式)
+// output_dir  書き出し先のディレクトリ(あらかじめ作成しておく)
+// tile_size   タイルの一辺のピクセル数(2のべき乗)
+// 戻り値      true なら成功
+bool buildImageTiles(const std::string& image_path, const std::string& output_dir,
+                     const int tile_size) {
+  Image image(image_path);
+
+  int width  = image.width();
+  int height = image.height();
+  int comp   = (image.isGrayscale() ? 1 : 3) + (image.hasAlpha() ? 1 : 0);
+  std::vector<u_char> pixels(image.image(), image.image() + width * height * comp);
+
+  int level = 0;
+  while (1) {
+    std::ofstream fstr(levelPath(output_dir, level), std::ios::binary);
+    if (!fstr) {
+      DOUT << "Can't write: " << levelPath(output_dir, level) << std::endl;
+      return false;
+    }
+
+    // タイルは常にtile_size四方で書き出す(はみ出した部分は0で埋める)
+    // TIPS:サイズが固定なので、読み込み時はファイル位置を計算で求められる
+    int tiles_x = (width + tile_size - 1) / tile_size;
+    int tiles_y = (height + tile_size - 1) / tile_size;
+    std::vector<u_char> tile(tile_size * tile_size * comp);
+    for (int ty = 0; ty < tiles_y; ++ty) {
+      for (int tx = 0; tx < tiles_x; ++tx) {
+        std::fill(std::begin(tile), std::end(tile), 0);
+
+        int w = std::min(tile_size, width - tx * tile_size);
+        int h = std::min(tile_size, height - ty * tile_size);
+        for (int y = 0; y < h; ++y) {
+          const u_char* src = &pixels[((ty * tile_size + y) * width + tx * tile_size) * comp];
+          std::copy(src, src + w * comp, &tile[y * tile_size * comp]);
+        }
+        fstr.write(reinterpret_cast<const char*>(&tile[0]), tile.size());
+      }
+    }
+    DOUT << "level" << level << ":" << width << "x" << height
+         << " tiles:" << tiles_x << "x" << tiles_y << std::endl;
+
+    level += 1;
+    if ((width <= tile_size) && (height <= tile_size)) break;
+
+    // 縦横半分に縮小(2x2の平均)
+    int half_width  = (width + 1) / 2;
+    int half_height = (height + 1) / 2;
+    std::vector<u_char> half(half_width * half_height * comp);
+    for (int y = 0; y < half_height; ++y) {
+      int y0 = y * 2;
+      int y1 = std::min(y0 + 1, height - 1);
+      for (int x = 0; x < half_width; ++x) {
+        int x0 = x * 2;
+        int x1 = std::min(x0 + 1, width - 1);
+        for (int c = 0; c < comp; ++c) {
+          int sum = pixels[(y0 * width + x0) * comp + c]
+                  + pixels[(y0 * width + x1) * comp + c]
+                  + pixels[(y1 * width + x0) * comp + c]
+                  + pixels[(y1 * width + x1) * comp + c];
+          half[(y * half_width + x) * comp + c] = (sum + 2) / 4;
+        }
+      }
+    }
+    pixels.swap(half);
+    width  = half_width;
+    height = half_height;
+  }
+
+  std::ofstream info(infoPath(output_dir));
+  if (!info) return false;
+  info << image.width() << " " << image.height() << " "
+       << comp << " " << tile_size << " " << level << std::endl;
+
+  return true;
+}
+
+
+bool TiledImage::Key::operator<(const Key& rhs) const {
+  if (level != rhs.level) return level < rhs.level;
+  if (y != rhs.y) return y < rhs.y;
+  return x < rhs.x;
+}
+
+bool TiledImage::Key::operator==(const Key& rhs) const {
+  return (level == rhs.level) && (x == rhs.x) && (y == rhs.y);
+}
+
+
+// dir         buildImageTiles()の書き出し先
+// cache_tiles GPUに置くタイルの枚数
+TiledImage::TiledImage(const std::string& dir, const int cache_tiles) :
+  dir_(dir),
+  frame_(0),
+  is_loading_(false),
+  finish_(false)
+{
+  DOUT << "TiledImage()" << std::endl;
+
+  std::ifstream info(infoPath(dir));
+  if (!info) throw "Can't open tile info.";
+  info >> width_ >> height_ >> comp_ >> tile_size_ >> levels_;
+
+  GLint type;
+  switch (comp_) {
+  case 1:  type = GL_LUMINANCE;       break;
+  case 2:  type = GL_LUMINANCE_ALPHA; break;
+  case 3:  type = GL_RGB;             break;
+  default: type = GL_RGBA;            break;
+  }
+
+  // GPU上のタイル置き場をあらかじめ確保
+  slots_.resize(cache_tiles);
+  for (auto& slot : slots_) {
+    slot.tex = std::make_shared<GlTexture>();
+    slot.used = false;
+    slot.last_frame = 0;
+
+    slot.tex->bind();
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexImage2D(GL_TEXTURE_2D, 0, type, tile_size_, tile_size_, 0, type, GL_UNSIGNED_BYTE, nullptr);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  thread_ = std::thread(&TiledImage::loadProc, this);
+}
+
+TiledImage::~TiledImage() {
+  DOUT << "~TiledImage()" << std::endl;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    finish_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+}
+
+
+// 元画像のサイズ
+int TiledImage::width() const { return width_; }
+int TiledImage::height() const { return height_; }
+
+
+// 描画
+// pos       画像の左下の位置
+// view_size 表示範囲のサイズ(AppEnv::viewSize()) 画面中央が(0, 0)
+// scale     拡大縮小率
+// color     色
+void TiledImage::draw(const Vec2f& pos, const Vec2f& view_size,
+                      const float scale, const Color& color) {
+  // TIPS:タイルのテクスチャは使い回すので、まとめ描画には入れない
+  flushBatch();
+
+  frame_ += 1;
+
+  // 縮小表示ほど粗いレベルを使う
+  int level = (scale < 1.0f) ? int(std::floor(std::log2(1.0f / scale))) : 0;
+  level = std::min(std::max(level, 0), levels_ - 1);
+
+  // 1タイルあたりの表示サイズ
+  float level_scale = scale * (1 << level);
+  float tile_world  = tile_size_ * level_scale;
+  float top         = pos.y + height_ * scale;
+
+  // 表示範囲に入るタイルの範囲
+  int min_x = int(std::floor((-view_size.x / 2 - pos.x) / tile_world));
+  int max_x = int(std::floor(( view_size.x / 2 - pos.x) / tile_world));
+  int min_y = int(std::floor((top - view_size.y / 2) / tile_world));
+  int max_y = int(std::floor((top + view_size.y / 2) / tile_world));
+  min_x = std::max(min_x, 0);
+  min_y = std::max(min_y, 0);
+  max_x = std::min(max_x, tilesX(level) - 1);
+  max_y = std::min(max_y, tilesY(level) - 1);
+
+  color.setToGl();
+  glEnable(GL_TEXTURE_2D);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+
+  std::vector<Key> missing;
+  for (int ty = min_y; ty <= max_y; ++ty) {
+    for (int tx = min_x; tx <= max_x; ++tx) {
+      Key key{ level, tx, ty };
+
+      float w = float(std::min(tile_size_, levelWidth(level) - tx * tile_size_));
+      float h = float(std::min(tile_size_, levelHeight(level) - ty * tile_size_));
+      float left  = pos.x + tx * tile_world;
+      float upper = top - ty * tile_world;
+
+      // 読み込み済みのタイルがなければ、上位レベルのタイルの一部で代用する
+      auto it = cache_.find(key);
+      if (it == std::end(cache_)) missing.push_back(key);
+
+      int k = 0;
+      while (it == std::end(cache_) && (level + ++k) < levels_) {
+        it = cache_.find(Key{ level + k, tx >> k, ty >> k });
+      }
+      if (it == std::end(cache_)) continue;
+
+      auto& slot = slots_[it->second];
+      slot.last_frame = frame_;
+
+      const Key& src = slot.key;
+      int   shift = src.level - level;
+      float u0 = float(tx * tile_size_ - (src.x << shift) * tile_size_) / (tile_size_ << shift);
+      float v0 = float(ty * tile_size_ - (src.y << shift) * tile_size_) / (tile_size_ << shift);
+      drawTile(*slot.tex,
+               left, upper, left + w * level_scale, upper - h * level_scale,
+               u0, v0, u0 + w / (tile_size_ << shift), v0 + h / (tile_size_ << shift));
+    }
+  }
+
+  glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+  glDisable(GL_TEXTURE_2D);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  upload();
+
+  // 画面中央に近いタイルから読み込む
+  float center_x = -pos.x / tile_world - 0.5f;
+  float center_y = top / tile_world - 0.5f;
+  std::sort(std::begin(missing), std::end(missing),
+            [center_x, center_y](const Key& a, const Key& b) {
+              float da = (a.x - center_x) * (a.x - center_x) + (a.y - center_y) * (a.y - center_y);
+              float db = (b.x - center_x) * (b.x - center_x) + (b.y - center_y) * (b.y - center_y);
+              return da < db;
+            });
+
+  // 最も粗いタイルは常に用意しておく(代用の最終手段)
+  Key root{ levels_ - 1, 0, 0 };
+  if (!cache_.count(root)) missing.insert(std::begin(missing), root);
+
+  {
+    // 表示範囲から外れたタイルの読み込みは取りやめる
+    std::lock_guard<std::mutex> lock(mutex_);
+    requests_.clear();
+    for (const auto& key : missing) {
+      // 読み込み中・転送待ちのタイルは除く
+      if (is_loading_ && (loading_ == key)) continue;
+      auto it = std::find_if(std::begin(loaded_), std::end(loaded_),
+                             [&key](const Loaded& tile) { return tile.key == key; });
+      if (it != std::end(loaded_)) continue;
+
+      requests_.push_back(key);
+    }
+  }
+  cv_.notify_one();
+}
+
+
+// 縮小レベルごとのサイズとタイル数
+int TiledImage::levelWidth(const int level) const {
+  return std::max((width_ + (1 << level) - 1) >> level, 1);
+}
+
+int TiledImage::levelHeight(const int level) const {
+  return std::max((height_ + (1 << level) - 1) >> level, 1);
+}
+
+int TiledImage::tilesX(const int level) const {
+  return (levelWidth(level) + tile_size_ - 1) / tile_size_;
+}
+
+int TiledImage::tilesY(const int level) const {
+  return (levelHeight(level) + tile_size_ - 1) / tile_size_;
+}
+
+
+// 読み込みが終わったタイルをGPUへ転送
+void TiledImage::upload() {
+  std::vector<Loaded> loaded;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    loaded.swap(loaded_);
+  }
+  if (loaded.empty()) return;
+
+  GLint type;
+  switch (comp_) {
+  case 1:  type = GL_LUMINANCE;       break;
+  case 2:  type = GL_LUMINANCE_ALPHA; break;
+  case 3:  type = GL_RGB;             break;
+  default: type = GL_RGBA;            break;
+  }
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+  size_t count = 0;
+  for (; count < loaded.size(); ++count) {
+    // 転送しきれなかったタイルは次のフレームに回す
+    if (count == UPLOAD_PER_FRAME) break;
+
+    auto& tile = loaded[count];
+    if (cache_.count(tile.key)) continue;
+
+    int index = findSlot();
+    if (index < 0) break;
+
+    auto& slot = slots_[index];
+    if (slot.used) cache_.erase(slot.key);
+
+    slot.tex->bind();
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, tile_size_, tile_size_, type, GL_UNSIGNED_BYTE, &tile.pixels[0]);
+
+    slot.key  = tile.key;
+    slot.used = true;
+    slot.last_frame = frame_;
+    cache_.insert(std::make_pair(tile.key, index));
+  }
+
+  if (count < loaded.size()) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    loaded_.insert(std::end(loaded_),
+                   std::make_move_iterator(std::begin(loaded) + count),
+                   std::make_move_iterator(std::end(loaded)));
+  }
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// 使われていないスロットを探す
+// 空きがなければ一番長く使われていないものを選ぶ
+int TiledImage::findSlot() {
+  int index = -1;
+  u_int oldest = frame_;
+  for (size_t i = 0; i < slots_.size(); ++i) {
+    if (!slots_[i].used) return int(i);
+
+    // このフレームで描画したタイルは追い出さない
+    if (slots_[i].last_frame < oldest) {
+      oldest = slots_[i].last_frame;
+      index  = int(i);
+    }
+  }
+  return index;
+}
+
+
+// タイルを１枚描画
+void TiledImage::drawTile(const GlTexture& tex,
+                          const float left, const float top, const float right, const float bottom,
+                          const float u0, const float v0, const float u1, const float v1) {
+  GLfloat vtx[] = {
+    left,  bottom,
+    right, bottom,
+    left,  top,
+    right, top
+  };
+  GLfloat uv[] = {
+    u0, v1,
+    u1, v1,
+    u0, v0,
+    u1, v0
+  };
+
+  glVertexPointer(2, GL_FLOAT, 0, vtx);
+  glTexCoordPointer(2, GL_FLOAT, 0, uv);
+
+  tex.bind();
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+
+// std::threadによる読み込み処理
+void TiledImage::loadProc() {
+  std::vector<std::ifstream> files(levels_);
+  for (int i = 0; i < levels_; ++i) {
+    files[i].open(levelPath(dir_, i), std::ios::binary);
+  }
+
+  size_t tile_bytes = tile_size_ * tile_size_ * comp_;
+
+  while (1) {
+    Key key;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this]() { return finish_ || !requests_.empty(); });
+      if (finish_) break;
+
+      key = requests_.front();
+      requests_.pop_front();
+
+      loading_    = key;
+      is_loading_ = true;
+    }
+
+    Loaded tile;
+    tile.key = key;
+    tile.pixels.resize(tile_bytes);
+
+    auto& fstr = files[key.level];
+    fstr.clear();
+    fstr.seekg((key.y * tilesX(key.level) + key.x) * tile_bytes, fstr.beg);
+    fstr.read(reinterpret_cast<char*>(&tile.pixels[0]), tile_bytes);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_loading_ = false;
+    if (!fstr) {
+      DOUT << "Can't read tile: " << key.level << " " << key.x << "," << key.y << std::endl;
+      continue;
+    }
+    loaded_.push_back(std::move(tile));
+  }
+}
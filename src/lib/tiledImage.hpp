@@ -0,0 +1,134 @@
+﻿#pragma once
+
+//
+// 巨大な画像のタイル分割表示
+//
+//   buildImageTiles()で画像をタイルに分割(縮小画像も作成)しておき、
+//   TiledImageで表示範囲のタイルだけを読み込んで描画する。
+//   読み込みは別スレッドで行い、GPUには決まった枚数のタイルしか置かないので
+//   メモリ使用量は画像サイズではなく画面サイズで決まる
+//
+//   NOTICE:このクラスはコピー禁止
+//
+
+#include "defines.hpp"
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "vector.hpp"
+#include "graph.hpp"
+#include "glTexture.hpp"
+
+
+// 画像をタイルに分割してディレクトリに書き出す(オフライン用)
+// image_path  元画像(stb_imageで読める形式)
+// output_dir  書き出し先のディレクトリ(あらかじめ作成しておく)
+// tile_size   タイルの一辺のピクセル数(2のべき乗)
+// 戻り値      true なら成功
+bool buildImageTiles(const std::string& image_path, const std::string& output_dir,
+                     const int tile_size = 256);
+
+
+class TiledImage {
+  enum {
+    // 1フレームでGPUへ転送するタイルの最大数
+    UPLOAD_PER_FRAME = 8,
+  };
+
+  // タイルの識別子(縮小レベル, x, y)
+  struct Key {
+    int level;
+    int x, y;
+
+    bool operator<(const Key& rhs) const;
+    bool operator==(const Key& rhs) const;
+  };
+
+  // 読み込みが終わったタイル
+  struct Loaded {
+    Key key;
+    std::vector<u_char> pixels;
+  };
+
+  // GPU上のタイル置き場
+  struct Slot {
+    std::shared_ptr<GlTexture> tex;
+    Key key;
+    bool used;
+    u_int last_frame;
+  };
+
+  int width_;
+  int height_;
+  int comp_;
+  int tile_size_;
+  int levels_;
+  std::string dir_;
+
+  std::vector<Slot> slots_;
+  std::map<Key, int> cache_;
+  u_int frame_;
+
+  // 読み込みスレッドとの連絡用
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Key> requests_;
+  std::vector<Loaded> loaded_;
+  Key loading_;
+  bool is_loading_;
+  bool finish_;
+
+  std::thread thread_;
+
+
+public:
+  // dir         buildImageTiles()の書き出し先
+  // cache_tiles GPUに置くタイルの枚数
+  explicit TiledImage(const std::string& dir, const int cache_tiles = 64);
+  ~TiledImage();
+
+  // TIPS:このクラスはコピー禁止
+  TiledImage(const TiledImage&) = delete;
+  TiledImage& operator=(const TiledImage&) = delete;
+
+  // 元画像のサイズ
+  int width() const;
+  int height() const;
+
+  // 描画
+  // pos       画像の左下の位置
+  // view_size 表示範囲のサイズ(AppEnv::viewSize()) 画面中央が(0, 0)
+  // scale     拡大縮小率
+  // color     色
+  void draw(const Vec2f& pos, const Vec2f& view_size,
+            const float scale = 1.0f, const Color& color = Color::white);
+
+  
+private:
+  // 縮小レベルごとのサイズとタイル数
+  int levelWidth(const int level) const;
+  int levelHeight(const int level) const;
+  int tilesX(const int level) const;
+  int tilesY(const int level) const;
+
+  // 読み込みが終わったタイルをGPUへ転送
+  void upload();
+
+  // 使われていないスロットを探す
+  int findSlot();
+
+  // タイルを１枚描画
+  // left, top, right, bottom 表示位置
+  // u0, v0, u1, v1           テクスチャの切り抜き範囲
+  static void drawTile(const GlTexture& tex,
+                       const float left, const float top, const float right, const float bottom,
+                       const float u0, const float v0, const float u1, const float v1);
+
+  // std::threadによる読み込み処理
+  void loadProc();
+};
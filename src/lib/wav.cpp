@@ -4,39 +4,79 @@
 //
 
 #include "wav.hpp"
+#include "adpcm.hpp"
 #include <iostream>
 #include <string>
 #include <vector>
-#include <fstream>
+#include <cstring>
+#include <algorithm>
 
 
-Wav::Wav(const std::string& file) {
-  std::ifstream fstr(file, std::ios::binary);
-  if (!fstr) {
-    DOUT << "Can't open: " << file << std::endl;
-    throw;
-  }
-    
+Wav::Wav(const std::string& file, const bool mono) :
+  file_(std::make_shared<MappedFile>(file))
+{
   // ファイル情報を解析
-  if (!analyzeWavFile(info, fstr)) {
+  if (!analyzeWavFile(info, file_->data(), file_->size())) {
     DOUT << "This file isn't WAV: " << file << std::endl;
-    throw;
+    throw "This file isn't WAV.";
   }
 
-  if ((info.id != 1) || (info.bit != 16)) {
-    // IDが１で量子化ビット数が16以外は扱わない
+  if (!isSupported(info)) {
+    // PCMとIMA ADPCM以外は扱わない
     DOUT << "Wav format error. " << info.id << " " << info.bit << " : " << file << std::endl;
-    throw;
+    throw "Wav format error.";
   }
     
   // 再生時間(秒)
-  time_ = info.size / info.ch / 2.0f / info.sample_rate;
+  time_ = float(info.frames) / info.sample_rate;
+
+  const char* data = file_->data() + info.offset;
+  u_int out_ch = outputChannel(info, mono);
+  bool adpcm = isImaAdpcm(info);
+  if (!adpcm && (sampleFormat(info) == SampleFormat::INT16) && (out_ch == info.ch)) {
+    // TIPS:コピーせずにファイルの中をそのまま使う
+    return;
+  }
+
+  // 16bit PCMにそろえる
+  std::vector<int16_t> pcm;
+  const int16_t* samples = reinterpret_cast<const int16_t*>(data);
+  if (adpcm) {
+    // IMA ADPCMは16bit PCMに展開する
+    // TIPS:OpenALのバッファは圧縮データを扱えない
+    u_int block_frames = imaAdpcmBlockFrames(info.block_size, info.ch);
+    u_int blocks = info.size / info.block_size;
+    pcm.resize(blocks * block_frames * info.ch);
+    for (u_int i = 0; i < blocks; ++i) {
+      decodeImaAdpcmBlock(reinterpret_cast<const u_char*>(data + i * info.block_size),
+                          info.block_size, info.ch, &pcm[i * block_frames * info.ch]);
+    }
+    info.frames = std::min(info.frames, blocks * block_frames);
+    samples = pcm.data();
+  }
+  else if (sampleFormat(info) != SampleFormat::INT16) {
+    pcm.resize(info.frames * info.ch);
+    convertSamples(sampleFormat(info), data, pcm.size(), pcm.data());
+    samples = pcm.data();
+  }
 
-  // データ読み込み
-  data_.resize(info.size);
-  searchChunk(fstr, "data");
-  fstr.seekg(4, fstr.cur);      
-  fstr.read(&data_[0], info.size);
+  if (out_ch != info.ch) {
+    // チャンネル数を減らす
+    data_.resize(info.frames * out_ch);
+    foldChannels(samples, info.ch, info.channel_mask, info.frames, out_ch, data_.data());
+  }
+  else {
+    data_ = std::move(pcm);
+    data_.resize(info.frames * out_ch);
+  }
+
+  info.id   = FORMAT_PCM;
+  info.ch   = out_ch;
+  info.bit  = 16;
+  info.size = u_int(data_.size() * sizeof(int16_t));
+
+  // 変換したのでファイルは不要
+  file_.reset();
 }
 
 // チャンネル数を返す
@@ -55,7 +95,9 @@ u_int Wav::size() const { return info.size; }
 float Wav::time() const { return time_; }
 
 // 波形データを返す
-const char* Wav::data() const { return &data_[0]; }
+const char* Wav::data() const {
+  return file_ ? file_->data() + info.offset : reinterpret_cast<const char*>(data_.data());
+}
 
 
 // 指定バイト数のメモリの内容をint値にする
@@ -72,59 +114,63 @@ u_int Wav::getValue(const char* ptr, const u_int num) {
 			
   return value;
 }
-  
-// wavの指定チャンクを探す
-bool Wav::searchChunk(std::ifstream& fstr, const char* chunk) {
-  enum {
-    // チャンクが始まる位置
-    WAV_HEADER_SIZE = 12
-  };
-    
-  fstr.seekg(WAV_HEADER_SIZE, fstr.beg);
-  // チャンクの並びは不定なので、常にファイルの先頭から探す
-
-  while (1) {
-    char tag[4];
-    fstr.read(tag, 4);
-    if (!std::strncmp(tag, chunk, 4)) {
-      return true;
-    }
-
-    // 次のチャンクへ
-    char data[4];
-    fstr.read(data, 4);
-    u_int chunk_size = getValue(data, 4);
-    fstr.seekg(chunk_size, fstr.cur);
-    
-    if (fstr.eof()) break; 
-  }
-  return false;
-}
-
-// チャンクのサイズを取得
-u_int Wav::getChunkSize(std::ifstream& fstr) {
-  char data[4];
-  fstr.read(data, 4);
-  return getValue(data, 4);
-}
 
 // wavの情報を取得
-bool Wav::analyzeWavFile(Info& info, std::ifstream& fstr) {
+bool Wav::analyzeWavFile(Info& info, const char* data, const size_t size) {
   // ファイルがwav形式か判別
   enum {
-    WAV_HEADER_SIZE = 12
+    WAV_HEADER_SIZE   = 12,
+    CHUNK_HEADER_SIZE = 8,
   };
     
-  char header[WAV_HEADER_SIZE];
-  fstr.read(header, WAV_HEADER_SIZE);
-  if (std::strncmp(&header[0], "RIFF", 4)) {
+  if ((size < WAV_HEADER_SIZE) || std::strncmp(&data[0], "RIFF", 4)) {
     DOUT << "This file isn't RIFF format." << std::endl;
     return false;
   }
-  if (std::strncmp(&header[8], "WAVE", 4)) {
+  if (std::strncmp(&data[8], "WAVE", 4)) {
     DOUT << "This file isn't WAVE format." << std::endl;
     return false;
   }
+
+  // チャンクの並びは不定なので、先頭から一度だけたどって位置を覚える
+  const char* fmt = nullptr;
+  size_t fmt_size = 0;
+  const char* fact = nullptr;
+  size_t fact_size = 0;
+  const char* samples = nullptr;
+  size_t samples_size = 0;
+  const char* smpl = nullptr;
+  size_t smpl_size = 0;
+
+  size_t pos = WAV_HEADER_SIZE;
+  while ((pos + CHUNK_HEADER_SIZE) <= size) {
+    const char* chunk = data + pos;
+    size_t chunk_size = getValue(chunk + 4, 4);
+    size_t body = pos + CHUNK_HEADER_SIZE;
+    // TIPS:途中で切れたファイルでも読めるところまで使う
+    size_t body_size = std::min(chunk_size, size - body);
+
+    if (!std::strncmp(chunk, "fmt ", 4)) {
+      fmt      = data + body;
+      fmt_size = body_size;
+    }
+    else if (!std::strncmp(chunk, "fact", 4)) {
+      fact      = data + body;
+      fact_size = body_size;
+    }
+    else if (!std::strncmp(chunk, "data", 4)) {
+      samples      = data + body;
+      samples_size = body_size;
+    }
+    else if (!std::strncmp(chunk, "smpl", 4)) {
+      smpl      = data + body;
+      smpl_size = body_size;
+    }
+    // TIPS:LISTなど、その他のチャンクは読み飛ばす
+
+    // TIPS:チャンクは2バイト境界に揃えてある
+    pos = body + chunk_size + (chunk_size & 1);
+  }
       
   enum {
     // fmtチャンク内のデータ位置
@@ -134,29 +180,119 @@ bool Wav::analyzeWavFile(Info& info, std::ifstream& fstr) {
     WAV_BPS         = WAV_SAMPLE_RATE + 4,
     WAV_BLOCK_SIZE  = WAV_BPS + 4,
     WAV_BIT         = WAV_BLOCK_SIZE + 2,
+    WAV_FMT_SIZE    = WAV_BIT + 2,
   };
 
-  // fmtチャンクを探してデータ形式を取得
-  if (!searchChunk(fstr, "fmt ")) {
+  // fmtチャンクからデータ形式を取得
+  if (!fmt || (fmt_size < WAV_FMT_SIZE)) {
     DOUT << "No chank 'fmt'." << std::endl;
     return false;
   }
-  u_int chunk_size = getChunkSize(fstr);
-  std::vector<char> chunk(chunk_size);
-  fstr.read(&chunk[0], chunk_size);
+  info.id = getValue(&fmt[WAV_ID], 2);
+  info.ch = getValue(&fmt[WAV_CH], 2);
+  info.sample_rate = getValue(&fmt[WAV_SAMPLE_RATE], 4);
+  info.bit = getValue(&fmt[WAV_BIT], 2);
+  info.block_size = getValue(&fmt[WAV_BLOCK_SIZE], 2);
+  info.channel_mask = 0;
 
-  info.id = getValue(&chunk[WAV_ID], 2);
-  info.ch = getValue(&chunk[WAV_CH], 2);
-  info.sample_rate = getValue(&chunk[WAV_SAMPLE_RATE], 4);
-  info.bit = getValue(&chunk[WAV_BIT], 2);
+  enum {
+    // WAVE_FORMAT_EXTENSIBLEの追加情報の位置
+    WAV_CHANNEL_MASK = WAV_FMT_SIZE + 4,
+    WAV_SUB_FORMAT   = WAV_CHANNEL_MASK + 4,
+    WAV_EXTENSIBLE_SIZE = WAV_SUB_FORMAT + 16,
+  };
+  if (info.id == FORMAT_EXTENSIBLE) {
+    if (fmt_size < WAV_EXTENSIBLE_SIZE) {
+      DOUT << "Broken chank 'fmt'." << std::endl;
+      return false;
+    }
+    // TIPS:SubFormatのGUIDの先頭2バイトが本来のデータ形式
+    info.id = getValue(&fmt[WAV_SUB_FORMAT], 2);
+    info.channel_mask = getValue(&fmt[WAV_CHANNEL_MASK], 4);
+  }
 
-  // dataチャンクを探してデータ長を取得
-  if (!searchChunk(fstr, "data")) {
+  // dataチャンクからデータ長を取得
+  if (!samples) {
     DOUT << "No chank 'data'." << std::endl;
     return false;
   }
-  info.size = getChunkSize(fstr);
+  info.offset = size_t(samples - data);
+  info.size   = u_int(samples_size);
+
+  if (isImaAdpcm(info)) {
+    // 圧縮形式ではfactチャンクにサンプル数が入っている
+    u_int frames = (info.size / info.block_size) * imaAdpcmBlockFrames(info.block_size, info.ch);
+    u_int fact_frames = (fact && (fact_size >= 4)) ? getValue(fact, 4) : 0;
+    info.frames = fact_frames ? std::min(fact_frames, frames) : frames;
+  }
+  else {
+    u_int frame_size = info.ch * (info.bit / 8);
+    info.frames = frame_size ? info.size / frame_size : 0;
+    // TIPS:半端なバイトは使わない
+    info.size = info.frames * frame_size;
+  }
+
+  enum {
+    // smplチャンク内のデータ位置
+    SMPL_LOOP_NUM   = 28,
+    SMPL_LOOP       = 36,
+    SMPL_LOOP_START = SMPL_LOOP + 8,
+    SMPL_LOOP_END   = SMPL_LOOP + 12,
+    SMPL_LOOP_SIZE  = SMPL_LOOP + 24,
+  };
+  info.loop_start = 0;
+  info.loop_end   = 0;
+  if (smpl && (smpl_size >= SMPL_LOOP_SIZE) && getValue(&smpl[SMPL_LOOP_NUM], 4)) {
+    // TIPS:smplチャンクのループの終わりはそのサンプルを含む
+    u_int start = getValue(&smpl[SMPL_LOOP_START], 4);
+    u_int end   = std::min(getValue(&smpl[SMPL_LOOP_END], 4) + 1, info.frames);
+    if (start < end) {
+      info.loop_start = start;
+      info.loop_end   = end;
+    }
+  }
 
   return true;
 }
-  
+
+// 8/16/24/32bit PCM、32bit float、IMA ADPCMならtrue
+bool Wav::isSupported(const Info& info) {
+  if (isImaAdpcm(info)) return (info.ch == 1) || (info.ch == 2);
+
+  // TIPS:3チャンネル以上はまとめてステレオにする
+  if ((info.ch < 1) || (info.ch > 32)) return false;
+
+  switch (info.id) {
+  case FORMAT_PCM:
+    return (info.bit == 8) || (info.bit == 16) || (info.bit == 24) || (info.bit == 32);
+
+  case FORMAT_IEEE_FLOAT:
+    return info.bit == 32;
+  }
+  return false;
+}
+
+// IMA ADPCMならtrue
+bool Wav::isImaAdpcm(const Info& info) {
+  return (info.id == FORMAT_IMA_ADPCM) && (info.bit == 4)
+    && (info.block_size > info.ch * 4) && !((info.block_size - info.ch * 4) % (info.ch * 4));
+}
+
+// PCMのサンプルの形式
+SampleFormat Wav::sampleFormat(const Info& info) {
+  if (info.id == FORMAT_IEEE_FLOAT) return SampleFormat::FLOAT32;
+
+  switch (info.bit) {
+  case 8:  return SampleFormat::UINT8;
+  case 24: return SampleFormat::INT24;
+  case 32: return SampleFormat::INT32;
+  }
+  return SampleFormat::INT16;
+}
+
+// 再生時のチャンネル数
+u_int Wav::outputChannel(const Info& info, const bool mono) {
+  if (mono) return 1;
+
+  return std::min(info.ch, 2u);
+}
@@ -3,26 +3,54 @@
 
 //
 // wavデータを扱う
+// TIPS:ファイルはメモリに割り当てて読み込む
+//      16bit以外のPCMや3チャンネル以上は、読み込み時に16bitのステレオかモノラルに変換する
 //
 
 #include "defines.hpp"
 #include <string>
 #include <vector>
-#include <fstream>
+#include <memory>
+#include "mappedFile.hpp"
+#include "sampleConvert.hpp"
 
 
 class Wav {
 public:
+  // データ形式
+  enum {
+    FORMAT_PCM        = 1,
+    FORMAT_IEEE_FLOAT = 3,
+    FORMAT_IMA_ADPCM  = 0x11,
+    FORMAT_EXTENSIBLE = 0xfffe,
+  };
+
   struct Info {
+    // データ形式(WAVE_FORMAT_EXTENSIBLEの場合はSubFormatの値)
     u_int id;
     u_int ch;
     u_int sample_rate;
     u_int bit;
     u_int size;
+
+    // ブロックのバイト数(IMA ADPCM)
+    u_int block_size;
+    // スピーカーの配置(WAVE_FORMAT_EXTENSIBLE)
+    u_int channel_mask;
+    // 全体のサンプル数(1チャンネルあたり)
+    u_int frames;
+    // 波形データの位置(ファイルの先頭からのバイト数)
+    size_t offset;
+
+    // ループ範囲(サンプル数、loop_endは含まない)
+    // TIPS:smplチャンクの最初のループを使う。無ければどちらも0
+    u_int loop_start;
+    u_int loop_end;
   };
 
 
-  explicit Wav(const std::string& file);
+  // mono trueならモノラルにまとめる(3D空間に配置する効果音向け)
+  explicit Wav(const std::string& file, const bool mono = false);
 
   // チャンネル数を返す
 	u_int channel() const;
@@ -40,27 +68,41 @@ public:
   float time() const;
 
   // 波形データを返す
+  // TIPS:変換が要らない16bit PCMはメモリに割り当てたファイルの中を直接指している
 	const char* data() const;
 
   
   // wavの情報を取得
-  static bool analyzeWavFile(Info& info, std::ifstream& fstr);
+  // チャンクを先頭から一度だけたどる
+  // data, size ファイルの内容
+  static bool analyzeWavFile(Info& info, const char* data, const size_t size);
+
+  // 8/16/24/32bit PCM、32bit float、IMA ADPCMならtrue
+  static bool isSupported(const Info& info);
+
+  // IMA ADPCMならtrue
+  static bool isImaAdpcm(const Info& info);
+
+  // PCMのサンプルの形式
+  // NOTICE:isSupported()がtrueで、IMA ADPCM以外の時に使う
+  static SampleFormat sampleFormat(const Info& info);
+
+  // 再生時のチャンネル数
+  // TIPS:OpenALで扱えるのはモノラルとステレオだけ
+  static u_int outputChannel(const Info& info, const bool mono);
 
 
 private:
   Info info;
   float time_;
-  std::vector<char> data_;
+  std::shared_ptr<MappedFile> file_;
+
+  // 展開・変換した16bit PCM
+  std::vector<int16_t> data_;
 
   
   // 指定バイト数のメモリの内容をint値にする
   static u_int getValue(const char* ptr, const u_int num);
   
-  // wavの指定チャンクを探す
-  static bool searchChunk(std::ifstream& fstr, const char* chunk);
-
-  // チャンクのサイズを取得
-  static u_int getChunkSize(std::ifstream& fstr);
-  
 };
 